@@ -0,0 +1,141 @@
+#include <gtest/gtest.h>
+
+#include "nix/expr/tests/libexpr.hh"
+#include "nix/expr/print.hh"
+#include "nix/util/environment-variables.hh"
+#include "nix/util/file-system.hh"
+
+namespace nix {
+
+class AstCacheTest : public LibExprTest
+{
+public:
+    AstCacheTest()
+        : LibExprTest(openStore("dummy://"), [](bool & readOnlyMode) {
+            EvalSettings settings{readOnlyMode};
+            settings.nixPath = {};
+            settings.useAstCache = true;
+            return settings;
+        })
+    {
+    }
+
+protected:
+    std::filesystem::path tmpDir = createTempDir();
+    AutoDelete delTmpDir{tmpDir, true};
+
+    void SetUp() override
+    {
+        setEnv("NIX_CACHE_HOME", (tmpDir / "cache").string().c_str());
+    }
+
+    void TearDown() override
+    {
+        unsetenv("NIX_CACHE_HOME");
+    }
+
+    SourcePath writeNixFile(std::string_view contents)
+    {
+        auto file = tmpDir / "default.nix";
+        writeFile(file.string(), contents);
+        return state.rootPath(CanonPath(file.string()));
+    }
+
+    size_t cacheEntries()
+    {
+        auto dir = tmpDir / "cache" / "ast";
+        if (!std::filesystem::exists(dir))
+            return 0;
+        return std::ranges::distance(std::filesystem::directory_iterator(dir), std::filesystem::directory_iterator());
+    }
+
+    std::string show(Expr * e)
+    {
+        std::ostringstream str;
+        e->show(state.symbols, str);
+        return str.str();
+    }
+
+    std::string evalToString(Expr * e)
+    {
+        Value v;
+        state.eval(e, v);
+        state.forceValueDeep(v);
+        std::ostringstream str;
+        printValue(state, str, v);
+        return str.str();
+    }
+};
+
+TEST_F(AstCacheTest, roundTrip)
+{
+    auto path = writeNixFile(R"(
+        let
+          inherit (builtins) map;
+          /** Add two numbers. */
+          add = { a, b ? 2, ... }@args: a + b;
+          neg = x: -x;
+        in
+        rec {
+          x = add { a = 1; };
+          y = [ 1 2.5 "s${toString x}" ./foo ];
+          z = with { q = 1; }; q;
+          w = if x > 2 then assert true; x else null;
+          v = { a.b = 1; } // { c = 1; } ? c;
+          u = !(x == 3) || x != 4 && true -> false;
+          t = __curPos.line;
+          s = ''
+            indented ${"string"}
+          '';
+          r = [ 1 ] ++ map neg [ 2 ];
+          n = (x: x) 1 * 2 - 3 / 1;
+          ${"dyn" + "amic"} = let { body = 1; };
+          a.b.c = 1;
+          a.d = 2;
+        }
+    )");
+
+    auto e1 = state.parseExprFromFile(path);
+    ASSERT_EQ(cacheEntries(), 1u);
+
+    auto e2 = state.parseExprFromFile(path);
+    ASSERT_NE(e1, e2);
+    ASSERT_EQ(show(e1), show(e2));
+    ASSERT_EQ(evalToString(e1), evalToString(e2));
+    ASSERT_EQ(cacheEntries(), 1u);
+}
+
+TEST_F(AstCacheTest, positions)
+{
+    auto path = writeNixFile("\n\n  { a = 1; }");
+
+    state.parseExprFromFile(path);
+    auto e = state.parseExprFromFile(path);
+
+    auto pos = state.positions[e->getPos()];
+    ASSERT_EQ(pos.line, 3u);
+    ASSERT_EQ(pos.column, 3u);
+}
+
+TEST_F(AstCacheTest, changedFile)
+{
+    auto e1 = state.parseExprFromFile(writeNixFile("1"));
+    auto e2 = state.parseExprFromFile(writeNixFile("2"));
+    ASSERT_EQ(cacheEntries(), 2u);
+    ASSERT_EQ(show(e1), "1");
+    ASSERT_EQ(show(e2), "2");
+}
+
+TEST_F(AstCacheTest, corruptEntry)
+{
+    auto path = writeNixFile("{ a = 1; }");
+    auto e1 = state.parseExprFromFile(path);
+
+    for (auto & entry : std::filesystem::directory_iterator(tmpDir / "cache" / "ast"))
+        writeFile(entry.path().string(), "garbage");
+
+    auto e2 = state.parseExprFromFile(path);
+    ASSERT_EQ(show(e1), show(e2));
+}
+
+} // namespace nix
@@ -0,0 +1,63 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "nix/expr/tests/libexpr.hh"
+
+namespace nix {
+
+class BindingsTest : public LibExprTest
+{
+protected:
+    /* A set large enough to be indexed, looked up enough times for the
+       index to be built. */
+    static constexpr size_t size = 1000;
+
+    const std::string largeSet =
+        fmt("builtins.listToAttrs (builtins.genList (i: { name = \"a${toString i}\"; value = i; }) %d)", size);
+
+    void checkLookups(const Bindings & attrs, size_t rounds = 3)
+    {
+        for (size_t round = 0; round < rounds; ++round) {
+            for (size_t i = 0; i < size; ++i) {
+                auto attr = attrs.get(createSymbol(fmt("a%d", i).c_str()));
+                ASSERT_TRUE(attr);
+                state.forceValue(*attr->value, noPos);
+                ASSERT_THAT(*attr->value, IsIntEq(i));
+            }
+            ASSERT_FALSE(attrs.get(createSymbol("b")));
+            ASSERT_FALSE(attrs.get(Symbol()));
+        }
+    }
+};
+
+TEST_F(BindingsTest, largeSet)
+{
+    auto v = eval(largeSet);
+    ASSERT_EQ(v.attrs()->size(), size);
+    checkLookups(*v.attrs());
+}
+
+TEST_F(BindingsTest, layeredOnLargeSet)
+{
+    auto v = eval(fmt("(%s) // { b = true; }", largeSet));
+    ASSERT_EQ(v.attrs()->size(), size + 1);
+    ASSERT_TRUE(v.attrs()->get(createSymbol("b")));
+    checkLookups(*v.attrs());
+}
+
+TEST_F(BindingsTest, evalLookups)
+{
+    auto v = eval(
+        fmt("let s = %s; in builtins.foldl' (acc: i: acc + s.\"a${toString i}\") 0 (builtins.genList (i: i) %d)",
+            largeSet,
+            size));
+    ASSERT_THAT(v, IsIntEq(size * (size - 1) / 2));
+}
+
+TEST_F(BindingsTest, builtins)
+{
+    for (auto & attr : *state.getBuiltins().attrs())
+        ASSERT_EQ(state.getBuiltins().attrs()->get(attr.name), &attr);
+}
+
+} // namespace nix
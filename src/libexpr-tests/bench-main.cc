@@ -0,0 +1,16 @@
+#include <benchmark/benchmark.h>
+#include "nix/expr/eval-gc.hh"
+#include "nix/store/globals.hh"
+
+// Custom main to initialize Nix before running benchmarks
+int main(int argc, char ** argv)
+{
+    // Initialize libstore and the garbage collector
+    nix::initLibStore(false);
+    nix::initGC();
+
+    // Initialize and run benchmarks
+    ::benchmark::Initialize(&argc, argv);
+    ::benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include <benchmark/benchmark.h>
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-gc.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/store-open.hh"
+#include "nix/util/environment-variables.hh"
+
+using namespace nix;
+
+// An evaluator over a dummy store, with or without the specialisation pass
+struct BenchEvalState
+{
+    bool readOnlyMode = true;
+    fetchers::Settings fetchSettings{};
+    EvalSettings evalSettings{readOnlyMode};
+    std::shared_ptr<EvalState> state;
+
+    BenchEvalState(bool specialise)
+    {
+        evalSettings.nixPath = {};
+        evalSettings.specialiseExprs = specialise;
+        state = std::allocate_shared<EvalState>(
+            traceable_allocator<EvalState>(), LookupPath{}, openStore("dummy://"), fetchSettings, evalSettings);
+    }
+};
+
+// Parse the expression once, then evaluate it (deeply) in every iteration
+static void BM_EvalExpr(benchmark::State & state, bool specialise, const std::string & expr)
+{
+    BenchEvalState bench(specialise);
+    auto e = bench.state->parseExprFromString(expr, bench.state->rootPath(CanonPath::root));
+
+    for (auto _ : state) {
+        Value v;
+        bench.state->eval(e, v);
+        bench.state->forceValueDeep(v);
+        benchmark::DoNotOptimize(v);
+    }
+}
+
+static const std::string attrSelects = R"(
+    let
+      attrs = { a = { b = { c = 1; }; }; d = 2; };
+    in
+    builtins.foldl' (acc: i: acc + attrs.a.b.c + attrs.d + (attrs.e or 0)) 0 (builtins.genList (i: i) 10000)
+)";
+
+static const std::string calls = R"(
+    let
+      inc = x: x + 1;
+      add = { x, y ? 1 }: x + y;
+    in
+    builtins.foldl' (acc: i: add { x = inc acc; }) 0 (builtins.genList (i: i) 10000)
+)";
+
+static const std::string interpolation = R"(
+    let
+      name = "hello";
+      version = "2.12";
+    in
+    builtins.genList (i: "${name}-${version}-${toString i}") 10000
+)";
+
+static const std::string attrUpdates = R"(
+    builtins.foldl' (acc: i: acc // { "a${toString (i - i / 100 * 100)}" = i; }) { } (builtins.genList (i: i) 10000)
+)";
+
+BENCHMARK_CAPTURE(BM_EvalExpr, attr_selects, false, attrSelects);
+BENCHMARK_CAPTURE(BM_EvalExpr, attr_selects_specialised, true, attrSelects);
+BENCHMARK_CAPTURE(BM_EvalExpr, calls, false, calls);
+BENCHMARK_CAPTURE(BM_EvalExpr, calls_specialised, true, calls);
+BENCHMARK_CAPTURE(BM_EvalExpr, interpolation, false, interpolation);
+BENCHMARK_CAPTURE(BM_EvalExpr, interpolation_specialised, true, interpolation);
+BENCHMARK_CAPTURE(BM_EvalExpr, attr_updates, false, attrUpdates);
+BENCHMARK_CAPTURE(BM_EvalExpr, attr_updates_specialised, true, attrUpdates);
+
+// Evaluate a package from a Nixpkgs checkout given by NIX_BENCH_NIXPKGS, starting from a fresh evaluator every time
+static void BM_EvalNixpkgs(benchmark::State & state, bool specialise)
+{
+    auto nixpkgs = getEnvNonEmpty("NIX_BENCH_NIXPKGS");
+    if (!nixpkgs) {
+        state.SkipWithError("NIX_BENCH_NIXPKGS is not set");
+        return;
+    }
+
+    for (auto _ : state) {
+        BenchEvalState bench(specialise);
+        auto e = bench.state->parseExprFromString(
+            fmt("(import %s { }).hello.drvPath", *nixpkgs), bench.state->rootPath(CanonPath::root));
+        Value v;
+        bench.state->eval(e, v);
+        bench.state->forceValueDeep(v);
+        benchmark::DoNotOptimize(v);
+    }
+}
+
+BENCHMARK_CAPTURE(BM_EvalNixpkgs, hello, false)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_EvalNixpkgs, hello_specialised, true)->Unit(benchmark::kMillisecond);
@@ -3,6 +3,7 @@
 
 #include "nix/expr/eval.hh"
 #include "nix/expr/tests/libexpr.hh"
+#include "nix/util/file-system.hh"
 #include "nix/util/memory-source-accessor.hh"
 
 namespace nix {
@@ -212,4 +213,159 @@ TEST_F(PureEvalTest, pathExists)
     }
 }
 
+class SpecialiseExprsTest : public LibExprTest
+{
+public:
+    SpecialiseExprsTest()
+        : LibExprTest(openStore("dummy://"), [](bool & readOnlyMode) {
+            EvalSettings settings{readOnlyMode};
+            settings.nixPath = {};
+            settings.specialiseExprs = true;
+            return settings;
+        })
+    {
+    }
+};
+
+TEST_F(SpecialiseExprsTest, substitutesNodes)
+{
+    auto e = state.parseExprFromString(
+        R"(let x = { a = 1; }; f = y: y; in [ x.a (f 1) "${x.a}-" (with x; a) ])", state.rootPath(CanonPath::root));
+
+    auto let = dynamic_cast<ExprLet *>(e);
+    ASSERT_TRUE(let);
+    auto list = dynamic_cast<ExprList *>(let->body);
+    ASSERT_TRUE(list);
+    ASSERT_EQ(list->elems.size(), 4u);
+    ASSERT_TRUE(dynamic_cast<ExprSelectVar *>(list->elems[0]));
+    ASSERT_TRUE(dynamic_cast<ExprCallVar *>(list->elems[1]));
+    ASSERT_TRUE(dynamic_cast<ExprInterpolatedString *>(list->elems[2]));
+    ASSERT_TRUE(dynamic_cast<ExprWith *>(list->elems[3]));
+}
+
+TEST_F(SpecialiseExprsTest, select)
+{
+    ASSERT_THAT(eval("let x = { a.b = 1; }; in x.a.b"), IsIntEq(1));
+    ASSERT_THAT(eval("let x = { a = 1; }; in x.b or 2"), IsIntEq(2));
+    ASSERT_THAT(eval("let x = 1; in x.b or 2"), IsIntEq(2));
+    ASSERT_THAT(eval("with { x = { a = 1; }; }; x.a"), IsIntEq(1));
+    ASSERT_THROW(eval("let x = { a = 1; }; in x.b"), EvalError);
+    ASSERT_THROW(eval("let x = 1; in x.b"), EvalError);
+}
+
+TEST_F(SpecialiseExprsTest, call)
+{
+    ASSERT_THAT(eval("let f = x: y: x + y; in f 1 2"), IsIntEq(3));
+    ASSERT_THAT(eval("let f = x: y: x + y; g = f 1; in g 2"), IsIntEq(3));
+    ASSERT_THAT(eval("let f = { a, b ? 2 }: a + b; in f { a = 1; }"), IsIntEq(3));
+    ASSERT_THROW(eval("let f = 1; in f 2"), EvalError);
+}
+
+TEST_F(SpecialiseExprsTest, interpolation)
+{
+    ASSERT_THAT(eval(R"(let name = "foo"; version = 1; in "${name}-${toString version}")"), IsStringEq("foo-1"));
+    ASSERT_THAT(eval(R"(let x = "a"; in "${x}")"), IsStringEq("a"));
+    ASSERT_THROW(eval(R"(let x = 1; in "${x}")"), EvalError);
+}
+
+class CallCacheTest : public LibExprTest
+{
+public:
+    CallCacheTest()
+        : LibExprTest(openStore("dummy://", {{"read-only", "false"}}), [](bool & readOnlyMode) {
+            EvalSettings settings{readOnlyMode};
+            settings.nixPath = {};
+            settings.callCacheSize = 64;
+            return settings;
+        })
+    {
+    }
+
+    std::pair<Value, Value> evalPair(std::string_view expr)
+    {
+        auto v = eval(fmt("let r = %s; in [ (builtins.elemAt r 0) (builtins.elemAt r 1) ]", expr));
+        auto list = v.listView();
+        state.forceValue(*list[0], noPos);
+        state.forceValue(*list[1], noPos);
+        return {*list[0], *list[1]};
+    }
+};
+
+TEST_F(CallCacheTest, reusesResult)
+{
+    auto [r1, r2] = evalPair("let f = { x }: { y = x; }; v = { x = 1; }; in [ (f v) (f v) ]");
+    ASSERT_EQ(r1.attrs(), r2.attrs());
+}
+
+TEST_F(CallCacheTest, onlyFormals)
+{
+    auto [r1, r2] = evalPair("let f = x: { y = x; }; v = 1; in [ (f v) (f v) ]");
+    ASSERT_NE(r1.attrs(), r2.attrs());
+}
+
+TEST_F(CallCacheTest, formalsIdentifiedByAttrs)
+{
+    auto [r1, r2] = evalPair("let f = { a, b ? 2 }@args: { inherit a b args; }; s = { a = 1; }; in [ (f s) (f s) ]");
+    ASSERT_EQ(r1.attrs(), r2.attrs());
+}
+
+TEST_F(CallCacheTest, distinguishesArguments)
+{
+    auto [r1, r2] = evalPair("let f = { x }: { y = x; }; in [ (f { x = 1; }) (f { x = 1; }) ]");
+    ASSERT_NE(r1.attrs(), r2.attrs());
+}
+
+TEST_F(CallCacheTest, distinguishesClosures)
+{
+    ASSERT_THAT(
+        eval("let mk = y: { x }: x + y; f1 = mk 1; f2 = mk 2; v = { x = 10; }; in f1 v * 100 + f2 v"), IsIntEq(1112));
+}
+
+TEST_F(CallCacheTest, toStringInMap)
+{
+    /* `__toString` is called with temporary values, whose addresses
+       are reused between the elements. */
+    ASSERT_THAT(
+        eval(R"(
+            builtins.concatStringsSep "," (
+              map (x: "${x}") [
+                { __toString = self: self.n; n = "a"; }
+                { __toString = self: self.n; n = "b"; }
+                { __toString = { n, ... }: n; n = "c"; }
+                { __toString = { n, ... }: n; n = "d"; }
+              ]
+            )
+        )"),
+        IsStringEq("a,b,c,d"));
+}
+
+TEST_F(CallCacheTest, pathFilter)
+{
+    /* Path filters are called with an argument on the stack, whose
+       address is the same for every file. */
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir, true);
+    for (auto name : {"a", "b", "c"})
+        writeFile((tmpDir / name).string(), name);
+
+    ASSERT_THAT(
+        eval(fmt(
+            R"(
+                builtins.attrNames (builtins.readDir (builtins.path {
+                  path = %s;
+                  filter = path: type: baseNameOf path == "b";
+                }))
+            )",
+            tmpDir.string())),
+        IsListOfSize(1));
+}
+
+TEST_F(CallCacheTest, errorsNotCached)
+{
+    ASSERT_THAT(
+        eval("let f = x: if x.fail then throw \"fail\" else 1; v = { fail = true; }; in "
+             "(builtins.tryEval (f v)).success || (builtins.tryEval (f v)).success"),
+        IsFalse());
+}
+
 } // namespace nix
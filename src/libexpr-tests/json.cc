@@ -1,6 +1,9 @@
 #include "nix/expr/tests/libexpr.hh"
 #include "nix/expr/value-to-json.hh"
 #include "nix/expr/static-string-data.hh"
+#include "nix/util/serialise.hh"
+
+#include <nlohmann/json.hpp>
 
 namespace nix {
 // Testing the conversion to JSON
@@ -67,6 +70,30 @@ TEST_F(JSONValueTest, StringQuotes)
     ASSERT_EQ(getJSONValue(v), "\"test\\\"\"");
 }
 
+TEST_F(JSONValueTest, SinkMatchesDump)
+{
+    auto v = eval(R"({
+        b = [ 1 (-2) 1.5 1.0e100 0.1 null true false [ ] { } ];
+        a = { "x\ny" = "tab\t quote\" backslash\\ ${builtins.fromJSON "\"\\u0001\\u00e9\""}"; z = { outPath = "out"; }; };
+        "" = "";
+    })");
+
+    StringSink sink;
+    NixStringContext context;
+    printValueAsJSON(state, true, v, noPos, sink, context);
+
+    ASSERT_EQ(sink.s, printValueAsJSON(state, true, v, noPos, context).dump());
+}
+
+TEST_F(JSONValueTest, SinkInvalidUTF8)
+{
+    Value v;
+    v.mkStringNoCopy("\xff"_sds);
+    StringSink sink;
+    NixStringContext context;
+    ASSERT_THROW(printValueAsJSON(state, true, v, noPos, sink, context), JSONSerializationError);
+}
+
 // The dummy store doesn't support writing files. Fails with this exception message:
 // C++ exception with description "error: operation 'addToStoreFromDump' is
 // not supported by store 'dummy'" thrown in the test body.
@@ -739,6 +739,37 @@ TEST_F(PrimOpTest, hashStringInvalidHashAlgorithm)
     ASSERT_THROW(eval("builtins.hashString \"foobar\" \"asdf\""), Error);
 }
 
+TEST_F(PrimOpTest, fromJSONNested)
+{
+    auto v = eval(R"(builtins.fromJSON ''{"b": [1, {"c": [], "d": {}}, "x"], "a": null}'')");
+    ASSERT_THAT(v, IsAttrsOfSize(2));
+    auto b = v.attrs()->get(createSymbol("b"));
+    ASSERT_NE(b, nullptr);
+    state.forceValue(*b->value, noPos);
+    ASSERT_THAT(*b->value, IsListOfSize(3));
+    ASSERT_THAT(*b->value->listView()[0], IsIntEq(1));
+    ASSERT_THAT(*b->value->listView()[1], IsAttrsOfSize(2));
+    ASSERT_THAT(*b->value->listView()[2], IsStringEq("x"));
+
+    v = eval(R"(builtins.fromJSON ''[[[[1]], 2], [], 3]'' == [ [ [ [ 1 ] ] 2 ] [ ] 3 ])");
+    ASSERT_THAT(v, IsTrue());
+}
+
+TEST_F(PrimOpTest, fromJSONDuplicateKeys)
+{
+    auto v = eval(R"(builtins.fromJSON ''{"a": 1, "b": 2, "a": 3}'')");
+    ASSERT_THAT(v, IsAttrsOfSize(2));
+    auto a = v.attrs()->get(createSymbol("a"));
+    ASSERT_NE(a, nullptr);
+    ASSERT_THAT(*a->value, IsIntEq(3));
+}
+
+TEST_F(PrimOpTest, fromJSONInvalid)
+{
+    ASSERT_THROW(eval(R"(builtins.fromJSON ''{"a": [1, 2}'')"), Error);
+    ASSERT_THROW(eval(R"(builtins.fromJSON ''[1] 2'')"), Error);
+}
+
 TEST_F(PrimOpTest, nixPath)
 {
     auto v = eval("builtins.nixPath");
@@ -1005,4 +1036,31 @@ TEST_F(PrimOpTest, genericClosure_not_strict)
     auto v = eval("builtins.genericClosure { startSet = []; }");
     ASSERT_THAT(v, IsListOfSize(0));
 }
+
+TEST_F(PrimOpTest, genericClosure_stringKeys)
+{
+    auto v = eval(R"(
+        map (x: x.key) (builtins.genericClosure {
+          startSet = [ { key = "c"; } ];
+          operator = x: [ { key = "a"; } { key = x.key; } { key = "b"; } ];
+        })
+    )");
+    ASSERT_THAT(v, IsListOfSize(3));
+    ASSERT_THAT(*v.listView()[0], IsStringEq("c"));
+    ASSERT_THAT(*v.listView()[1], IsStringEq("a"));
+    ASSERT_THAT(*v.listView()[2], IsStringEq("b"));
+}
+
+TEST_F(PrimOpTest, genericClosure_mixedKeys)
+{
+    // Integer keys are compared with float keys by value, even after
+    // they have been hashed.
+    auto v = eval(R"(
+        builtins.genericClosure {
+          startSet = [ { key = 1; } { key = 2; } ];
+          operator = x: [ { key = 1.0; } { key = 1.5; } ];
+        }
+    )");
+    ASSERT_THAT(v, IsListOfSize(3));
+}
 } /* namespace nix */
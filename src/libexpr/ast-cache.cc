@@ -0,0 +1,867 @@
+#include "nix/expr/ast-cache.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/store/globals.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/finally.hh"
+#include "nix/util/util.hh"
+#include "nix/util/users.hh"
+
+#include <cstring>
+#include <thread>
+#include <typeinfo>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <boost/unordered/unordered_flat_map.hpp>
+
+namespace nix {
+
+namespace {
+
+/**
+ * Bump this whenever the serialisation format or the syntax tree
+ * changes.
+ */
+constexpr std::string_view astCacheMagic = "nixast01";
+
+enum class AstTag : uint8_t {
+    Int,
+    Float,
+    String,
+    Path,
+    Var,
+    InheritFrom,
+    Select,
+    OpHasAttr,
+    Attrs,
+    List,
+    Lambda,
+    Call,
+    Let,
+    With,
+    If,
+    Assert,
+    OpNot,
+    OpEq,
+    OpNEq,
+    OpAnd,
+    OpOr,
+    OpImpl,
+    OpConcatLists,
+    OpUpdate,
+    ConcatStrings,
+    Pos,
+};
+
+struct AstWriter
+{
+    const EvalState & state;
+    const PosTable::Origin & origin;
+
+    std::string out;
+    uint32_t nrExprs = 0;
+    boost::unordered_flat_map<const Expr *, uint32_t> exprIds;
+
+    std::vector<std::string_view> symbolStrings;
+    boost::unordered_flat_map<Symbol, uint32_t, std::hash<Symbol>> symbolIds;
+
+    template<typename T>
+    void put(T n)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        out.append((const char *) &n, sizeof(n));
+    }
+
+    void putString(std::string_view s)
+    {
+        put<uint32_t>(s.size());
+        out.append(s);
+    }
+
+    void putPos(PosIdx pos)
+    {
+        if (!pos) {
+            put<uint32_t>(0);
+            return;
+        }
+        auto offset = origin.offsetOf(pos);
+        if (offset > origin.size)
+            throw Error("position is not in the file being serialised");
+        put<uint32_t>(offset + 1);
+    }
+
+    void putSymbol(Symbol sym)
+    {
+        if (!sym) {
+            put<uint32_t>(0);
+            return;
+        }
+        auto [i, inserted] = symbolIds.try_emplace(sym, symbolStrings.size() + 1);
+        if (inserted)
+            symbolStrings.push_back(state.symbols[sym]);
+        put<uint32_t>(i->second);
+    }
+
+    void putAttrPath(std::span<const AttrName> attrPath, std::span<const uint32_t> ids)
+    {
+        put<uint32_t>(attrPath.size());
+        for (auto && [i, name] : enumerate(attrPath)) {
+            put<uint8_t>(name.expr ? 1 : 0);
+            if (name.expr)
+                put<uint32_t>(ids[i]);
+            else
+                putSymbol(name.symbol);
+        }
+    }
+
+    std::vector<uint32_t> addAttrPath(std::span<const AttrName> attrPath)
+    {
+        std::vector<uint32_t> ids;
+        for (auto & name : attrPath)
+            ids.push_back(add(name.expr));
+        return ids;
+    }
+
+    template<typename E>
+    uint32_t addBinOp(AstTag tag, const E & e)
+    {
+        auto e1 = add(e.e1), e2 = add(e.e2);
+        put(tag);
+        putPos(e.pos);
+        put(e1);
+        put(e2);
+        return ++nrExprs;
+    }
+
+    /**
+     * Serialise `e` after its children, returning its index (or 0 for
+     * `nullptr`). Expressions that are shared (like the `from` of an
+     * `inherit (from)`) are only serialised once.
+     */
+    uint32_t add(const Expr * e)
+    {
+        if (!e)
+            return 0;
+
+        if (auto i = exprIds.find(e); i != exprIds.end())
+            return i->second;
+
+        auto id = addNew(*e);
+        exprIds.emplace(e, id);
+        return id;
+    }
+
+    uint32_t addNew(const Expr & e)
+    {
+        auto & type = typeid(e);
+
+        if (type == typeid(ExprInt)) {
+            put(AstTag::Int);
+            put(static_cast<const ExprInt &>(e).v.integer().value);
+        }
+
+        else if (type == typeid(ExprFloat)) {
+            put(AstTag::Float);
+            put(static_cast<const ExprFloat &>(e).v.fpoint());
+        }
+
+        else if (type == typeid(ExprString)) {
+            put(AstTag::String);
+            putString(static_cast<const ExprString &>(e).v.string_view());
+        }
+
+        else if (type == typeid(ExprPath)) {
+            auto & e2 = static_cast<const ExprPath &>(e);
+            put(AstTag::Path);
+            /* Absolute paths refer to the root accessor; relative ones
+               to the accessor of the file. */
+            put<uint8_t>(&*e2.accessor == &*state.rootFS ? 1 : 0);
+            putString(e2.v.pathStrView());
+        }
+
+        else if (type == typeid(ExprVar)) {
+            auto & e2 = static_cast<const ExprVar &>(e);
+            put(AstTag::Var);
+            putPos(e2.pos);
+            putSymbol(e2.name);
+        }
+
+        else if (type == typeid(ExprInheritFrom)) {
+            auto & e2 = static_cast<const ExprInheritFrom &>(e);
+            put(AstTag::InheritFrom);
+            putPos(e2.pos);
+            put<uint32_t>(e2.displ);
+        }
+
+        else if (type == typeid(ExprSelect)) {
+            auto & e2 = static_cast<const ExprSelect &>(e);
+            auto sub = add(e2.e), def = add(e2.def);
+            auto ids = addAttrPath(e2.getAttrPath());
+            put(AstTag::Select);
+            putPos(e2.pos);
+            put(sub);
+            put(def);
+            putAttrPath(e2.getAttrPath(), ids);
+        }
+
+        else if (type == typeid(ExprOpHasAttr)) {
+            auto & e2 = static_cast<const ExprOpHasAttr &>(e);
+            auto sub = add(e2.e);
+            auto ids = addAttrPath(e2.attrPath);
+            put(AstTag::OpHasAttr);
+            put(sub);
+            putAttrPath(e2.attrPath, ids);
+        }
+
+        else if (type == typeid(ExprAttrs)) {
+            auto & e2 = static_cast<const ExprAttrs &>(e);
+            std::vector<uint32_t> attrIds, inheritFromIds, dynamicIds;
+            for (auto & [_, def] : *e2.attrs)
+                attrIds.push_back(add(def.e));
+            if (e2.inheritFromExprs)
+                for (auto from : *e2.inheritFromExprs)
+                    inheritFromIds.push_back(add(from));
+            for (auto & def : *e2.dynamicAttrs) {
+                dynamicIds.push_back(add(def.nameExpr));
+                dynamicIds.push_back(add(def.valueExpr));
+            }
+            put(AstTag::Attrs);
+            put<uint8_t>(e2.recursive);
+            putPos(e2.pos);
+            put<uint32_t>(e2.attrs->size());
+            for (auto && [i, attr] : enumerate(*e2.attrs)) {
+                putSymbol(attr.first);
+                put(attr.second.kind);
+                put(attrIds[i]);
+                putPos(attr.second.pos);
+            }
+            put<uint8_t>(e2.inheritFromExprs ? 1 : 0);
+            put<uint32_t>(inheritFromIds.size());
+            for (auto id : inheritFromIds)
+                put(id);
+            put<uint32_t>(e2.dynamicAttrs->size());
+            for (auto && [i, def] : enumerate(*e2.dynamicAttrs)) {
+                put(dynamicIds[2 * i]);
+                put(dynamicIds[2 * i + 1]);
+                putPos(def.pos);
+            }
+        }
+
+        else if (type == typeid(ExprList)) {
+            auto & e2 = static_cast<const ExprList &>(e);
+            std::vector<uint32_t> ids;
+            for (auto elem : e2.elems)
+                ids.push_back(add(elem));
+            put(AstTag::List);
+            put<uint32_t>(ids.size());
+            for (auto id : ids)
+                put(id);
+        }
+
+        else if (type == typeid(ExprLambda)) {
+            auto & e2 = static_cast<const ExprLambda &>(e);
+            auto formals = e2.getFormals();
+            std::vector<uint32_t> defIds;
+            if (formals)
+                for (auto & formal : formals->formals)
+                    defIds.push_back(add(formal.def));
+            auto body = add(e2.body);
+            put(AstTag::Lambda);
+            putPos(e2.pos);
+            putSymbol(e2.name);
+            putSymbol(e2.arg);
+            put<uint8_t>(formals ? 1 : 0);
+            if (formals) {
+                put<uint8_t>(formals->ellipsis);
+                put<uint32_t>(formals->formals.size());
+                for (auto && [i, formal] : enumerate(formals->formals)) {
+                    putPos(formal.pos);
+                    putSymbol(formal.name);
+                    put(defIds[i]);
+                }
+            }
+            put(body);
+            putPos(e2.docComment.begin);
+            putPos(e2.docComment.end);
+        }
+
+        else if (type == typeid(ExprCall)) {
+            auto & e2 = static_cast<const ExprCall &>(e);
+            auto fun = add(e2.fun);
+            std::vector<uint32_t> ids;
+            for (auto arg : *e2.args)
+                ids.push_back(add(arg));
+            put(AstTag::Call);
+            putPos(e2.pos);
+            put(fun);
+            put<uint32_t>(ids.size());
+            for (auto id : ids)
+                put(id);
+        }
+
+        else if (type == typeid(ExprLet)) {
+            auto & e2 = static_cast<const ExprLet &>(e);
+            auto attrs = add(e2.attrs), body = add(e2.body);
+            put(AstTag::Let);
+            put(attrs);
+            put(body);
+        }
+
+        else if (type == typeid(ExprWith)) {
+            auto & e2 = static_cast<const ExprWith &>(e);
+            auto attrs = add(e2.attrs), body = add(e2.body);
+            put(AstTag::With);
+            putPos(e2.pos);
+            put(attrs);
+            put(body);
+        }
+
+        else if (type == typeid(ExprIf)) {
+            auto & e2 = static_cast<const ExprIf &>(e);
+            auto cond = add(e2.cond), then = add(e2.then), else_ = add(e2.else_);
+            put(AstTag::If);
+            putPos(e2.pos);
+            put(cond);
+            put(then);
+            put(else_);
+        }
+
+        else if (type == typeid(ExprAssert)) {
+            auto & e2 = static_cast<const ExprAssert &>(e);
+            auto cond = add(e2.cond), body = add(e2.body);
+            put(AstTag::Assert);
+            putPos(e2.pos);
+            put(cond);
+            put(body);
+        }
+
+        else if (type == typeid(ExprOpNot)) {
+            auto sub = add(static_cast<const ExprOpNot &>(e).e);
+            put(AstTag::OpNot);
+            put(sub);
+        }
+
+        else if (type == typeid(ExprOpEq))
+            return addBinOp(AstTag::OpEq, static_cast<const ExprOpEq &>(e));
+        else if (type == typeid(ExprOpNEq))
+            return addBinOp(AstTag::OpNEq, static_cast<const ExprOpNEq &>(e));
+        else if (type == typeid(ExprOpAnd))
+            return addBinOp(AstTag::OpAnd, static_cast<const ExprOpAnd &>(e));
+        else if (type == typeid(ExprOpOr))
+            return addBinOp(AstTag::OpOr, static_cast<const ExprOpOr &>(e));
+        else if (type == typeid(ExprOpImpl))
+            return addBinOp(AstTag::OpImpl, static_cast<const ExprOpImpl &>(e));
+        else if (type == typeid(ExprOpConcatLists))
+            return addBinOp(AstTag::OpConcatLists, static_cast<const ExprOpConcatLists &>(e));
+        else if (type == typeid(ExprOpUpdate))
+            return addBinOp(AstTag::OpUpdate, static_cast<const ExprOpUpdate &>(e));
+
+        else if (type == typeid(ExprConcatStrings)) {
+            auto & e2 = static_cast<const ExprConcatStrings &>(e);
+            std::vector<uint32_t> ids;
+            for (auto & [_, part] : e2.es)
+                ids.push_back(add(part));
+            put(AstTag::ConcatStrings);
+            putPos(e2.pos);
+            put<uint8_t>(e2.forceString);
+            put<uint32_t>(ids.size());
+            for (auto && [i, part] : enumerate(e2.es)) {
+                putPos(part.first);
+                put(ids[i]);
+            }
+        }
+
+        else if (type == typeid(ExprPos)) {
+            put(AstTag::Pos);
+            putPos(static_cast<const ExprPos &>(e).pos);
+        }
+
+        else
+            throw Error("cannot serialise expression of type '%s'", type.name());
+
+        return ++nrExprs;
+    }
+};
+
+struct AstReader
+{
+    EvalState & state;
+    std::string_view data;
+    const PosTable::Origin & origin;
+    const SourcePath & basePath;
+
+    std::vector<Symbol> symbols;
+    std::vector<Expr *> exprs;
+
+    [[noreturn]] void corrupt()
+    {
+        throw Error("AST cache entry is corrupt");
+    }
+
+    std::string_view getBytes(size_t n)
+    {
+        if (n > data.size())
+            corrupt();
+        auto res = data.substr(0, n);
+        data.remove_prefix(n);
+        return res;
+    }
+
+    template<typename T>
+    T get()
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T n;
+        std::memcpy(&n, getBytes(sizeof(n)).data(), sizeof(n));
+        return n;
+    }
+
+    std::string_view getString()
+    {
+        return getBytes(get<uint32_t>());
+    }
+
+    PosIdx getPos()
+    {
+        auto offset = get<uint32_t>();
+        if (!offset)
+            return noPos;
+        if (offset - 1 > origin.size)
+            corrupt();
+        return state.positions.add(origin, offset - 1);
+    }
+
+    Symbol getSymbol()
+    {
+        auto id = get<uint32_t>();
+        if (!id)
+            return {};
+        if (id > symbols.size())
+            corrupt();
+        return symbols[id - 1];
+    }
+
+    /**
+     * Return a previously read expression, or `nullptr`.
+     */
+    Expr * getExpr()
+    {
+        auto id = get<uint32_t>();
+        if (!id)
+            return nullptr;
+        if (id > exprs.size())
+            corrupt();
+        return exprs[id - 1];
+    }
+
+    Expr * getNonNullExpr()
+    {
+        auto e = getExpr();
+        if (!e)
+            corrupt();
+        return e;
+    }
+
+    /**
+     * Return the size of a table whose entries take at least
+     * `entrySize` bytes, making sure the data can hold it.
+     */
+    uint32_t getCount(size_t entrySize)
+    {
+        auto n = get<uint32_t>();
+        if ((uint64_t) n * entrySize > data.size())
+            corrupt();
+        return n;
+    }
+
+    AttrSelectionPath getAttrPath()
+    {
+        AttrSelectionPath attrPath;
+        auto n = getCount(5);
+        for (uint32_t i = 0; i < n; ++i) {
+            if (get<uint8_t>())
+                attrPath.emplace_back(getNonNullExpr());
+            else
+                attrPath.emplace_back(getSymbol());
+        }
+        return attrPath;
+    }
+
+    template<typename E>
+    Expr * getBinOp()
+    {
+        auto pos = getPos();
+        auto e1 = getNonNullExpr();
+        auto e2 = getNonNullExpr();
+        return state.mem.exprs.add<E>(pos, e1, e2);
+    }
+
+    Expr * getNode()
+    {
+        auto & exprs = state.mem.exprs;
+
+        switch (get<AstTag>()) {
+
+        case AstTag::Int:
+            return exprs.add<ExprInt>(get<NixInt::Inner>());
+
+        case AstTag::Float:
+            return exprs.add<ExprFloat>(get<NixFloat>());
+
+        case AstTag::String:
+            return exprs.add<ExprString>(exprs.alloc, getString());
+
+        case AstTag::Path: {
+            auto isRoot = get<uint8_t>();
+            return exprs.add<ExprPath>(exprs.alloc, isRoot ? state.rootFS : basePath.accessor, getString());
+        }
+
+        case AstTag::Var: {
+            auto pos = getPos();
+            return exprs.add<ExprVar>(pos, getSymbol());
+        }
+
+        case AstTag::InheritFrom: {
+            auto pos = getPos();
+            return exprs.add<ExprInheritFrom>(pos, get<uint32_t>());
+        }
+
+        case AstTag::Select: {
+            auto pos = getPos();
+            auto e = getNonNullExpr();
+            auto def = getExpr();
+            auto attrPath = getAttrPath();
+            if (attrPath.empty())
+                corrupt();
+            return exprs.add<ExprSelect>(exprs.alloc, pos, e, attrPath, def);
+        }
+
+        case AstTag::OpHasAttr: {
+            auto e = getNonNullExpr();
+            auto attrPath = getAttrPath();
+            return exprs.add<ExprOpHasAttr>(exprs.alloc, e, attrPath);
+        }
+
+        case AstTag::Attrs: {
+            auto e = exprs.add<ExprAttrs>();
+            e->recursive = get<uint8_t>();
+            e->pos = getPos();
+            auto nAttrs = getCount(16);
+            for (uint32_t i = 0; i < nAttrs; ++i) {
+                auto name = getSymbol();
+                auto kind = get<ExprAttrs::AttrDef::Kind>();
+                if (kind != ExprAttrs::AttrDef::Kind::Plain && kind != ExprAttrs::AttrDef::Kind::Inherited
+                    && kind != ExprAttrs::AttrDef::Kind::InheritedFrom)
+                    corrupt();
+                auto value = getNonNullExpr();
+                e->attrs->emplace(name, ExprAttrs::AttrDef(value, getPos(), kind));
+            }
+            if (get<uint8_t>()) {
+                e->inheritFromExprs = std::make_unique<std::pmr::vector<Expr *>>();
+                auto n = getCount(4);
+                for (uint32_t i = 0; i < n; ++i)
+                    e->inheritFromExprs->push_back(getNonNullExpr());
+            } else if (get<uint32_t>())
+                corrupt();
+            auto nDynamic = getCount(12);
+            for (uint32_t i = 0; i < nDynamic; ++i) {
+                auto nameExpr = getNonNullExpr();
+                auto valueExpr = getNonNullExpr();
+                e->dynamicAttrs->emplace_back(nameExpr, valueExpr, getPos());
+            }
+            return e;
+        }
+
+        case AstTag::List: {
+            std::vector<Expr *> elems(getCount(4));
+            for (auto & elem : elems)
+                elem = getNonNullExpr();
+            return exprs.add<ExprList>(exprs.alloc, elems);
+        }
+
+        case AstTag::Lambda: {
+            auto pos = getPos();
+            auto name = getSymbol();
+            auto arg = getSymbol();
+            ExprLambda * e;
+            if (get<uint8_t>()) {
+                FormalsBuilder formals;
+                formals.ellipsis = get<uint8_t>();
+                auto n = getCount(12);
+                for (uint32_t i = 0; i < n; ++i) {
+                    auto formalPos = getPos();
+                    auto formalName = getSymbol();
+                    formals.formals.push_back(Formal{formalPos, formalName, getExpr()});
+                }
+                auto body = getNonNullExpr();
+                e = exprs.add<ExprLambda>(state.positions, exprs.alloc, pos, arg, formals, body);
+            } else {
+                auto body = getNonNullExpr();
+                e = exprs.add<ExprLambda>(pos, arg, body);
+            }
+            /* Set these directly rather than through setName() and
+               setDocComment(), which would propagate them to the body
+               again. */
+            e->name = name;
+            e->docComment.begin = getPos();
+            e->docComment.end = getPos();
+            return e;
+        }
+
+        case AstTag::Call: {
+            auto pos = getPos();
+            auto fun = getNonNullExpr();
+            std::pmr::vector<Expr *> args(getCount(4));
+            for (auto & arg : args)
+                arg = getNonNullExpr();
+            return exprs.add<ExprCall>(pos, fun, std::move(args));
+        }
+
+        case AstTag::Let: {
+            auto attrs = dynamic_cast<ExprAttrs *>(getNonNullExpr());
+            if (!attrs)
+                corrupt();
+            return exprs.add<ExprLet>(attrs, getNonNullExpr());
+        }
+
+        case AstTag::With: {
+            auto pos = getPos();
+            auto attrs = getNonNullExpr();
+            return exprs.add<ExprWith>(pos, attrs, getNonNullExpr());
+        }
+
+        case AstTag::If: {
+            auto pos = getPos();
+            auto cond = getNonNullExpr();
+            auto then = getNonNullExpr();
+            return exprs.add<ExprIf>(pos, cond, then, getNonNullExpr());
+        }
+
+        case AstTag::Assert: {
+            auto pos = getPos();
+            auto cond = getNonNullExpr();
+            return exprs.add<ExprAssert>(pos, cond, getNonNullExpr());
+        }
+
+        case AstTag::OpNot:
+            return exprs.add<ExprOpNot>(getNonNullExpr());
+
+        case AstTag::OpEq:
+            return getBinOp<ExprOpEq>();
+        case AstTag::OpNEq:
+            return getBinOp<ExprOpNEq>();
+        case AstTag::OpAnd:
+            return getBinOp<ExprOpAnd>();
+        case AstTag::OpOr:
+            return getBinOp<ExprOpOr>();
+        case AstTag::OpImpl:
+            return getBinOp<ExprOpImpl>();
+        case AstTag::OpConcatLists:
+            return getBinOp<ExprOpConcatLists>();
+        case AstTag::OpUpdate:
+            return getBinOp<ExprOpUpdate>();
+
+        case AstTag::ConcatStrings: {
+            auto pos = getPos();
+            bool forceString = get<uint8_t>();
+            std::vector<std::pair<PosIdx, Expr *>> parts(getCount(8));
+            for (auto & part : parts) {
+                part.first = getPos();
+                part.second = getNonNullExpr();
+            }
+            return exprs.add<ExprConcatStrings>(exprs.alloc, pos, forceString, std::span(parts));
+        }
+
+        case AstTag::Pos:
+            return exprs.add<ExprPos>(getPos());
+        }
+
+        corrupt();
+    }
+};
+
+} // namespace
+
+Hash getAstCacheKey(const EvalState & state, std::string_view source, const SourcePath & basePath)
+{
+    HashSink sink(HashAlgorithm::SHA256);
+
+    auto field = [&](std::string_view s) {
+        sink(std::to_string(s.size()));
+        sink(":");
+        sink(s);
+    };
+
+    field(astCacheMagic);
+    field(nixVersion);
+    /* Relative path literals are resolved when parsing. */
+    field(basePath.path.abs());
+    /* So are `~/...` paths, which are rejected in pure mode. */
+    field(getHome().string());
+    field(state.settings.pureEval ? "pure" : "impure");
+    field(state.settings.warnShortPathLiterals ? "warn" : "nowarn");
+    field(experimentalFeatureSettings.isEnabled(Xp::PipeOperators) ? "pipes" : "nopipes");
+    field(experimentalFeatureSettings.isEnabled(Xp::NoUrlLiterals) ? "nourls" : "urls");
+    field(source);
+
+    return sink.finish().hash;
+}
+
+std::string serialiseAst(
+    const EvalState & state,
+    Expr * e,
+    const PosTable::Origin & origin,
+    const PosTable::Lines & lines,
+    const DocCommentMap & docComments)
+{
+    AstWriter writer{.state = state, .origin = origin};
+
+    auto root = writer.add(e);
+    auto nodes = std::exchange(writer.out, {});
+
+    writer.out.append(astCacheMagic);
+    writer.put<uint32_t>(1);
+
+    writer.put<uint32_t>(writer.symbolStrings.size());
+    for (auto & s : writer.symbolStrings)
+        writer.putString(s);
+
+    writer.put<uint32_t>(lines.size());
+    for (auto line : lines)
+        writer.put(line);
+
+    /* Doc comments of other files with the same path (i.e. earlier
+       versions of this one) are skipped. */
+    std::vector<std::pair<PosIdx, DocComment>> comments;
+    for (auto & [pos, comment] : docComments)
+        if (origin.offsetOf(pos) <= origin.size)
+            comments.emplace_back(pos, comment);
+
+    writer.put<uint32_t>(comments.size());
+    for (auto & [pos, comment] : comments) {
+        writer.putPos(pos);
+        writer.putPos(comment.begin);
+        writer.putPos(comment.end);
+    }
+
+    writer.put<uint32_t>(writer.nrExprs);
+    writer.put(root);
+    writer.out.append(nodes);
+
+    return std::move(writer.out);
+}
+
+Expr * deserialiseAst(
+    EvalState & state,
+    std::string_view data,
+    const PosTable::Origin & origin,
+    const SourcePath & basePath,
+    DocCommentMap & docComments)
+{
+    AstReader reader{.state = state, .data = data, .origin = origin, .basePath = basePath};
+
+    if (reader.getBytes(astCacheMagic.size()) != astCacheMagic)
+        throw Error("not an AST cache entry");
+    if (reader.get<uint32_t>() != 1)
+        throw Error("AST cache entry has the wrong byte order");
+
+    auto nSymbols = reader.getCount(4);
+    reader.symbols.reserve(nSymbols);
+    for (uint32_t i = 0; i < nSymbols; ++i)
+        reader.symbols.push_back(state.symbols.create(reader.getString()));
+
+    PosTable::Lines lines(reader.getCount(4));
+    for (auto & line : lines)
+        line = reader.get<uint32_t>();
+
+    std::vector<std::pair<PosIdx, DocComment>> comments(reader.getCount(12));
+    for (auto & [pos, comment] : comments) {
+        pos = reader.getPos();
+        comment.begin = reader.getPos();
+        comment.end = reader.getPos();
+    }
+
+    auto nExprs = reader.getCount(1);
+    auto root = reader.get<uint32_t>();
+    if (!root || root > nExprs)
+        reader.corrupt();
+
+    reader.exprs.reserve(nExprs);
+    for (uint32_t i = 0; i < nExprs; ++i)
+        reader.exprs.push_back(reader.getNode());
+
+    if (!reader.data.empty())
+        reader.corrupt();
+
+    if (!lines.empty())
+        state.positions.addLines(origin, std::move(lines));
+
+    for (auto & [pos, comment] : comments)
+        docComments.insert_or_assign(pos, comment);
+
+    return reader.exprs[root - 1];
+}
+
+static std::filesystem::path astCachePath(const Hash & key)
+{
+    return getCacheDir() / "ast" / key.to_string(HashFormat::Nix32, false);
+}
+
+Expr * loadCachedAst(
+    EvalState & state,
+    const Hash & key,
+    const PosTable::Origin & origin,
+    const SourcePath & basePath,
+    DocCommentMap & docComments)
+{
+    auto path = astCachePath(key);
+
+    AutoCloseFD fd = toDescriptor(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (!fd)
+        return nullptr;
+
+    try {
+        struct stat st;
+        if (fstat(fd.get(), &st) == -1)
+            throw SysError("statting %s", path);
+
+        if (st.st_size == 0)
+            throw Error("AST cache entry is empty");
+
+        auto p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+        if (p == MAP_FAILED)
+            throw SysError("mapping %s", path);
+        Finally unmap([&]() { munmap(p, st.st_size); });
+
+        return deserialiseAst(state, {(const char *) p, (size_t) st.st_size}, origin, basePath, docComments);
+    } catch (Error & e) {
+        debug("cannot use AST cache entry %s: %s", path, e.what());
+        return nullptr;
+    }
+}
+
+void saveCachedAst(
+    const EvalState & state,
+    const Hash & key,
+    Expr * e,
+    const PosTable::Origin & origin,
+    const PosTable::Lines & lines,
+    const DocCommentMap & docComments)
+{
+    auto path = astCachePath(key);
+
+    try {
+        auto data = serialiseAst(state, e, origin, lines, docComments);
+        createDirs(path.parent_path());
+        auto tmpFile = path;
+        tmpFile += fmt(".tmp-%d-%d", getpid(), std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        writeFile(tmpFile, data);
+        std::filesystem::rename(tmpFile, path);
+    } catch (std::exception & e) {
+        debug("cannot write AST cache entry %s: %s", path, e.what());
+    }
+}
+
+} // namespace nix
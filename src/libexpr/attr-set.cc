@@ -1,12 +1,19 @@
 #include "nix/expr/attr-set.hh"
 #include "nix/expr/eval-inline.hh"
+#include "nix/util/util.hh"
 
 #include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
 
 namespace nix {
 
 Bindings Bindings::emptyBindings;
 
+Counter Bindings::nrIndexes;
+Counter Bindings::nrIndexBytes;
+
 /* Allocate a new array of attributes for an attribute set with a specific
    capacity. The space is implicitly reserved after the Bindings
    structure. */
@@ -18,7 +25,10 @@ Bindings * EvalMemory::allocBindings(size_t capacity)
         throw Error("attribute set of size %d is too big", capacity);
     stats.nrAttrsets++;
     stats.nrAttrsInAttrsets += capacity;
-    return new (allocBytes(sizeof(Bindings) + sizeof(Attr) * capacity)) Bindings();
+    /* Reserve room for the index pointer of large attribute sets (see
+       Bindings::getIndexed()). */
+    auto slots = capacity >= Bindings::indexThreshold ? capacity + 1 : capacity;
+    return new (allocBytes(sizeof(Bindings) + sizeof(Attr) * slots)) Bindings();
 }
 
 Value & BindingsBuilder::alloc(Symbol name, PosIdx pos)
@@ -33,9 +43,109 @@ Value & BindingsBuilder::alloc(std::string_view name, PosIdx pos)
     return alloc(symbols.get().create(name), pos);
 }
 
+namespace {
+
+/**
+ * An open-addressing hash table mapping the names in a Bindings layer
+ * to the positions of their attributes. It is probed linearly, and
+ * since the entries are small and the table is at most half full, a
+ * lookup usually reads a single cache line, without touching the
+ * attributes that don't match.
+ */
+struct BindingsIndex
+{
+    struct Entry
+    {
+        /**
+         * The symbol ID, or 0 for an empty entry.
+         */
+        uint32_t name;
+        Bindings::size_type pos;
+    };
+
+    uint32_t shift;
+    uint32_t mask;
+    Entry entries[0];
+
+    uint32_t home(Symbol name) const noexcept
+    {
+        /* Fibonacci hashing; symbol IDs are sequential. */
+        return (name.getId() * 0x9e3779b9u) >> shift;
+    }
+
+    static size_t sizeFor(size_t nrEntries)
+    {
+        return sizeof(BindingsIndex) + nrEntries * sizeof(Entry);
+    }
+
+    static BindingsIndex * build(std::span<const Attr> attrs)
+    {
+        auto nrEntries = std::bit_ceil(attrs.size() * 2);
+        auto index = (BindingsIndex *) GC_MALLOC_ATOMIC(sizeFor(nrEntries));
+        if (!index)
+            return nullptr;
+        std::memset(index, 0, sizeFor(nrEntries));
+        index->shift = 32 - std::countr_zero(nrEntries);
+        index->mask = nrEntries - 1;
+        for (auto [pos, attr] : enumerate(attrs)) {
+            auto i = index->home(attr.name);
+            while (index->entries[i].name)
+                i = (i + 1) & index->mask;
+            index->entries[i] = {attr.name.getId(), (Bindings::size_type) pos};
+        }
+        return index;
+    }
+};
+
+} // namespace
+
+const Attr * Bindings::getIndexed(Symbol name) const noexcept
+{
+    /* The word after the last attribute is 0 or, with the low bit set,
+       the number of lookups done so far; or it points to the index. */
+    std::atomic_ref<uintptr_t> slot(*reinterpret_cast<uintptr_t *>(const_cast<Attr *>(attrs + numAttrs)));
+    auto word = slot.load(std::memory_order_acquire);
+
+    if (word == 0 || word & 1) {
+        auto lookups = word >> 1;
+        BindingsIndex * index = nullptr;
+
+        if (lookups < numAttrs / 8) {
+            slot.compare_exchange_weak(word, ((lookups + 1) << 1) | 1, std::memory_order_relaxed);
+        } else if ((index = BindingsIndex::build({attrs, numAttrs}))) {
+            /* Publish the index, unless another thread beat us to it. */
+            while (word == 0 || word & 1) {
+                if (slot.compare_exchange_weak(word, (uintptr_t) index, std::memory_order_acq_rel)) {
+                    nrIndexes++;
+                    nrIndexBytes += BindingsIndex::sizeFor(index->mask + 1);
+                    word = (uintptr_t) index;
+                }
+            }
+        }
+
+        if (word == 0 || word & 1) {
+            auto i = std::lower_bound(attrs, attrs + numAttrs, Attr{name, nullptr});
+            return i != attrs + numAttrs && i->name == name ? i : nullptr;
+        }
+    }
+
+    auto & index = *(const BindingsIndex *) word;
+    for (auto i = index.home(name);; i = (i + 1) & index.mask) {
+        auto & entry = index.entries[i];
+        if (!entry.name)
+            return nullptr;
+        if (entry.name == name.getId())
+            return &attrs[entry.pos];
+    }
+}
+
 void Bindings::sort()
 {
     std::sort(attrs, attrs + numAttrs);
+    /* Drop the lookup count or index of the unsorted attributes (this
+       happens for the builtins set, which is sorted in place). */
+    if (numAttrs >= indexThreshold)
+        attrs[numAttrs] = Attr{};
 }
 
 Value & Value::mkAttrs(BindingsBuilder & bindings)
@@ -1,4 +1,5 @@
 #include "nix/expr/eval.hh"
+#include "nix/expr/ast-cache.hh"
 #include "nix/expr/eval-settings.hh"
 #include "nix/expr/primops.hh"
 #include "nix/expr/print-options.hh"
@@ -45,6 +46,7 @@
 
 #include <nlohmann/json.hpp>
 #include <boost/container/small_vector.hpp>
+#include <boost/container_hash/hash.hpp>
 #include <boost/unordered/concurrent_flat_map.hpp>
 #include <boost/unordered/unordered_flat_set.hpp>
 
@@ -344,6 +346,9 @@ EvalState::EvalState(
 
     countCalls = getEnv("NIX_COUNT_CALLS").value_or("0") != "0";
 
+    if (settings.callCacheSize)
+        callCache.lock()->resize(settings.callCacheSize);
+
     static_assert(sizeof(Env) <= 16, "environment must be <= 16 bytes");
     static_assert(sizeof(Counter) == 64, "counters must be 64 bytes");
 
@@ -1425,10 +1430,21 @@ static std::string showAttrSelectionPath(EvalState & state, Env & env, std::span
 void ExprSelect::eval(EvalState & state, Env & env, Value & v)
 {
     Value vTmp;
-    PosIdx pos2;
-    Value * vAttrs = &vTmp;
-
     e->eval(state, env, vTmp);
+    evalAttrPath(state, env, vTmp, v);
+}
+
+void ExprSelectVar::eval(EvalState & state, Env & env, Value & v)
+{
+    Value * vVar = state.lookupVar(&env, var, false);
+    state.forceValue(*vVar, var.pos);
+    evalAttrPath(state, env, *vVar, v);
+}
+
+void ExprSelect::evalAttrPath(EvalState & state, Env & env, Value & vStart, Value & v)
+{
+    PosIdx pos2;
+    Value * vAttrs = &vStart;
 
     try {
         auto dts = state.debugRepl ? makeDebugTraceStacker(
@@ -1531,6 +1547,39 @@ void ExprLambda::eval(EvalState & state, Env & env, Value & v)
 
 thread_local size_t EvalState::callDepth = 0;
 
+static size_t callCacheSlot(Env & env, ExprLambda & fun, const void * arg, size_t size)
+{
+    size_t h = 0;
+    boost::hash_combine(h, &env);
+    boost::hash_combine(h, &fun);
+    boost::hash_combine(h, arg);
+    return h % size;
+}
+
+bool EvalState::lookupCallCache(Env & env, ExprLambda & fun, const void * arg, Value & v)
+{
+    auto cache(callCache.lock());
+    auto & entry = (*cache)[callCacheSlot(env, fun, arg, cache->size())];
+    if (entry.env != &env || entry.fun != &fun || entry.arg != arg) {
+        nrCallCacheMisses++;
+        return false;
+    }
+    nrCallCacheHits++;
+    v = entry.result;
+    return true;
+}
+
+void EvalState::insertCallCache(Env & env, ExprLambda & fun, const void * arg, const Value & v)
+{
+    auto cache(callCache.lock());
+    (*cache)[callCacheSlot(env, fun, arg, cache->size())] = {
+        .env = &env,
+        .fun = &fun,
+        .arg = arg,
+        .result = v,
+    };
+}
+
 void EvalState::callFunction(Value & fun, std::span<Value *> args, Value & vRes, const PosIdx pos)
 {
     auto _level = addCallDepth(pos);
@@ -1581,8 +1630,17 @@ void EvalState::callFunction(Value & fun, std::span<Value *> args, Value & vRes,
                     throw;
                 }
 
-                if (lambda.arg)
-                    env2.values[displ++] = args[0];
+                if (lambda.arg) {
+                    /* The result of a cached call may outlive the call,
+                       so it must not refer to the argument value, which
+                       the caller may have allocated on the stack. */
+                    if (settings.callCacheSize && !debugRepl) {
+                        auto arg = allocValue();
+                        *arg = *args[0];
+                        env2.values[displ++] = arg;
+                    } else
+                        env2.values[displ++] = args[0];
+                }
 
                 /* For each formal argument, get the actual argument.  If
                    there is no matching actual argument but the formal
@@ -1635,6 +1693,22 @@ void EvalState::callFunction(Value & fun, std::span<Value *> args, Value & vRes,
                 env2.values[displ++] = args[0];
             }
 
+            /* If enabled, reuse the result of an earlier application of
+               this closure to the same argument. Only functions with
+               formals are cached: their argument has been forced, so
+               it can be identified by its attribute set, which lives
+               on the heap and is shared by copies of the value. Other
+               arguments may be temporaries on the caller's stack, whose
+               addresses are reused. */
+            const void * cacheArg = nullptr;
+            if (settings.callCacheSize && !debugRepl && lambda.getFormals()) {
+                cacheArg = args[0]->attrs();
+                if (lookupCallCache(*env2.up, lambda, cacheArg, vCur)) {
+                    args = args.subspan(1);
+                    continue;
+                }
+            }
+
             nrFunctionCalls++;
             if (countCalls)
                 incrFunctionCall(&lambda);
@@ -1666,6 +1740,9 @@ void EvalState::callFunction(Value & fun, std::span<Value *> args, Value & vRes,
                 throw;
             }
 
+            if (cacheArg)
+                insertCallCache(*env2.up, lambda, cacheArg, vCur);
+
             args = args.subspan(1);
         }
 
@@ -1801,6 +1878,20 @@ void ExprCall::eval(EvalState & state, Env & env, Value & v)
     state.callFunction(vFun, vArgs, v, pos);
 }
 
+void ExprCallVar::eval(EvalState & state, Env & env, Value & v)
+{
+    /* callFunction() copies the function, so there's no need to copy
+       it here as well. */
+    Value * vFun = state.lookupVar(&env, var, false);
+    state.forceValue(*vFun, var.pos);
+
+    SmallValueVector<4> vArgs(args->size());
+    for (size_t i = 0; i < args->size(); ++i)
+        vArgs[i] = (*args)[i]->maybeThunk(state, env);
+
+    state.callFunction(*vFun, vArgs, v, pos);
+}
+
 // Lifted out of callFunction() because it creates a temporary that
 // prevents tail-call optimisation.
 void EvalState::incrFunctionCall(ExprLambda * fun)
@@ -2167,6 +2258,36 @@ void ExprConcatStrings::eval(EvalState & state, Env & env, Value & v)
     }
 }
 
+void ExprInterpolatedString::eval(EvalState & state, Env & env, Value & v)
+{
+    NixStringContext context;
+    boost::container::small_vector<BackedStringView, 4> strings;
+    size_t sSize = 0;
+
+    // List of returned strings. References to these Values must NOT be persisted.
+    SmallTemporaryValueVector<conservativeStackReservation> values(es.size());
+    Value * vTmpP = values.data();
+
+    strings.reserve(es.size());
+
+    for (auto & [i_pos, i] : es) {
+        Value & vTmp = *vTmpP++;
+        i->eval(state, env, vTmp);
+        auto part = state.coerceToString(i_pos, vTmp, context, "while evaluating a path segment", false, true, true);
+        sSize += part->size();
+        strings.emplace_back(std::move(part));
+    }
+
+    auto & resultStr = StringData::alloc(state.mem, sSize);
+    auto * tmp = resultStr.data();
+    for (const auto & part : strings) {
+        std::memcpy(tmp, part->data(), part->size());
+        tmp += part->size();
+    }
+    *tmp = '\0';
+    v.mkStringMove(resultStr, context, state.mem);
+}
+
 void ExprPos::eval(EvalState & state, Env & env, Value & v)
 {
     state.mkPos(v, pos);
@@ -3030,6 +3151,8 @@ void EvalState::printStatistics()
         {"number", memstats.nrAttrsets.load()},
         {"bytes", bAttrsets},
         {"elements", memstats.nrAttrsInAttrsets.load()},
+        {"indexes", Bindings::nrIndexes.load()},
+        {"indexBytes", Bindings::nrIndexBytes.load()},
     };
     topObj["sizes"] = {
         {"Env", sizeof(Env)},
@@ -3049,6 +3172,11 @@ void EvalState::printStatistics()
     topObj["nrLookups"] = nrLookups.load();
     topObj["nrPrimOpCalls"] = nrPrimOpCalls.load();
     topObj["nrFunctionCalls"] = nrFunctionCalls.load();
+    topObj["callCache"] = {
+        {"size", settings.callCacheSize.get()},
+        {"hits", nrCallCacheHits.load()},
+        {"misses", nrCallCacheMisses.load()},
+    };
 #if NIX_USE_BOEHMGC
     topObj["gc"] = {
         {"heapSize", heapSize},
@@ -3288,16 +3416,42 @@ Expr * EvalState::parse(
     DocCommentMap tmpDocComments; // Only used when not origin is not a SourcePath
     auto * docComments = &tmpDocComments;
 
-    if (auto sourcePath = std::get_if<SourcePath>(&origin)) {
+    auto sourcePath = std::get_if<SourcePath>(&origin);
+
+    if (sourcePath) {
         auto [it, _] = positionToDocComment.lock()->try_emplace(*sourcePath, make_ref<DocCommentMap>());
         docComments = &*it->second;
     }
 
-    auto result =
-        parseExprFromBuf(text, length, origin, basePath, mem.exprs, symbols, settings, positions, *docComments, rootFS);
+    auto posOrigin = positions.addOrigin(origin, length);
+
+    /* Only files are cached, since those are what gets parsed over
+       and over again. Note that `text` is followed by two NUL
+       terminators. */
+    Expr * result = nullptr;
+    if (settings.useAstCache && sourcePath && length >= 2) {
+        std::string_view source(text, length - 2);
+        auto astCacheKey = getAstCacheKey(*this, source, basePath);
+        result = loadCachedAst(*this, astCacheKey, posOrigin, basePath, *docComments);
+        if (!result) {
+            /* The lexer may modify `text`, so compute the line
+               offsets first. */
+            auto lines = PosTable::computeLines(source);
+            result = parseExprFromBuf(
+                text, length, posOrigin, basePath, mem.exprs, symbols, settings, positions, *docComments, rootFS);
+            saveCachedAst(*this, astCacheKey, result, posOrigin, lines, *docComments);
+        }
+    } else
+        result = parseExprFromBuf(
+            text, length, posOrigin, basePath, mem.exprs, symbols, settings, positions, *docComments, rootFS);
 
     result->bindVars(*this, staticEnv);
 
+    /* The debugger looks up the static environment of expressions by
+       their address, so it needs the original ones. */
+    if (settings.specialiseExprs && !debugRepl)
+        result = specialiseExpr(*this, result);
+
     return result;
 }
 
@@ -0,0 +1,71 @@
+#pragma once
+///@file
+
+#include "nix/expr/eval.hh"
+#include "nix/util/hash.hh"
+
+namespace nix {
+
+/**
+ * Return the key under which the syntax tree of the Nix file with
+ * contents `source` in directory `basePath` is stored in the AST
+ * cache. Besides the contents, it covers the Nix version and the
+ * settings that affect parsing.
+ */
+Hash getAstCacheKey(const EvalState & state, std::string_view source, const SourcePath & basePath);
+
+/**
+ * Serialise the syntax tree `e`, as returned by the parser (i.e. before
+ * `bindVars()`), together with the doc comments and the line offsets
+ * of its source. All positions must be in `origin`.
+ *
+ * The result is a flat, pointer-free buffer in host byte order:
+ * symbols are stored once in a string table, expressions are stored
+ * in post-order and refer to their children by index, and positions
+ * are stored as offsets into `origin`. Throws an `Error` if `e` contains
+ * expressions that cannot be serialised.
+ */
+std::string serialiseAst(
+    const EvalState & state,
+    Expr * e,
+    const PosTable::Origin & origin,
+    const PosTable::Lines & lines,
+    const DocCommentMap & docComments);
+
+/**
+ * Reconstruct a syntax tree serialised by `serialiseAst()`, with
+ * positions in `origin` and relative paths resolved in `basePath`. The
+ * doc comments are added to `docComments`, and the line offsets are
+ * added to the position table. Throws an `Error` if `data` is corrupt.
+ */
+Expr * deserialiseAst(
+    EvalState & state,
+    std::string_view data,
+    const PosTable::Origin & origin,
+    const SourcePath & basePath,
+    DocCommentMap & docComments);
+
+/**
+ * Return the syntax tree stored in the AST cache under `key`, or
+ * `nullptr` if there is no usable entry.
+ */
+Expr * loadCachedAst(
+    EvalState & state,
+    const Hash & key,
+    const PosTable::Origin & origin,
+    const SourcePath & basePath,
+    DocCommentMap & docComments);
+
+/**
+ * Store the syntax tree `e` in the AST cache under `key`. Failures
+ * are ignored.
+ */
+void saveCachedAst(
+    const EvalState & state,
+    const Hash & key,
+    Expr * e,
+    const PosTable::Origin & origin,
+    const PosTable::Lines & lines,
+    const DocCommentMap & docComments);
+
+} // namespace nix
@@ -58,6 +58,12 @@ static_assert(
  * this linked list until a matching attribute is found (thus overlays earlier in
  * the list take precedence). For iteration over the whole Bindings, an on-the-fly
  * k-way merge is performed by Bindings::iterator class.
+ *
+ * Lookups in a layer with at least `indexThreshold` attributes use a hash
+ * index once the layer has been looked up often enough to pay for
+ * building it (@see Bindings::getIndexed). Bindings allocated with that
+ * capacity reserve one extra `Attr` after the attributes, whose first word
+ * holds the lookup count or a pointer to the index.
  */
 class Bindings
 {
@@ -114,7 +120,29 @@ private:
      */
     static constexpr unsigned maxLayers = 8;
 
+    /**
+     * Look up `name` in this layer, which must have at least
+     * `indexThreshold` attributes. This counts the lookups done on the
+     * layer, and once they exceed 1/8 of its size, builds a hash index
+     * of its attributes. Until then, it does a binary search.
+     */
+    const Attr * getIndexed(Symbol name) const noexcept;
+
 public:
+    /**
+     * Minimum number of attributes in a layer for lookups to use a
+     * hash index rather than binary search. The index is about as big
+     * as the attributes themselves, so it is reserved for the few
+     * large sets (package sets, `lib`) that most lookups go to.
+     */
+    static constexpr size_type indexThreshold = 256;
+
+    /**
+     * Number of hash indices built and their total size in bytes.
+     */
+    static Counter nrIndexes;
+    static Counter nrIndexBytes;
+
     size_type size() const
     {
         return numAttrsInChain;
@@ -351,6 +379,8 @@ public:
     const Attr * get(Symbol name) const noexcept
     {
         auto getInChunk = [key = Attr{name, nullptr}](const Bindings & chunk) -> const Attr * {
+            if (chunk.numAttrs >= indexThreshold)
+                return chunk.getIndexed(key.name);
             auto first = chunk.attrs;
             auto last = first + chunk.numAttrs;
             const Attr * i = std::lower_bound(first, last, key);
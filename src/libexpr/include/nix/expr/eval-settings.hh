@@ -265,6 +265,34 @@ struct EvalSettings : Config
             Intermediate results are not cached.
         )"};
 
+    Setting<bool> useAstCache{
+        this,
+        false,
+        "ast-cache",
+        R"(
+            Whether to cache the parsed syntax trees of Nix files in
+            `~/.cache/nix/ast`, so that files that haven't changed don't
+            have to be parsed again by later evaluations. Entries are
+            keyed by the contents of the file, the Nix version and the
+            settings that affect parsing.
+
+            Warnings emitted by the parser (such as those enabled by
+            `warn-short-path-literals`) are not shown when a file is
+            loaded from the cache.
+        )"};
+
+    Setting<bool> specialiseExprs{
+        this,
+        false,
+        "specialise-exprs",
+        R"(
+            Whether to replace common kinds of expressions by specialised
+            forms after parsing, such as attribute selections and function
+            calls on variables, and strings with interpolations. This
+            speeds up evaluation without changing its result. It is
+            disabled when the debugger is enabled.
+        )"};
+
     Setting<bool> ignoreExceptionsDuringTry{
         this,
         false,
@@ -343,6 +371,33 @@ struct EvalSettings : Config
           more explicit.
     )"};
 
+    Setting<unsigned> callCacheSize{
+        this,
+        0,
+        "eval-call-cache-size",
+        R"(
+          The number of entries in a cache of the results of function
+          calls. If this is non-zero, applying a function with a
+          [set pattern](@docroot@/language/syntax.md#functions) to the
+          same attribute set a second time (such as a package function
+          called by `callPackage` or a NixOS module) returns the earlier
+          result instead of evaluating the function body again.
+
+          Calls are identified by the function (including the values of
+          the variables it closes over) and the identity of the attribute
+          set passed in. Attribute sets are never compared structurally,
+          so this never forces more of the argument than the call itself
+          would. Functions without a set pattern are not cached. Results
+          are not cached if the call fails.
+
+          Since the body is not evaluated again, side effects such as
+          `builtins.trace` messages only happen on the first call. Each
+          cache entry keeps the values of its call alive, which may
+          increase memory use.
+
+          This setting is ignored when the debugger is enabled.
+        )"};
+
     Setting<unsigned> bindingsUpdateLayerRhsSizeThreshold{
         this,
         sizeof(void *) == 4 ? 8192 : 16,
@@ -394,6 +449,7 @@ struct EvalSettings : Config
           * `nix flake show`
           * `nix eval --json`
           * Any evaluation that uses `builtins.parallel`
+          * Any evaluation that uses `builtins.genericClosure`
 
           The value `0` causes Nix to use all available CPU cores in the system.
 
@@ -888,6 +888,8 @@ private:
     inline Value * lookupVar(Env * env, const ExprVar & var, bool noEval);
 
     friend struct ExprVar;
+    friend struct ExprSelectVar;
+    friend struct ExprCallVar;
     friend struct ExprAttrs;
     friend struct ExprLet;
 
@@ -1102,6 +1104,38 @@ private:
 
     void incrFunctionCall(ExprLambda * fun);
 
+    /**
+     * An entry in `callCache`. `arg` is the attribute set passed to a
+     * function with formals. Since the entry points to the closure and
+     * to that attribute set, which are allocated on the GC heap, they
+     * are kept alive, so their addresses cannot be reused while the
+     * entry exists.
+     */
+    struct CallCacheEntry
+    {
+        Env * env = nullptr;
+        ExprLambda * fun = nullptr;
+        const void * arg = nullptr;
+        Value result;
+    };
+
+    /**
+     * A direct-mapped cache of the results of lambda applications, with
+     * `eval-call-cache-size` entries. Empty if disabled.
+     */
+    Sync<std::vector<CallCacheEntry, traceable_allocator<CallCacheEntry>>> callCache;
+
+    Counter nrCallCacheHits;
+    Counter nrCallCacheMisses;
+
+    /**
+     * Look up the result of applying the lambda `fun` with closure
+     * `env` to the argument identified by `arg`.
+     */
+    bool lookupCallCache(Env & env, ExprLambda & fun, const void * arg, Value & v);
+
+    void insertCallCache(Env & env, ExprLambda & fun, const void * arg, const Value & v);
+
     // FIXME: make thread-safe.
     typedef boost::unordered_flat_map<PosIdx, size_t, std::hash<PosIdx>> AttrSelects;
     AttrSelects attrSelects;
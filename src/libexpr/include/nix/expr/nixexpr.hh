@@ -320,6 +320,11 @@ struct ExprSelect : Expr
      */
     Symbol evalExceptFinalSelect(EvalState & state, Env & env, Value & attrs);
 
+    /**
+     * Select the attribute path from `vStart`, which is the value of `e`.
+     */
+    void evalAttrPath(EvalState & state, Env & env, Value & vStart, Value & v);
+
     COMMON_METHODS
 };
 
@@ -793,6 +798,63 @@ struct ExprPos : Expr
     COMMON_METHODS
 };
 
+/* Specialised forms of common expressions, substituted by
+   `specialiseExpr()` after `bindVars()`. They behave exactly like the
+   expressions they are derived from, but take shortcuts that are only
+   valid for their particular shape. */
+
+/**
+ * An attribute selection from a variable that doesn't come from a
+ * `with`, e.g. `lib.attrsets.mapAttrs`. The variable is looked up
+ * directly in its environment instead of being evaluated into a
+ * temporary.
+ */
+struct ExprSelectVar : ExprSelect
+{
+    ExprVar & var;
+
+    ExprSelectVar(const ExprSelect & e, ExprVar & var)
+        : ExprSelect(e)
+        , var(var) {};
+
+    void eval(EvalState & state, Env & env, Value & v) override;
+};
+
+/**
+ * A call of a variable that doesn't come from a `with`, e.g. `f x y`.
+ * The function is looked up directly in its environment instead of
+ * being evaluated into a temporary.
+ */
+struct ExprCallVar : ExprCall
+{
+    ExprVar & var;
+
+    ExprCallVar(ExprCall && e, ExprVar & var)
+        : ExprCall(std::move(e))
+        , var(var) {};
+
+    void eval(EvalState & state, Env & env, Value & v) override;
+};
+
+/**
+ * A string with interpolations, e.g. `"${name}-${version}"`. Unlike
+ * `+`, every part is coerced to a string, so there is no need to
+ * track the type of the first operand.
+ */
+struct ExprInterpolatedString : ExprConcatStrings
+{
+    ExprInterpolatedString(const ExprConcatStrings & e)
+        : ExprConcatStrings(e) {};
+
+    void eval(EvalState & state, Env & env, Value & v) override;
+};
+
+/**
+ * Replace the expressions in the bound syntax tree `e` by their
+ * specialised forms, where possible. Returns the new root.
+ */
+Expr * specialiseExpr(EvalState & state, Expr * e);
+
 class Exprs
 {
     // FIXME: use std::pmr::monotonic_buffer_resource when parallel
@@ -10,9 +10,25 @@
 
 namespace nix {
 
+struct Sink;
+
 nlohmann::json printValueAsJSON(
     EvalState & state, bool strict, Value & v, const PosIdx pos, NixStringContext & context, bool copyToStore = true);
 
+/**
+ * Write `v` as compact JSON to `sink` without building an intermediate
+ * `nlohmann::json` tree. The output is identical to that of `dump()` on
+ * the result of the function above.
+ */
+void printValueAsJSON(
+    EvalState & state,
+    bool strict,
+    Value & v,
+    const PosIdx pos,
+    Sink & sink,
+    NixStringContext & context,
+    bool copyToStore = true);
+
 void printValueAsJSON(
     EvalState & state,
     bool strict,
@@ -3,161 +3,131 @@
 #include "nix/expr/eval.hh"
 
 #include <limits>
-#include <variant>
 #include <nlohmann/json.hpp>
 
 using json = nlohmann::json;
 
 namespace nix {
 
+namespace {
+
 // for more information, refer to
 // https://github.com/nlohmann/json/blob/master/include/nlohmann/detail/input/json_sax.hpp
-class JSONSax : nlohmann::json_sax<json>
+/**
+ * Builds Nix values directly from the events of nlohmann's SAX parser.
+ *
+ * Rather than allocating a state object with its own map or vector for
+ * every open object or array, the members of all open containers are
+ * kept on two shared stacks, and a container is built from the top of
+ * those stacks when it is closed. So apart from the resulting values,
+ * parsing only allocates when the stacks grow. Since the SAX interface
+ * is a template parameter of `sax_parse()`, the handlers are not
+ * virtual.
+ */
+class JSONSax
 {
-    class JSONState
-    {
-    protected:
-        std::unique_ptr<JSONState> parent;
-        RootValue v;
-    public:
-        virtual std::unique_ptr<JSONState> resolve(EvalState &)
-        {
-            throw std::logic_error("tried to close toplevel json parser state");
-        }
-
-        explicit JSONState(std::unique_ptr<JSONState> && p)
-            : parent(std::move(p))
-        {
-        }
-
-        explicit JSONState(Value * v)
-            : v(allocRootValue(v))
-        {
-        }
-
-        JSONState(JSONState & p) = delete;
-
-        Value & value(EvalState & state)
-        {
-            if (!v)
-                v = allocRootValue(state.allocValue());
-            return **v;
-        }
-
-        virtual ~JSONState() {}
+    EvalState & state;
 
-        virtual void add() {}
-    };
+    /**
+     * Where to store the top-level value.
+     */
+    Value & result;
 
-    class JSONObjectState : public JSONState
+    struct Frame
     {
-        using JSONState::JSONState;
-        ValueMap attrs;
-
-        std::unique_ptr<JSONState> resolve(EvalState & state) override
-        {
-            auto attrs2 = state.buildBindings(attrs.size());
-            for (auto & i : attrs)
-                attrs2.insert(i.first, i.second);
-            parent->value(state).mkAttrs(attrs2);
-            return std::move(parent);
-        }
-
-        void add() override
-        {
-            v = nullptr;
-        }
-    public:
-        void key(string_t & name, EvalState & state)
-        {
-            forceNoNullByte(name);
-            attrs.insert_or_assign(state.symbols.create(name), &value(state));
-        }
+        /**
+         * The size of `values` and `keys` when this container was
+         * opened.
+         */
+        size_t values, keys;
     };
 
-    class JSONListState : public JSONState
-    {
-        ValueVector values;
-
-        std::unique_ptr<JSONState> resolve(EvalState & state) override
-        {
-            auto list = state.buildList(values.size());
-            for (const auto & [n, v2] : enumerate(list))
-                v2 = values[n];
-            parent->value(state).mkList(list);
-            return std::move(parent);
-        }
-
-        void add() override
-        {
-            values.push_back(*v);
-            v = nullptr;
-        }
-    public:
-        JSONListState(std::unique_ptr<JSONState> && p, std::size_t reserve)
-            : JSONState(std::move(p))
-        {
-            values.reserve(reserve);
-        }
-    };
-
-    EvalState & state;
-    std::unique_ptr<JSONState> rs;
+    std::vector<Frame> frames;
+
+    /**
+     * The members of all open containers.
+     */
+    std::vector<Value *, traceable_allocator<Value *>> values;
+
+    /**
+     * The keys of the members of all open objects.
+     */
+    std::vector<Symbol> keys;
+
+    /**
+     * Scratch space for sorting the members of an object.
+     */
+    std::vector<std::pair<Symbol, size_t>> sorted;
+
+    /**
+     * Return the value to store the next member of the current
+     * container in.
+     */
+    Value & add()
+    {
+        if (frames.empty())
+            return result;
+        auto v = state.allocValue();
+        values.push_back(v);
+        return *v;
+    }
 
 public:
+    using string_t = json::string_t;
+    using number_integer_t = json::number_integer_t;
+    using number_unsigned_t = json::number_unsigned_t;
+    using number_float_t = json::number_float_t;
+    using binary_t = json::binary_t;
+
     JSONSax(EvalState & state, Value & v)
         : state(state)
-        , rs(new JSONState(&v)) {};
+        , result(v)
+    {
+    }
 
-    bool null() override
+    bool null()
     {
-        rs->value(state).mkNull();
-        rs->add();
+        add().mkNull();
         return true;
     }
 
-    bool boolean(bool val) override
+    bool boolean(bool val)
     {
-        rs->value(state).mkBool(val);
-        rs->add();
+        add().mkBool(val);
         return true;
     }
 
-    bool number_integer(number_integer_t val) override
+    bool number_integer(number_integer_t val)
     {
-        rs->value(state).mkInt(val);
-        rs->add();
+        add().mkInt(val);
         return true;
     }
 
-    bool number_unsigned(number_unsigned_t val_) override
+    bool number_unsigned(number_unsigned_t val_)
     {
         if (val_ > std::numeric_limits<NixInt::Inner>::max()) {
             throw Error("unsigned json number %1% outside of Nix integer range", val_);
         }
         NixInt::Inner val = val_;
-        rs->value(state).mkInt(val);
-        rs->add();
+        add().mkInt(val);
         return true;
     }
 
-    bool number_float(number_float_t val, const string_t & s) override
+    bool number_float(number_float_t val, const string_t & s)
     {
-        rs->value(state).mkFloat(val);
-        rs->add();
+        add().mkFloat(val);
         return true;
     }
 
-    bool string(string_t & val) override
+    bool string(string_t & val)
     {
         forceNoNullByte(val);
-        rs->value(state).mkString(val, state.mem);
-        rs->add();
+        add().mkString(val, state.mem);
         return true;
     }
 
 #if NLOHMANN_JSON_VERSION_MAJOR >= 3 && NLOHMANN_JSON_VERSION_MINOR >= 8
-    bool binary(binary_t &) override
+    bool binary(binary_t &)
     {
         // This function ought to be unreachable
         assert(false);
@@ -165,42 +135,71 @@ public:
     }
 #endif
 
-    bool start_object(std::size_t len) override
+    bool start_object(std::size_t len)
     {
-        rs = std::make_unique<JSONObjectState>(std::move(rs));
+        frames.push_back({values.size(), keys.size()});
         return true;
     }
 
-    bool key(string_t & name) override
+    bool key(string_t & name)
     {
-        dynamic_cast<JSONObjectState *>(rs.get())->key(name, state);
+        forceNoNullByte(name);
+        keys.push_back(state.symbols.create(name));
         return true;
     }
 
-    bool end_object() override
+    bool end_object()
     {
-        rs = rs->resolve(state);
-        rs->add();
+        auto frame = frames.back();
+        frames.pop_back();
+        auto size = values.size() - frame.values;
+
+        /* Sort the members by name. If a key occurs more than once, the
+           last occurrence wins. */
+        sorted.clear();
+        for (size_t i = 0; i < size; ++i)
+            sorted.emplace_back(keys[frame.keys + i], frame.values + i);
+        std::ranges::sort(sorted);
+
+        auto attrs = state.buildBindings(size);
+        for (size_t i = 0; i < size; ++i)
+            if (i + 1 == size || sorted[i + 1].first != sorted[i].first)
+                attrs.insert(sorted[i].first, values[sorted[i].second]);
+
+        values.resize(frame.values);
+        keys.resize(frame.keys);
+        add().mkAttrs(attrs.alreadySorted());
         return true;
     }
 
-    bool end_array() override
+    bool start_array(size_t len)
     {
-        return end_object();
+        frames.push_back({values.size(), keys.size()});
+        return true;
     }
 
-    bool start_array(size_t len) override
+    bool end_array()
     {
-        rs = std::make_unique<JSONListState>(std::move(rs), len != std::numeric_limits<size_t>::max() ? len : 128);
+        auto frame = frames.back();
+        frames.pop_back();
+
+        auto list = state.buildList(values.size() - frame.values);
+        for (const auto & [n, v2] : enumerate(list))
+            v2 = values[frame.values + n];
+
+        values.resize(frame.values);
+        add().mkList(list);
         return true;
     }
 
-    bool parse_error(std::size_t, const std::string &, const nlohmann::detail::exception & ex) override
+    bool parse_error(std::size_t, const std::string &, const nlohmann::detail::exception & ex)
     {
         throw JSONParseError("%s", ex.what());
     }
 };
 
+} // namespace
+
 void parseJSON(EvalState & state, const std::string_view & s_, Value & v)
 {
     JSONSax parser(state, v);
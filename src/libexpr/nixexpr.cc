@@ -6,6 +6,7 @@
 
 #include <cstdlib>
 #include <sstream>
+#include <typeinfo>
 
 #include "nix/util/strings-inline.hh"
 
@@ -674,4 +675,156 @@ void ExprCall::warnIfCursedOr(const SymbolTable & symbols, const PosTable & posi
     }
 }
 
+/* Specialisation of bound expressions. */
+
+template<typename E>
+static void specialiseBinOp(EvalState & state, E & e)
+{
+    e.e1 = specialiseExpr(state, e.e1);
+    e.e2 = specialiseExpr(state, e.e2);
+}
+
+static void specialiseAttrPath(EvalState & state, std::span<AttrName> attrPath)
+{
+    for (auto & i : attrPath)
+        if (!i.symbol)
+            i.expr = specialiseExpr(state, i.expr);
+}
+
+/**
+ * Specialise the children of `e`. Expressions of unknown types are
+ * left alone, including their children.
+ */
+static void specialiseChildren(EvalState & state, Expr & e)
+{
+    auto & type = typeid(e);
+
+    if (type == typeid(ExprSelect)) {
+        auto & e2 = static_cast<ExprSelect &>(e);
+        e2.e = specialiseExpr(state, e2.e);
+        e2.def = specialiseExpr(state, e2.def);
+        specialiseAttrPath(state, {e2.attrPathStart, e2.nAttrPath});
+    }
+
+    else if (type == typeid(ExprOpHasAttr)) {
+        auto & e2 = static_cast<ExprOpHasAttr &>(e);
+        e2.e = specialiseExpr(state, e2.e);
+        specialiseAttrPath(state, e2.attrPath);
+    }
+
+    else if (type == typeid(ExprAttrs)) {
+        auto & e2 = static_cast<ExprAttrs &>(e);
+        for (auto & [_, def] : *e2.attrs)
+            def.e = specialiseExpr(state, def.e);
+        if (e2.inheritFromExprs)
+            for (auto & from : *e2.inheritFromExprs)
+                from = specialiseExpr(state, from);
+        for (auto & def : *e2.dynamicAttrs) {
+            def.nameExpr = specialiseExpr(state, def.nameExpr);
+            def.valueExpr = specialiseExpr(state, def.valueExpr);
+        }
+    }
+
+    else if (type == typeid(ExprList)) {
+        for (auto & elem : static_cast<ExprList &>(e).elems)
+            elem = specialiseExpr(state, elem);
+    }
+
+    else if (type == typeid(ExprLambda)) {
+        auto & e2 = static_cast<ExprLambda &>(e);
+        if (auto formals = e2.getFormals())
+            for (auto & formal : formals->formals)
+                formal.def = specialiseExpr(state, formal.def);
+        e2.body = specialiseExpr(state, e2.body);
+    }
+
+    else if (type == typeid(ExprCall)) {
+        auto & e2 = static_cast<ExprCall &>(e);
+        e2.fun = specialiseExpr(state, e2.fun);
+        for (auto & arg : *e2.args)
+            arg = specialiseExpr(state, arg);
+    }
+
+    else if (type == typeid(ExprLet)) {
+        auto & e2 = static_cast<ExprLet &>(e);
+        /* Attribute sets are never replaced, so this is safe. */
+        specialiseChildren(state, *e2.attrs);
+        e2.body = specialiseExpr(state, e2.body);
+    }
+
+    else if (type == typeid(ExprWith)) {
+        auto & e2 = static_cast<ExprWith &>(e);
+        e2.attrs = specialiseExpr(state, e2.attrs);
+        e2.body = specialiseExpr(state, e2.body);
+    }
+
+    else if (type == typeid(ExprIf)) {
+        auto & e2 = static_cast<ExprIf &>(e);
+        e2.cond = specialiseExpr(state, e2.cond);
+        e2.then = specialiseExpr(state, e2.then);
+        e2.else_ = specialiseExpr(state, e2.else_);
+    }
+
+    else if (type == typeid(ExprAssert)) {
+        auto & e2 = static_cast<ExprAssert &>(e);
+        e2.cond = specialiseExpr(state, e2.cond);
+        e2.body = specialiseExpr(state, e2.body);
+    }
+
+    else if (type == typeid(ExprOpNot)) {
+        auto & e2 = static_cast<ExprOpNot &>(e);
+        e2.e = specialiseExpr(state, e2.e);
+    }
+
+    else if (type == typeid(ExprOpEq))
+        specialiseBinOp(state, static_cast<ExprOpEq &>(e));
+    else if (type == typeid(ExprOpNEq))
+        specialiseBinOp(state, static_cast<ExprOpNEq &>(e));
+    else if (type == typeid(ExprOpAnd))
+        specialiseBinOp(state, static_cast<ExprOpAnd &>(e));
+    else if (type == typeid(ExprOpOr))
+        specialiseBinOp(state, static_cast<ExprOpOr &>(e));
+    else if (type == typeid(ExprOpImpl))
+        specialiseBinOp(state, static_cast<ExprOpImpl &>(e));
+    else if (type == typeid(ExprOpConcatLists))
+        specialiseBinOp(state, static_cast<ExprOpConcatLists &>(e));
+    else if (type == typeid(ExprOpUpdate))
+        specialiseBinOp(state, static_cast<ExprOpUpdate &>(e));
+
+    else if (type == typeid(ExprConcatStrings)) {
+        for (auto & [_, part] : static_cast<ExprConcatStrings &>(e).es)
+            part = specialiseExpr(state, part);
+    }
+}
+
+Expr * specialiseExpr(EvalState & state, Expr * e)
+{
+    if (!e)
+        return nullptr;
+
+    specialiseChildren(state, *e);
+
+    auto & type = typeid(*e);
+
+    if (type == typeid(ExprSelect)) {
+        auto & e2 = static_cast<ExprSelect &>(*e);
+        if (auto var = dynamic_cast<ExprVar *>(e2.e); var && !var->fromWith)
+            return state.mem.exprs.add<ExprSelectVar>(e2, *var);
+    }
+
+    else if (type == typeid(ExprCall)) {
+        auto & e2 = static_cast<ExprCall &>(*e);
+        if (auto var = dynamic_cast<ExprVar *>(e2.fun); var && !var->fromWith)
+            return state.mem.exprs.add<ExprCallVar>(std::move(e2), *var);
+    }
+
+    else if (type == typeid(ExprConcatStrings)) {
+        auto & e2 = static_cast<ExprConcatStrings &>(*e);
+        if (e2.forceString)
+            return state.mem.exprs.add<ExprInterpolatedString>(e2);
+    }
+
+    return e;
+}
+
 } // namespace nix
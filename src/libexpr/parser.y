@@ -61,7 +61,7 @@ typedef boost::unordered_flat_map<PosIdx, DocComment, std::hash<PosIdx>> DocComm
 Expr * parseExprFromBuf(
     char * text,
     size_t length,
-    Pos::Origin origin,
+    const PosTable::Origin & origin,
     const SourcePath & basePath,
     Exprs & exprs,
     SymbolTable & symbols,
@@ -518,7 +518,7 @@ namespace nix {
 Expr * parseExprFromBuf(
     char * text,
     size_t length,
-    Pos::Origin origin,
+    const PosTable::Origin & origin,
     const SourcePath & basePath,
     Exprs & exprs,
     SymbolTable & symbols,
@@ -531,7 +531,7 @@ Expr * parseExprFromBuf(
     LexerState lexerState {
         .positionToDocComment = docComments,
         .positions = positions,
-        .origin = positions.addOrigin(origin, length),
+        .origin = origin,
     };
     ParserState state {
         .lexerState = lexerState,
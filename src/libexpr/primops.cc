@@ -5,6 +5,7 @@
 #include "nix/expr/eval-settings.hh"
 #include "nix/expr/gc-small-vector.hh"
 #include "nix/expr/json-to-value.hh"
+#include "nix/expr/parallel-eval.hh"
 #include "nix/expr/static-string-data.hh"
 #include "nix/store/globals.hh"
 #include "nix/store/names.hh"
@@ -795,6 +796,64 @@ struct CompareValues
 
 typedef std::list<Value *, gc_allocator<Value *>> ValueList;
 
+/**
+ * The keys seen by `genericClosure`, mapped to the element they came
+ * from. As long as the keys are all integers or all strings, which is
+ * the common case, they are kept in a hash table. Otherwise they are
+ * moved to a map ordered by `CompareValues`, which is also what reports
+ * keys that cannot be compared.
+ */
+struct GenericClosureKeys
+{
+    struct Hash
+    {
+        size_t operator()(Value * v) const
+        {
+            return v->type() == nInt ? std::hash<NixInt::Inner>()(v->integer().value)
+                                     : std::hash<std::string_view>()(v->string_view());
+        }
+    };
+
+    struct Equal
+    {
+        bool operator()(Value * v1, Value * v2) const
+        {
+            return v1->type() == nInt ? v1->integer().value == v2->integer().value
+                                      : v1->string_view() == v2->string_view();
+        }
+    };
+
+    /**
+     * The type of the keys in `hashed`.
+     */
+    std::optional<ValueType> type;
+
+    boost::unordered_flat_map<Value *, Value *, Hash, Equal> hashed;
+
+    std::map<Value *, Value *, CompareValues> ordered;
+
+    GenericClosureKeys(const CompareValues & cmp)
+        : ordered(cmp)
+    {
+    }
+
+    /**
+     * Add `key`, returning whether it was new.
+     */
+    bool insert(Value * key, Value * elem)
+    {
+        if (ordered.empty() && (key->type() == nInt || key->type() == nString) && (!type || *type == key->type())) {
+            type = key->type();
+            return hashed.emplace(key, elem).second;
+        }
+        if (!hashed.empty()) {
+            ordered.insert(hashed.begin(), hashed.end());
+            hashed.clear();
+        }
+        return ordered.emplace(key, elem).second;
+    }
+};
+
 static void prim_genericClosure(EvalState & state, const PosIdx pos, Value ** args, Value & v)
 {
     state.forceAttrs(*args[0], noPos, "while evaluating the first argument passed to builtins.genericClosure");
@@ -829,11 +888,10 @@ static void prim_genericClosure(EvalState & state, const PosIdx pos, Value ** ar
     ValueList res;
     // Track which element each key came from
     auto cmp = CompareValues(state, noPos, "");
-    std::map<Value *, Value *, decltype(cmp)> keyToElem(cmp);
-    while (!workSet.empty()) {
-        Value * e = *(workSet.begin());
-        workSet.pop_front();
+    GenericClosureKeys keyToElem(cmp);
 
+    /* Return whether `e` has a key that we haven't seen before. */
+    auto isNew = [&](Value * e) -> bool {
         try {
             state.forceAttrs(*e, noPos, "");
         } catch (Error & err) {
@@ -851,13 +909,11 @@ static void prim_genericClosure(EvalState & state, const PosIdx pos, Value ** ar
         state.forceValue(*key->value, noPos);
 
         try {
-            auto [it, inserted] = keyToElem.insert({key->value, e});
-            if (!inserted)
-                continue;
+            return keyToElem.insert(key->value, e);
         } catch (Error & err) {
             // Try to find which element we're comparing against
             Value * otherElem = nullptr;
-            for (auto & [otherKey, elem] : keyToElem) {
+            for (auto & [otherKey, elem] : keyToElem.ordered) {
                 try {
                     cmp(key->value, otherKey);
                 } catch (Error &) {
@@ -876,12 +932,18 @@ static void prim_genericClosure(EvalState & state, const PosIdx pos, Value ** ar
             }
             throw;
         }
-        res.push_back(e);
+    };
 
-        /* Call the `operator' function with `e' as argument. */
+    /* Call the `operator' function with `e' as argument, or use
+       `app` if the call has already been started in the background. */
+    auto expand = [&](Value * e, Value * app) {
         Value newElements;
         try {
-            state.callFunction(*op->value, {&e, 1}, newElements, noPos);
+            if (app) {
+                state.forceValue(*app, noPos);
+                newElements = *app;
+            } else
+                state.callFunction(*op->value, {&e, 1}, newElements, noPos);
             state.forceList(
                 newElements,
                 noPos,
@@ -901,6 +963,55 @@ static void prim_genericClosure(EvalState & state, const PosIdx pos, Value ** ar
                 ValuePrinter(state, *e, errorPrintOptions));
             throw;
         }
+    };
+
+    /* With parallel evaluation, the work set is processed one
+       generation at a time: first the new elements are determined,
+       then the operator is applied to all of them in the background,
+       and finally the results are collected in order. This yields
+       the same result as processing the elements one by one. */
+    bool parallel = state.executor->enabled && !Executor::amWorkerThread;
+
+    while (!workSet.empty()) {
+        if (!parallel) {
+            Value * e = *(workSet.begin());
+            workSet.pop_front();
+            if (!isNew(e))
+                continue;
+            res.push_back(e);
+            expand(e, nullptr);
+            continue;
+        }
+
+        ValueList generation;
+        std::swap(generation, workSet);
+
+        std::vector<std::pair<Value *, Value *>, traceable_allocator<std::pair<Value *, Value *>>> todo;
+        for (auto e : generation)
+            if (isNew(e)) {
+                res.push_back(e);
+                todo.emplace_back(e, nullptr);
+            }
+
+        if (todo.size() > 1) {
+            std::vector<std::pair<Executor::work_t, uint8_t>> work;
+            for (auto & [e, app] : todo) {
+                app = state.allocValue();
+                app->mkApp(op->value, e);
+                work.emplace_back(
+                    [app(allocRootValue(app)), &state]() {
+                        state.forceValue(**app, noPos);
+                        if ((*app)->type() == nList)
+                            for (auto elem : (*app)->listView())
+                                state.forceValue(*elem, noPos);
+                    },
+                    0);
+            }
+            state.executor->spawn(std::move(work));
+        }
+
+        for (auto & [e, app] : todo)
+            expand(e, app);
     }
 
     /* Create the result list. */
@@ -1850,20 +1961,23 @@ static void derivationStrictInternal(EvalState & state, std::string_view drvName
         drv.fillInOutputPaths(*state.store);
     }
 
-    /* Write the resulting term into the Nix store directory. */
-    auto drvPath = writeDerivation(*state.store, *state.asyncPathWriter, drv, state.repair);
+    /* Write the resulting term into the Nix store directory. Cache
+       its hash: an optimisation, but required in read-only mode!
+       because in that case we don't actually write store
+       derivations, so we can't read them later. Likewise, the
+       derivation may not have been written yet, so the entry stays
+       pinned until the path writer has done so. */
+    auto drvPath = writeDerivation(
+        *state.store,
+        *state.asyncPathWriter,
+        drv,
+        state.repair,
+        false,
+        hashDerivationModulo(*state.store, drv, false));
     auto drvPathS = state.store->printStorePath(drvPath);
 
     printMsg(lvlChatty, "instantiated '%1%' -> '%2%'", drvName, drvPathS);
 
-    /* Optimisation, but required in read-only mode! because in that
-       case we don't actually write store derivations, so we can't
-       read them later. */
-    {
-        auto h = hashDerivationModulo(*state.store, drv, false);
-        drvHashes.insert_or_assign(drvPath, std::move(h));
-    }
-
     auto result = state.buildBindings(1 + drv.outputs.size());
     result.alloc(state.s.drvPath)
         .mkString(
@@ -2638,10 +2752,10 @@ static RegisterPrimOp primop_toXML({
    represented (e.g., functions). */
 static void prim_toJSON(EvalState & state, const PosIdx pos, Value ** args, Value & v)
 {
-    std::ostringstream out;
+    StringSink out;
     NixStringContext context;
     printValueAsJSON(state, true, *args[0], pos, out, context);
-    v.mkString(out.view(), context, state.mem);
+    v.mkString(out.s, context, state.mem);
 }
 
 static RegisterPrimOp primop_toJSON({
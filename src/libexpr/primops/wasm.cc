@@ -1,5 +1,6 @@
 #include "nix/expr/primops.hh"
 #include "nix/expr/eval-inline.hh"
+#include "nix/store/wasm.hh"
 
 #include <wasmtime.hh>
 #include <wasi.h>
@@ -17,34 +18,8 @@ SourcePath realisePath(
 
 using ValueId = uint32_t;
 
-template<typename T, typename E = Error>
-T unwrap(Result<T, E> && res)
-{
-    if (res)
-        return res.ok();
-    throw Error(res.err().message());
-}
-
-static Engine & getEngine()
-{
-    static Engine engine = []() {
-        wasmtime::Config config;
-        config.pooling_allocation_strategy(PoolAllocationConfig());
-        config.memory_init_cow(true);
-        return Engine(std::move(config));
-    }();
-    return engine;
-}
-
-static std::span<uint8_t> string2span(std::string_view s)
-{
-    return std::span<uint8_t>((uint8_t *) s.data(), s.size());
-}
-
-static std::string_view span2string(std::span<uint8_t> s)
-{
-    return std::string_view((char *) s.data(), s.size());
-}
+using wasm::span2string;
+using wasm::unwrap;
 
 template<typename T>
 static std::span<T> subspan(std::span<uint8_t> s, size_t len)
@@ -76,9 +51,9 @@ struct NixWasmModule
     Module module;
 
     NixWasmModule(SourcePath _wasmPath)
-        : engine(getEngine())
+        : engine(wasm::getEngine())
         , wasmPath(_wasmPath)
-        , module(unwrap(Module::compile(engine, string2span(wasmPath.readFile()))))
+        , module(wasm::compileModule(wasmPath.readFile(), wasmPath.to_string()))
     {
     }
 };
@@ -4,6 +4,7 @@
 #include "nix/util/signals.hh"
 #include "nix/expr/parallel-eval.hh"
 
+#include <charconv>
 #include <cstdlib>
 #include <iomanip>
 #include <nlohmann/json.hpp>
@@ -145,22 +146,156 @@ json printValueAsJSON(
     return res;
 }
 
+/**
+ * Write `s` as a JSON string literal, exactly as nlohmann's `dump()`
+ * would.
+ */
+static void writeJSONString(Sink & sink, std::string_view s)
+{
+    /* Most strings need no escaping and can be copied as is. The rest,
+       including all non-ASCII strings (which have to be checked for
+       valid UTF-8), go through nlohmann. */
+    if (std::ranges::all_of(s, [](unsigned char c) { return c >= 0x20 && c < 0x80 && c != '"' && c != '\\'; })) {
+        sink("\"");
+        sink(s);
+        sink("\"");
+    } else
+        sink(json(s).dump());
+}
+
 void printValueAsJSON(
     EvalState & state,
     bool strict,
     Value & v,
     const PosIdx pos,
-    std::ostream & str,
+    Sink & sink,
     NixStringContext & context,
     bool copyToStore)
 {
+    if (strict && state.executor->enabled && !Executor::amWorkerThread)
+        parallelForceDeep(state, v, pos);
+
+    auto recurse = [&](this const auto & recurse, Value & v, PosIdx pos) -> void {
+        checkInterrupt();
+
+        auto _level = state.addCallDepth(pos);
+
+        if (strict)
+            state.forceValue(v, pos);
+
+        switch (v.type()) {
+
+        case nInt: {
+            char buf[24];
+            auto res = std::to_chars(buf, buf + sizeof(buf), v.integer().value);
+            sink(std::string_view(buf, res.ptr));
+            break;
+        }
+
+        case nBool:
+            sink(v.boolean() ? "true" : "false");
+            break;
+
+        case nString: {
+            copyContext(v, context);
+            writeJSONString(sink, v.string_view());
+            break;
+        }
+
+        case nPath:
+            if (copyToStore)
+                writeJSONString(
+                    sink, state.store->printStorePath(state.copyPathToStore(context, v.path(), v.determinePos(pos))));
+            else
+                writeJSONString(sink, v.path().path.abs());
+            break;
+
+        case nNull:
+            sink("null");
+            break;
+
+        case nAttrs: {
+            auto maybeString = state.tryAttrsToString(pos, v, context, false, false);
+            if (maybeString) {
+                writeJSONString(sink, *maybeString);
+                break;
+            }
+            if (auto i = v.attrs()->get(state.s.outPath))
+                return recurse(*i->value, i->pos);
+            sink("{");
+            bool first = true;
+            for (auto & a : v.attrs()->lexicographicOrder(state.symbols)) {
+                if (!first)
+                    sink(",");
+                first = false;
+                writeJSONString(sink, state.symbols[a->name]);
+                sink(":");
+                try {
+                    recurse(*a->value, a->pos);
+                } catch (Error & e) {
+                    e.addTrace(
+                        state.positions[a->pos], HintFmt("while evaluating attribute '%1%'", state.symbols[a->name]));
+                    throw;
+                }
+            }
+            sink("}");
+            break;
+        }
+
+        case nList: {
+            sink("[");
+            for (const auto & [i, elem] : enumerate(v.listView())) {
+                if (i)
+                    sink(",");
+                try {
+                    recurse(*elem, pos);
+                } catch (Error & e) {
+                    e.addTrace(state.positions[pos], HintFmt("while evaluating list element at index %1%", i));
+                    throw;
+                }
+            }
+            sink("]");
+            break;
+        }
+
+        case nExternal: {
+            sink(v.external()->printValueAsJSON(state, strict, context, copyToStore).dump());
+            break;
+        }
+
+        case nFloat:
+            /* Use nlohmann for the shortest round-tripping
+               representation, and to map NaN and infinity to null. */
+            sink(json(v.fpoint()).dump());
+            break;
+
+        case nThunk:
+        case nFailed:
+        case nFunction:
+            state.error<TypeError>("cannot convert %1% to JSON", showType(v)).atPos(v.determinePos(pos)).debugThrow();
+        }
+    };
+
     try {
-        str << printValueAsJSON(state, strict, v, pos, context, copyToStore);
+        recurse(v, pos);
     } catch (nlohmann::json::exception & e) {
         throw JSONSerializationError("JSON serialization error: %s", e.what());
     }
 }
 
+void printValueAsJSON(
+    EvalState & state,
+    bool strict,
+    Value & v,
+    const PosIdx pos,
+    std::ostream & str,
+    NixStringContext & context,
+    bool copyToStore)
+{
+    LambdaSink sink([&](std::string_view data) { str << data; });
+    printValueAsJSON(state, strict, v, pos, sink, context, copyToStore);
+}
+
 json ExternalValueBase::printValueAsJSON(
     EvalState & state, bool strict, NixStringContext & context, bool copyToStore) const
 {
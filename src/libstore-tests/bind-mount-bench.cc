@@ -0,0 +1,91 @@
+#include "nix/store/bind-mount.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/processes.hh"
+
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+
+#include <sched.h>
+#include <sys/mount.h>
+
+using namespace nix;
+
+/**
+ * Time `bindMountStoreObjects()` in a child process with user and mount
+ * namespaces of its own, so that the benchmark process (and thus the
+ * other benchmarks) are unaffected. Returns `std::nullopt` if the
+ * namespaces can't be created.
+ */
+static std::optional<double>
+timeInNamespace(const std::filesystem::path & storeDir, const std::filesystem::path & sandboxDir, const StringSet & names)
+{
+    Pipe pipe;
+    pipe.create();
+
+    Pid pid = startProcess([&]() {
+        pipe.readSide.close();
+
+        if (unshare(CLONE_NEWUSER | CLONE_NEWNS) == -1 || mount(0, "/", 0, MS_PRIVATE | MS_REC, 0) == -1)
+            _exit(1);
+
+        if (mount("none", sandboxDir.c_str(), "tmpfs", 0, 0) == -1)
+            throw SysError("mounting tmpfs on '%s'", sandboxDir);
+
+        auto start = std::chrono::steady_clock::now();
+        linux::bindMountStoreObjects(storeDir, sandboxDir, names);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        writeFull(pipe.writeSide.get(), std::to_string(elapsed.count()));
+        _exit(0);
+    });
+
+    pipe.writeSide.close();
+    auto result = drainFD(pipe.readSide.get());
+
+    if (pid.wait() != 0 || result.empty())
+        return std::nullopt;
+    return std::stod(result);
+}
+
+/**
+ * Measure the cost of populating a sandbox store with a closure of
+ * `state.range(0)` store objects. This needs to be able to create
+ * user and mount namespaces.
+ */
+static void BM_BindMountStoreObjects(benchmark::State & state)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir, true);
+
+    auto storeDir = tmpDir / "store";
+    createDirs(storeDir);
+
+    StringSet names;
+    for (int64_t i = 0; i < state.range(0); ++i) {
+        auto name = fmt("%032d-input-%d", i, i);
+        createDirs(storeDir / name / "bin");
+        names.insert(name);
+    }
+
+    auto sandboxDir = tmpDir / "sandbox";
+    createDirs(sandboxDir);
+
+    for (auto _ : state) {
+        auto elapsed = timeInNamespace(storeDir, sandboxDir, names);
+        if (!elapsed) {
+            state.SkipWithError("cannot create a user and mount namespace");
+            return;
+        }
+        state.SetIterationTime(*elapsed);
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_BindMountStoreObjects)
+    ->Arg(100)
+    ->Arg(1'000)
+    ->Arg(10'000)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+
+#include "nix/store/build/build-log-file.hh"
+#include "nix/util/compression.hh"
+#include "nix/util/file-system.hh"
+
+#include <fcntl.h>
+#include <future>
+#include <sys/stat.h>
+
+namespace nix {
+
+class BuildLogFileTest : public ::testing::Test
+{
+protected:
+    std::filesystem::path tmpDir = createTempDir();
+    AutoDelete delTmpDir{tmpDir, true};
+    Path logPath = (tmpDir / "log").string();
+
+    /**
+     * Write numbered lines to `log` and return what was written.
+     */
+    static std::string writeLines(BuildLogFile & log, size_t n)
+    {
+        std::string expected;
+        for (size_t i = 0; i < n; ++i) {
+            auto line = fmt("line %d\n", i);
+            log(line);
+            expected += line;
+        }
+        return expected;
+    }
+};
+
+TEST_F(BuildLogFileTest, keepsOrder)
+{
+    BuildLogFile log(logPath, std::nullopt);
+    auto expected = writeLines(log, 100000);
+    log.finish();
+
+    ASSERT_EQ(readFile(logPath), expected);
+}
+
+TEST_F(BuildLogFileTest, compressed)
+{
+    BuildLogFile log(logPath, "zstd");
+    auto expected = writeLines(log, 100000);
+    log.finish();
+
+    ASSERT_EQ(decompress("zstd", readFile(logPath)), expected);
+}
+
+TEST_F(BuildLogFileTest, flushedOnDestruction)
+{
+    std::string expected;
+    {
+        BuildLogFile log(logPath, "zstd");
+        expected = writeLines(log, 1000);
+    }
+
+    ASSERT_EQ(decompress("zstd", readFile(logPath)), expected);
+}
+
+TEST_F(BuildLogFileTest, cannotCreate)
+{
+    ASSERT_THROW(BuildLogFile((tmpDir / "missing" / "log").string(), std::nullopt), SysError);
+}
+
+#ifndef _WIN32
+TEST_F(BuildLogFileTest, dropsOutputWhenBehind)
+{
+    /* Write the log to a pipe that isn't read until all output has
+       been produced, so the writer thread falls behind. */
+    if (mkfifo(logPath.c_str(), 0600) == -1)
+        throw SysError("creating FIFO '%s'", logPath);
+
+    std::promise<void> produced;
+    auto reader = std::async(std::launch::async, [&]() {
+        AutoCloseFD fd = open(logPath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (!fd)
+            throw SysError("opening FIFO '%s'", logPath);
+        produced.get_future().wait();
+        return drainFD(fd.get());
+    });
+
+    std::string chunk(1024 * 1024, 'x');
+    {
+        BuildLogFile log(logPath, std::nullopt);
+        for (size_t i = 0; i < 100; ++i)
+            log(chunk);
+        produced.set_value();
+        log.finish();
+    }
+
+    /* The output that fit in the queue is followed by a note about the
+       rest. */
+    auto contents = reader.get();
+    auto kept = contents.find('\n');
+    ASSERT_NE(kept, std::string::npos);
+    ASSERT_EQ(kept % chunk.size(), 0);
+    ASSERT_LT(kept, 100 * chunk.size());
+    ASSERT_EQ(
+        contents.substr(kept),
+        fmt("\n[%d bytes of output dropped because the log could not be written fast enough]\n",
+            100 * chunk.size() - kept));
+}
+#endif
+
+#ifdef __linux__
+TEST_F(BuildLogFileTest, writeError)
+{
+    /* Writes to /dev/full fail with ENOSPC. */
+    BuildLogFile log("/dev/full", std::nullopt);
+
+    /* Once writing has failed, more than the queue can hold can be
+       written without blocking. */
+    std::string chunk(1024 * 1024, 'x');
+    for (size_t i = 0; i < 100; ++i)
+        log(chunk);
+
+    ASSERT_THROW(log.finish(), SysError);
+}
+#endif
+
+} // namespace nix
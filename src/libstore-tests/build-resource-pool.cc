@@ -0,0 +1,44 @@
+#include <gtest/gtest.h>
+
+#include "nix/store/build/build-resource-pool.hh"
+
+namespace nix {
+
+TEST(BuildResourcePool, rebalances)
+{
+    BuildResourcePool pool(8, 1024);
+
+    std::optional<BuildBudget> aBudget;
+    auto a = pool.acquire(1, [&](const BuildBudget & budget) { aBudget = budget; });
+    EXPECT_EQ(a->budget(), (BuildBudget{.cores = 8, .memory = 1024}));
+    EXPECT_EQ(aBudget, std::nullopt);
+
+    {
+        /* Expecting 3 concurrent builds reserves cores for a third
+           one, but memory is only shared by the running builds. */
+        auto b = pool.acquire(3, {});
+        EXPECT_EQ(a->budget(), (BuildBudget{.cores = 3, .memory = 512}));
+        EXPECT_EQ(b->budget(), (BuildBudget{.cores = 3, .memory = 512}));
+        EXPECT_EQ(aBudget, a->budget());
+    }
+
+    /* When `b` finishes, `a` gets the whole machine again. */
+    EXPECT_EQ(a->budget(), (BuildBudget{.cores = 8, .memory = 1024}));
+    EXPECT_EQ(aBudget, a->budget());
+}
+
+TEST(BuildResourcePool, atLeastOneCore)
+{
+    BuildResourcePool pool(2, std::nullopt);
+
+    auto a = pool.acquire(1, {});
+    auto b = pool.acquire(2, {});
+    auto c = pool.acquire(3, {});
+
+    EXPECT_EQ(a->budget().cores, 1u);
+    EXPECT_EQ(b->budget().cores, 1u);
+    EXPECT_EQ(c->budget().cores, 1u);
+    EXPECT_EQ(c->budget().memory, std::nullopt);
+}
+
+} // namespace nix
@@ -58,3 +58,67 @@ BENCHMARK_CAPTURE(
     BM_UnparseRealDerivationFile, hello, getEnvNonEmpty("_NIX_TEST_UNIT_DATA").value() + "/derivation/hello.drv");
 BENCHMARK_CAPTURE(
     BM_UnparseRealDerivationFile, firefox, getEnvNonEmpty("_NIX_TEST_UNIT_DATA").value() + "/derivation/firefox.drv");
+
+// Benchmark unparsing real derivation files into a hash sink, as hashDerivationModulo() does
+static void BM_UnparseRealDerivationFileToHash(benchmark::State & state, const std::string & filename)
+{
+    // Read the file once
+    std::ifstream file(filename);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    std::string content = buffer.str();
+
+    auto store = openStore("dummy://");
+    ExperimentalFeatureSettings xpSettings;
+    auto drv = parseDerivation(*store, std::string(content), "test", xpSettings);
+
+    for (auto _ : state) {
+        HashSink sink(HashAlgorithm::SHA256);
+        drv.unparse(sink, *store, /*maskOutputs=*/false);
+        auto hash = sink.finish();
+        benchmark::DoNotOptimize(hash);
+        assert(hash.numBytesDigested == content.size());
+    }
+    state.SetBytesProcessed(state.iterations() * content.size());
+}
+
+// Benchmark hashDerivationModulo, with the hashes of the input derivations already cached
+static void BM_HashDerivationModulo(benchmark::State & state, const std::string & filename)
+{
+    // Read the file once
+    std::ifstream file(filename);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    std::string content = buffer.str();
+
+    auto store = openStore("dummy://");
+    ExperimentalFeatureSettings xpSettings;
+    auto drv = parseDerivation(*store, std::string(content), "test", xpSettings);
+
+    // The input derivations are not in the store, so make up their hashes
+    for (auto & [inputDrv, node] : drv.inputDrvs.map) {
+        DrvHash hash{.kind = DrvHash::Kind::Regular};
+        for (auto & outputName : node.value)
+            hash.hashes.insert_or_assign(outputName, hashString(HashAlgorithm::SHA256, inputDrv.to_string()));
+        drvHashes.insert(inputDrv, std::move(hash), /*pinned=*/true);
+    }
+
+    for (auto _ : state) {
+        auto hash = hashDerivationModulo(*store, drv, /*maskOutputs=*/false);
+        benchmark::DoNotOptimize(hash);
+    }
+    state.SetBytesProcessed(state.iterations() * content.size());
+}
+
+BENCHMARK_CAPTURE(
+    BM_UnparseRealDerivationFileToHash,
+    hello,
+    getEnvNonEmpty("_NIX_TEST_UNIT_DATA").value() + "/derivation/hello.drv");
+BENCHMARK_CAPTURE(
+    BM_UnparseRealDerivationFileToHash,
+    firefox,
+    getEnvNonEmpty("_NIX_TEST_UNIT_DATA").value() + "/derivation/firefox.drv");
+BENCHMARK_CAPTURE(
+    BM_HashDerivationModulo, hello, getEnvNonEmpty("_NIX_TEST_UNIT_DATA").value() + "/derivation/hello.drv");
+BENCHMARK_CAPTURE(
+    BM_HashDerivationModulo, firefox, getEnvNonEmpty("_NIX_TEST_UNIT_DATA").value() + "/derivation/firefox.drv");
@@ -2,6 +2,7 @@
 #include <gtest/gtest.h>
 
 #include "nix/store/derivations.hh"
+#include "nix/util/serialise.hh"
 #include "derivation/test-support.hh"
 #include "nix/util/tests/json-characterization.hh"
 
@@ -168,6 +169,14 @@ INSTANTIATE_TEST_SUITE_P(
     {                                                                                              \
         const auto & drv = GetParam();                                                             \
         writeTest(drv.name + ".drv", [&]() -> std::string { return drv.unparse(*store, false); }); \
+    }                                                                                              \
+                                                                                                   \
+    TEST_P(FIXTURE, to_aterm_sink)                                                                 \
+    {                                                                                              \
+        const auto & drv = GetParam();                                                             \
+        StringSink sink;                                                                           \
+        drv.unparse(sink, *store, false);                                                          \
+        ASSERT_EQ(sink.s, drv.unparse(*store, false));                                             \
     }
 
 struct DerivationJsonAtermTest : DerivationTest,
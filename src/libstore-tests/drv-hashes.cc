@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+
+#include "nix/store/derivations.hh"
+#include "nix/store/globals.hh"
+
+namespace nix {
+
+class DrvHashesTest : public ::testing::Test
+{
+protected:
+    uint64_t oldCacheSize = settings.derivationHashCacheSize;
+
+    void TearDown() override
+    {
+        settings.derivationHashCacheSize = oldCacheSize;
+    }
+
+    static StorePath drvPath(size_t i)
+    {
+        return StorePath(fmt("%s-foo-%d.drv", std::string(StorePath::HashLen, '0' + i % 10), i));
+    }
+
+    static DrvHash drvHash(size_t i)
+    {
+        return DrvHash{
+            .hashes = {{"out", hashString(HashAlgorithm::SHA256, std::to_string(i))}},
+            .kind = DrvHash::Kind::Regular,
+        };
+    }
+};
+
+TEST_F(DrvHashesTest, getAndInsert)
+{
+    DrvHashes cache;
+    ASSERT_FALSE(cache.get(drvPath(1)));
+    cache.insert(drvPath(1), drvHash(1));
+    auto hash = cache.get(drvPath(1));
+    ASSERT_TRUE(hash);
+    ASSERT_EQ(hash->hashes, drvHash(1).hashes);
+    ASSERT_EQ(cache.size(), 1u);
+}
+
+TEST_F(DrvHashesTest, bounded)
+{
+    settings.derivationHashCacheSize = 16 * 1024;
+
+    DrvHashes cache;
+    for (size_t i = 0; i < 10000; ++i)
+        cache.insert(drvPath(i), drvHash(i));
+
+    ASSERT_LT(cache.size(), 200u);
+    ASSERT_TRUE(cache.get(drvPath(9999)));
+    ASSERT_FALSE(cache.get(drvPath(0)));
+}
+
+TEST_F(DrvHashesTest, lookupsKeepEntries)
+{
+    settings.derivationHashCacheSize = 16 * 1024;
+
+    DrvHashes cache;
+    cache.insert(drvPath(0), drvHash(0));
+    for (size_t i = 1; i < 10000; ++i) {
+        cache.insert(drvPath(i), drvHash(i));
+        ASSERT_TRUE(cache.get(drvPath(0)));
+    }
+}
+
+TEST_F(DrvHashesTest, pinned)
+{
+    settings.derivationHashCacheSize = 16 * 1024;
+
+    DrvHashes cache;
+    cache.insert(drvPath(0), drvHash(0), true);
+    for (size_t i = 1; i < 10000; ++i)
+        cache.insert(drvPath(i), drvHash(i));
+    ASSERT_TRUE(cache.get(drvPath(0)));
+
+    cache.unpin(drvPath(0));
+    for (size_t i = 1; i < 10000; ++i)
+        cache.insert(drvPath(i), drvHash(i));
+    ASSERT_FALSE(cache.get(drvPath(0)));
+}
+
+} // namespace nix
@@ -0,0 +1,48 @@
+#include "nix/util/archive.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/posix-source-accessor.hh"
+#include "nix/util/source-path.hh"
+
+#include <benchmark/benchmark.h>
+
+using namespace nix;
+
+/**
+ * Create a wide tree of `nrFiles` small files, spread over directories
+ * of 100 files each.
+ */
+static std::filesystem::path makeWideTree(const std::filesystem::path & root, int64_t nrFiles)
+{
+    createDirs(root);
+    for (int64_t i = 0; i < nrFiles; ++i) {
+        auto dir = root / fmt("dir-%d", i / 100);
+        if (i % 100 == 0)
+            createDirs(dir);
+        writeFile((dir / fmt("file-%d", i)).string(), std::string(1 + i % 4096, 'x'));
+    }
+    return root;
+}
+
+template<bool readAhead>
+static void BM_DumpPathWideTree(benchmark::State & state)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir, true);
+    auto tree = PosixSourceAccessor::createAtRoot(makeWideTree(tmpDir / "tree", state.range(0)));
+
+    uint64_t processed = 0;
+
+    for (auto _ : state) {
+        LengthSink sink;
+        if (readAhead)
+            dumpPathReadAhead(*tree.accessor, tree.path, sink);
+        else
+            tree.accessor->SourceAccessor::dumpPath(tree.path, sink);
+        processed += sink.length;
+    }
+
+    state.SetBytesProcessed(processed);
+}
+
+BENCHMARK(BM_DumpPathWideTree<false>)->Arg(1'000)->Arg(10'000)->Arg(100'000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_DumpPathWideTree<true>)->Arg(1'000)->Arg(10'000)->Arg(100'000)->Unit(benchmark::kMillisecond);
@@ -1,6 +1,8 @@
 #include <gtest/gtest.h>
 
 #include "nix/store/local-store.hh"
+#include "nix/store/build-result.hh"
+#include "nix/util/file-system.hh"
 
 // Needed for template specialisations. This is not good! When we
 // overhaul how store configs work, this should be fixed.
@@ -39,4 +41,98 @@ TEST(LocalStore, constructConfig_to_string)
     EXPECT_EQ(config.getReference().to_string(), "local");
 }
 
+TEST(LocalStore, buildHistory)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir, true);
+
+    /* Keep the builds from 1970. */
+    auto config = make_ref<LocalStoreConfig>(
+        "local", tmpDir.string(), LocalStoreConfig::Params{{"build-history-max-age", "0"}});
+    LocalStore store(config);
+
+    StorePath hello1{"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-hello-1.0.drv"};
+    StorePath hello2{"h1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-hello-2.0.drv"};
+    StorePath out1{"j1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-hello-1.0"};
+
+    EXPECT_EQ(store.queryExpectedBuildTime(hello2, "x86_64-linux"), std::nullopt);
+
+    store.addBuildToHistory(
+        hello1,
+        "x86_64-linux",
+        BuildResult{
+            .inner =
+                BuildResult::Success{
+                    .builtOutputs = {{
+                        "out",
+                        Realisation{
+                            {.outPath = out1},
+                            {.drvHash = Hash::dummy, .outputName = "out"},
+                        },
+                    }},
+                },
+            .startTime = 1000,
+            .stopTime = 1010,
+            .cpuUser = std::chrono::microseconds(5000),
+            .peakMemory = 1 << 20,
+        });
+    store.addBuildToHistory(hello1, "x86_64-linux", BuildResult{.startTime = 2000, .stopTime = 2030});
+    store.addBuildToHistory(
+        hello2,
+        "x86_64-linux",
+        BuildResult{
+            .inner = BuildResult::Failure{.status = BuildResult::Failure::TimedOut},
+            .startTime = 3000,
+            .stopTime = 4000,
+        });
+
+    /* The version is ignored, but the system is not. Failed builds
+       don't count. */
+    EXPECT_EQ(store.queryExpectedBuildTime(hello2, "x86_64-linux"), std::chrono::seconds(20));
+    EXPECT_EQ(store.queryExpectedBuildTime(hello2, "aarch64-linux"), std::nullopt);
+
+    auto all = store.queryBuildHistory({.name = "hello"});
+    ASSERT_EQ(all.size(), 3u);
+    EXPECT_EQ(all[0].drvPath, hello2);
+    EXPECT_EQ(all[0].status, "TimedOut");
+    EXPECT_TRUE(all[0].outputs.empty());
+    EXPECT_EQ(all[1].startTime, 2000);
+    EXPECT_EQ(all[1].status, "Built");
+    EXPECT_EQ(all[1].cpuUser, std::nullopt);
+
+    auto byOutput = store.queryBuildHistory({.outputPath = out1});
+    ASSERT_EQ(byOutput.size(), 1u);
+    EXPECT_EQ(byOutput[0].drvPath, hello1);
+    EXPECT_EQ(byOutput[0].stopTime, 1010);
+    EXPECT_EQ(byOutput[0].cpuUser, std::chrono::microseconds(5000));
+    EXPECT_EQ(byOutput[0].cpuSystem, std::nullopt);
+    EXPECT_EQ(byOutput[0].peakMemory, 1u << 20);
+    EXPECT_EQ(byOutput[0].outputs.at("out"), out1);
+
+    EXPECT_TRUE(store.queryBuildHistory({.name = "goodbye"}).empty());
+}
+
+TEST(LocalStore, buildHistoryMaxAge)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir, true);
+
+    auto config = make_ref<LocalStoreConfig>(
+        "local", tmpDir.string(), LocalStoreConfig::Params{{"build-history-max-age", "1"}});
+    LocalStore store(config);
+
+    StorePath hello{"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-hello-1.0.drv"};
+
+    auto now = time(0);
+
+    store.addBuildToHistory(hello, "x86_64-linux", BuildResult{.startTime = 1000, .stopTime = 1010});
+    store.addBuildToHistory(hello, "x86_64-linux", BuildResult{.startTime = now - 20, .stopTime = now - 10});
+
+    /* Recording a build removes the builds that are more than a day
+       old. */
+    auto all = store.queryBuildHistory({.name = "hello"});
+    ASSERT_EQ(all.size(), 1u);
+    EXPECT_EQ(all[0].stopTime, now - 10);
+}
+
 } // namespace nix
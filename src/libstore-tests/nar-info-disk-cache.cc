@@ -121,4 +121,56 @@ TEST(NarInfoDiskCacheImpl, create_and_read)
     }
 }
 
+TEST(NarInfoDiskCacheImpl, bulk_lookup_and_upsert)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+    auto dbPath(tmpDir / "test-narinfo-disk-cache.sqlite");
+
+    std::string present = "g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q";
+    std::string missing = "g1w7hyyyy1w7hy3qg1w7hy3qgqqqqy3q";
+    std::string unknown = "00000000000000000000000000000000";
+
+    auto info = std::make_shared<ValidPathInfo>(
+        StorePath{present + "-bar"},
+        UnkeyedValidPathInfo{
+            "/nix/storedir",
+            Hash::parseSRI("sha256-FePFYIlMuycIXPZbWi7LGEiMmZSX9FMbaQenWBzm1Sc="),
+        });
+    info->narSize = 34878;
+
+    {
+        auto cache = getTestNarInfoDiskCache(dbPath.string());
+        cache->createCache("http://foo", "/nix/storedir", true, 10);
+
+        cache->upsertNarInfos("http://foo", {{present, info}, {missing, nullptr}});
+
+        auto res = cache->lookupNarInfos("http://foo", {present, missing, unknown});
+        ASSERT_EQ(res.size(), 2u);
+        ASSERT_EQ(res[present].first, NarInfoDiskCache::oValid);
+        ASSERT_EQ(res[present].second->path, info->path);
+        ASSERT_EQ(res[present].second->narSize, info->narSize);
+        ASSERT_EQ(res[missing].first, NarInfoDiskCache::oInvalid);
+        ASSERT_FALSE(res.contains(unknown));
+
+        // Negative results are now answered from memory, and must be
+        // kept in sync with later upserts.
+        cache->upsertNarInfo("http://foo", missing, info);
+        ASSERT_EQ(cache->lookupNarInfo("http://foo", missing).first, NarInfoDiskCache::oValid);
+        cache->upsertNarInfo("http://foo", present, nullptr);
+        ASSERT_EQ(cache->lookupNarInfo("http://foo", present).first, NarInfoDiskCache::oInvalid);
+    }
+
+    {
+        // A fresh cache object sees the same data.
+        auto cache = getTestNarInfoDiskCache(dbPath.string());
+        cache->createCache("http://foo", "/nix/storedir", true, 10);
+
+        auto res = cache->lookupNarInfos("http://foo", {present, missing, unknown});
+        ASSERT_EQ(res.size(), 2u);
+        ASSERT_EQ(res[present].first, NarInfoDiskCache::oInvalid);
+        ASSERT_EQ(res[missing].first, NarInfoDiskCache::oValid);
+    }
+}
+
 } // namespace nix
@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+
+#include "nix/store/pathlocks.hh"
+#include "nix/util/file-system.hh"
+
+namespace nix {
+
+#ifdef __linux__
+
+TEST(LockFileWatcher, notifiesOnUnlock)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+    auto path = tmpDir / "foo";
+
+    PathLocks locks({path});
+
+    LockFileWatcher watcher;
+    ASSERT_NE(watcher.getDescriptor(), INVALID_DESCRIPTOR);
+    ASSERT_TRUE(watcher.watch(path));
+    ASSERT_TRUE(watcher.readEvents().empty());
+
+    locks.unlock();
+
+    ASSERT_EQ(watcher.readEvents(), std::set<std::filesystem::path>{path});
+
+    /* The watch is one-shot. */
+    PathLocks locks2({path});
+    locks2.unlock();
+    ASSERT_TRUE(watcher.readEvents().empty());
+}
+
+TEST(LockFileWatcher, ignoresFailedAttempts)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+    auto path = tmpDir / "foo";
+
+    PathLocks locks({path});
+
+    LockFileWatcher watcher;
+    ASSERT_TRUE(watcher.watch(path));
+
+    /* Another waiter failing to acquire the lock opens and closes the
+       lock file, which must not look like a release. */
+    PathLocks locks2;
+    ASSERT_FALSE(locks2.lockPaths({path}, "", false));
+    ASSERT_TRUE(watcher.readEvents().empty());
+
+    locks.unlock();
+    ASSERT_EQ(watcher.readEvents(), std::set<std::filesystem::path>{path});
+}
+
+TEST(LockFileWatcher, notifiesOnDelete)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+    auto path = tmpDir / "foo";
+
+    PathLocks locks({path});
+    locks.setDeletion(true);
+
+    LockFileWatcher watcher;
+    ASSERT_TRUE(watcher.watch(path));
+
+    locks.unlock();
+    ASSERT_EQ(watcher.readEvents(), std::set<std::filesystem::path>{path});
+}
+
+TEST(LockFileWatcher, missingLockFile)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+
+    LockFileWatcher watcher;
+    ASSERT_FALSE(watcher.watch(tmpDir / "foo"));
+}
+
+#endif
+
+} // namespace nix
@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+
+#include "nix/store/wasm.hh"
+#include "nix/util/environment-variables.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/processes.hh"
+
+namespace nix {
+
+using namespace wasm;
+
+class WasmTest : public ::testing::Test
+{
+protected:
+    std::filesystem::path cacheDir = createTempDir();
+    AutoDelete delCacheDir{cacheDir, true};
+    std::optional<std::string> oldCacheHome = getEnv("NIX_CACHE_HOME");
+
+    void SetUp() override
+    {
+        setEnv("NIX_CACHE_HOME", cacheDir.c_str());
+    }
+
+    void TearDown() override
+    {
+        if (oldCacheHome)
+            setEnv("NIX_CACHE_HOME", oldCacheHome->c_str());
+        else
+            unsetenv("NIX_CACHE_HOME");
+    }
+
+    /**
+     * A module that exports an empty `_start` function.
+     */
+    static std::string emptyModule()
+    {
+        return std::string(
+            "\0asm\1\0\0\0"
+            "\1\4\1\x60\0\0"
+            "\3\2\1\0"
+            "\7\x0a\1\6_start\0\0"
+            "\x0a\4\1\2\0\x0b",
+            36);
+    }
+
+    /**
+     * Call the `_start` function of `module`, throwing if it fails.
+     */
+    static void callStart(wasmtime::Engine & engine, const wasmtime::Module & module)
+    {
+        wasmtime::Store store(engine);
+        auto instance = unwrap(wasmtime::Instance::create(store, module, {}));
+        auto ext = instance.get(store, "_start");
+        if (!ext)
+            throw Error("module does not export '_start'");
+        auto fun = std::get_if<wasmtime::Func>(&*ext);
+        if (!fun)
+            throw Error("'_start' is not a function");
+        unwrap(fun->call(store.context(), {}));
+    }
+};
+
+TEST_F(WasmTest, compileModule)
+{
+    auto module = compileModule(emptyModule(), "empty");
+    callStart(getEngine(), module);
+
+    /* The compiled module is cached on disk. */
+    auto cached = std::filesystem::directory_iterator(cacheDir / "wasm");
+    ASSERT_NE(cached, std::filesystem::directory_iterator());
+    ASSERT_EQ(cached->path().extension(), ".cwasm");
+
+    callStart(getEngine(), compileModule(emptyModule(), "empty"));
+}
+
+TEST_F(WasmTest, invalidModule)
+{
+    ASSERT_THROW(compileModule("not a module", "invalid"), Error);
+}
+
+/* This is how WASI builders run their module: it is compiled (or
+   loaded from the cache) with an engine of its own in the builder
+   process. */
+TEST_F(WasmTest, compileInChild)
+{
+    Pid pid = startProcess([&]() {
+        auto engine = createEngine();
+        callStart(engine, compileModule(engine, emptyModule(), "empty"));
+        _exit(0);
+    });
+
+    ASSERT_EQ(pid.wait(), 0);
+
+    /* The child cached the module, so the parent can load it. */
+    ASSERT_NE(std::filesystem::directory_iterator(cacheDir / "wasm"), std::filesystem::directory_iterator());
+    callStart(getEngine(), compileModule(emptyModule(), "empty"));
+}
+
+TEST_F(WasmTest, pruneCache)
+{
+    auto wasmDir = cacheDir / "wasm";
+    createDirs(wasmDir);
+
+    auto old = std::filesystem::file_time_type::clock::now() - std::chrono::hours(1);
+    for (size_t n = 0; n < maxCachedModules + 10; ++n) {
+        auto path = wasmDir / fmt("stale-%d.cwasm", n);
+        writeFile(path, "");
+        std::filesystem::last_write_time(path, old);
+    }
+
+    auto engine = createEngine();
+    callStart(engine, compileModule(engine, emptyModule(), "empty"));
+
+    /* The least recently used modules were deleted, but not the one
+       that was just added. */
+    size_t count = 0;
+    bool found = false;
+    for (auto & entry : std::filesystem::directory_iterator(wasmDir)) {
+        ASSERT_EQ(entry.path().extension(), ".cwasm");
+        found |= !entry.path().filename().string().starts_with("stale-");
+        ++count;
+    }
+    ASSERT_EQ(count, maxCachedModules);
+    ASSERT_TRUE(found);
+}
+
+} // namespace nix
@@ -1,4 +1,5 @@
 #include "nix/store/async-path-writer.hh"
+#include "nix/store/derivations.hh"
 #include "nix/util/archive.hh"
 
 #include <thread>
@@ -161,6 +162,9 @@ struct AsyncPathWriterImpl : AsyncPathWriter
                 item.references,
                 item.repair);
             assert(storePath == item.storePath);
+            /* Its hash can now be recomputed from the store if evicted. */
+            if (storePath.isDerivation())
+                drvHashes.unpin(storePath);
         }
     }
 };
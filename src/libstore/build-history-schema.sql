@@ -0,0 +1,34 @@
+-- History of the builds performed by this store, including failed
+-- ones. Successful builds are used to estimate how long future builds
+-- of the same derivation will take. Builds older than
+-- `build-history-max-age` are removed.
+
+create table if not exists BuildHistory (
+    id integer primary key autoincrement not null,
+    name text not null, -- derivation name without the version
+    system text not null,
+    drvPath text not null,
+    startTime integer not null,
+    stopTime integer not null,
+    status text not null, -- see BuildResult::{Success,Failure}::Status
+    cpuUser integer, -- microseconds
+    cpuSystem integer, -- microseconds
+    peakMemory integer, -- bytes
+    ioReadBytes integer,
+    ioWriteBytes integer
+);
+
+create index if not exists IndexBuildHistory on BuildHistory(name, system);
+
+create index if not exists IndexBuildHistoryStopTime on BuildHistory(stopTime);
+
+-- The outputs produced by each build.
+create table if not exists BuildHistoryOutputs (
+    build integer not null,
+    outputName text not null,
+    path text not null,
+    primary key (build, outputName),
+    foreign key (build) references BuildHistory(id) on delete cascade
+);
+
+create index if not exists IndexBuildHistoryOutputs on BuildHistoryOutputs(path);
@@ -0,0 +1,52 @@
+#include "nix/store/build-history.hh"
+#include "nix/util/json-utils.hh"
+
+#include <nlohmann/json.hpp>
+
+namespace nlohmann {
+
+using namespace nix;
+
+BuildHistoryEntry adl_serializer<BuildHistoryEntry>::from_json(const json & j)
+{
+    BuildHistoryEntry entry{
+        .drvPath = StorePath{getString(j.at("drvPath"))},
+        .system = getString(j.at("system")),
+        .startTime = (time_t) getInteger<int64_t>(j.at("startTime")),
+        .stopTime = (time_t) getInteger<int64_t>(j.at("stopTime")),
+        .status = getString(j.at("status")),
+        .cpuUser = j.at("cpuUser").get<std::optional<uint64_t>>().transform(
+            [](auto n) { return std::chrono::microseconds(n); }),
+        .cpuSystem = j.at("cpuSystem").get<std::optional<uint64_t>>().transform(
+            [](auto n) { return std::chrono::microseconds(n); }),
+        .peakMemory = j.at("peakMemory").get<std::optional<uint64_t>>(),
+        .ioReadBytes = j.at("ioReadBytes").get<std::optional<uint64_t>>(),
+        .ioWriteBytes = j.at("ioWriteBytes").get<std::optional<uint64_t>>(),
+    };
+    for (auto & [name, path] : getObject(j.at("outputs")))
+        entry.outputs.insert_or_assign(name, StorePath{getString(path)});
+    return entry;
+}
+
+void adl_serializer<BuildHistoryEntry>::to_json(json & j, const BuildHistoryEntry & entry)
+{
+    auto outputs = json::object();
+    for (auto & [name, path] : entry.outputs)
+        outputs[name] = path.to_string();
+
+    j = nlohmann::json{
+        {"drvPath", entry.drvPath.to_string()},
+        {"system", entry.system},
+        {"startTime", entry.startTime},
+        {"stopTime", entry.stopTime},
+        {"status", entry.status},
+        {"cpuUser", entry.cpuUser.transform([](auto t) { return t.count(); })},
+        {"cpuSystem", entry.cpuSystem.transform([](auto t) { return t.count(); })},
+        {"peakMemory", entry.peakMemory},
+        {"ioReadBytes", entry.ioReadBytes},
+        {"ioWriteBytes", entry.ioWriteBytes},
+        {"outputs", std::move(outputs)},
+    };
+}
+
+} // namespace nlohmann
@@ -97,6 +97,15 @@ void adl_serializer<BuildResult>::to_json(json & res, const BuildResult & br)
     if (br.cpuSystem.has_value()) {
         res["cpuSystem"] = br.cpuSystem->count();
     }
+    if (br.peakMemory.has_value()) {
+        res["peakMemory"] = *br.peakMemory;
+    }
+    if (br.ioReadBytes.has_value()) {
+        res["ioReadBytes"] = *br.ioReadBytes;
+    }
+    if (br.ioWriteBytes.has_value()) {
+        res["ioWriteBytes"] = *br.ioWriteBytes;
+    }
 
     // Handle success or failure variant
     std::visit(
@@ -133,6 +142,15 @@ BuildResult adl_serializer<BuildResult>::from_json(const json & _json)
     if (auto cpuSystem = optionalValueAt(json, "cpuSystem")) {
         br.cpuSystem = std::chrono::microseconds(getUnsigned(*cpuSystem));
     }
+    if (auto peakMemory = optionalValueAt(json, "peakMemory")) {
+        br.peakMemory = getUnsigned(*peakMemory);
+    }
+    if (auto ioReadBytes = optionalValueAt(json, "ioReadBytes")) {
+        br.ioReadBytes = getUnsigned(*ioReadBytes);
+    }
+    if (auto ioWriteBytes = optionalValueAt(json, "ioWriteBytes")) {
+        br.ioWriteBytes = getUnsigned(*ioWriteBytes);
+    }
 
     // Determine success or failure based on success field
     bool success = getBoolean(valueAt(json, "success"));
@@ -0,0 +1,142 @@
+#include "nix/store/build/build-log-file.hh"
+#include "nix/util/compression.hh"
+#include "nix/util/file-system.hh"
+
+#include <fcntl.h>
+
+namespace nix {
+
+/**
+ * How much data may be queued before output is dropped.
+ */
+static constexpr size_t maxPendingSize = 64 * 1024 * 1024;
+
+BuildLogFile::BuildLogFile(const Path & path, std::optional<std::string> compression)
+    : path(path)
+{
+    fd = toDescriptor(open(
+        path.c_str(),
+        O_CREAT | O_WRONLY | O_TRUNC
+#ifndef _WIN32
+            | O_CLOEXEC
+#endif
+        ,
+        0666));
+    if (!fd)
+        throw SysError("creating log file '%1%'", path);
+
+    fileSink = FdSink(fd.get());
+
+    if (compression)
+        compressionSink = makeCompressionSink(*compression, fileSink).get_ptr();
+
+    thread = std::thread([this]() { run(); });
+}
+
+BuildLogFile::~BuildLogFile()
+{
+    try {
+        if (thread.joinable())
+            finish();
+    } catch (...) {
+        ignoreExceptionInDestructor();
+    }
+}
+
+void BuildLogFile::operator()(std::string_view data)
+{
+    if (data.empty())
+        return;
+
+    auto state(state_.lock());
+
+    /* If writing failed, finish() will report it. */
+    if (state->error)
+        return;
+
+    /* Don't hold up the worker if the disk can't keep up with the
+       builder; drop the output instead. */
+    if (state->pendingSize + data.size() > maxPendingSize) {
+        if (!state->warned) {
+            state->warned = true;
+            warn("dropping build output because the log file '%s' cannot be written fast enough", path);
+        }
+        state->dropped += data.size();
+        return;
+    }
+
+    queueDropped(*state);
+    state->pending.emplace_back(data);
+    state->pendingSize += data.size();
+    wakeup.notify_one();
+}
+
+void BuildLogFile::queueDropped(State & state)
+{
+    if (!state.dropped)
+        return;
+    auto note = fmt("\n[%d bytes of output dropped because the log could not be written fast enough]\n", state.dropped);
+    state.pendingSize += note.size();
+    state.pending.push_back(std::move(note));
+    state.dropped = 0;
+}
+
+void BuildLogFile::run()
+{
+    try {
+        while (true) {
+            std::deque<std::string> batch;
+            bool finishing;
+
+            {
+                auto state(state_.lock());
+                while (state->pending.empty() && !state->finishing)
+                    state.wait(wakeup);
+                batch = std::move(state->pending);
+                state->pending.clear();
+                state->pendingSize = 0;
+                finishing = state->finishing;
+            }
+
+            if (batch.empty() && finishing)
+                break;
+
+            for (auto & data : batch) {
+                if (compressionSink)
+                    (*compressionSink)(data);
+                else
+                    fileSink(data);
+            }
+        }
+
+        if (compressionSink)
+            compressionSink->finish();
+        fileSink.flush();
+    } catch (...) {
+        state_.lock()->error = std::current_exception();
+    }
+}
+
+void BuildLogFile::finish()
+{
+    {
+        auto state(state_.lock());
+        queueDropped(*state);
+        state->finishing = true;
+    }
+    wakeup.notify_one();
+
+    thread.join();
+
+    /* If writing failed, drop whatever is still buffered, so that the
+       sinks don't write it to `fd` after it has been closed. */
+    compressionSink.reset();
+    fileSink.bufPos = 0;
+
+    fd.close();
+
+    if (auto error = state_.lock()->error)
+        std::rethrow_exception(error);
+}
+
+} // namespace nix
@@ -0,0 +1,65 @@
+#include "nix/store/build/build-resource-pool.hh"
+
+#include <algorithm>
+
+namespace nix {
+
+BuildResourcePool::Token::Token(BuildResourcePool & pool, OnRebalance onRebalance)
+    : pool(pool)
+    , onRebalance(std::move(onRebalance))
+{
+}
+
+BuildResourcePool::Token::~Token()
+{
+    pool.tokens.erase(pos);
+    /* Builds that are still running get the freed resources; the hint
+       from the last `acquire()` no longer applies. */
+    pool.expectedBuilds = 0;
+    pool.rebalance(nullptr);
+}
+
+BuildResourcePool::BuildResourcePool(unsigned int cores, std::optional<uint64_t> memory)
+    : cores(std::max(cores, 1U))
+    , memory(memory)
+{
+}
+
+std::unique_ptr<BuildResourcePool::Token> BuildResourcePool::acquire(size_t expectedBuilds, OnRebalance onRebalance)
+{
+    std::unique_ptr<Token> token(new Token(*this, std::move(onRebalance)));
+    token->pos = tokens.insert(tokens.end(), token.get());
+    this->expectedBuilds = expectedBuilds;
+    rebalance(token.get());
+    return token;
+}
+
+void BuildResourcePool::rebalance(Token * skip)
+{
+    if (tokens.empty())
+        return;
+
+    /* The number of cores is advertised to the builder when it starts
+       (`NIX_BUILD_CORES`), so reserve cores for the builds that are
+       expected to start soon. The memory limit is only enforced, and
+       is lowered once those builds have actually started, so divide
+       the memory between the running builds only. */
+    auto shares = std::max(tokens.size(), expectedBuilds);
+
+    /* Give every build an equal number of cores (but at least one),
+       handing out the remainder to the oldest builds. */
+    size_t n = 0;
+    for (auto token : tokens) {
+        BuildBudget budget{
+            .cores = std::max<unsigned int>(1, cores / shares + (n++ < cores % shares ? 1 : 0)),
+            .memory = memory.transform([&](uint64_t m) { return m / tokens.size(); }),
+        };
+        if (budget == token->budget_)
+            continue;
+        token->budget_ = budget;
+        if (token != skip && token->onRebalance)
+            token->onRebalance(budget);
+    }
+}
+
+} // namespace nix
@@ -2,6 +2,7 @@
 #include "nix/store/build/derivation-env-desugar.hh"
 #ifndef _WIN32 // TODO enable build hook on Windows
 #  include "nix/store/build/hook-instance.hh"
+#  include "nix/store/build/remote-build-dispatcher.hh"
 #  include "nix/store/build/derivation-builder.hh"
 #endif
 #include "nix/util/processes.hh"
@@ -60,14 +61,37 @@ std::string DerivationBuildingGoal::key()
     return "dd$" + std::string(drvPath.name()) + "$" + worker.store.printStorePath(drvPath);
 }
 
+std::chrono::seconds DerivationBuildingGoal::expectedDuration()
+{
+    if (!expectedBuildTime) {
+        expectedBuildTime = defaultExpectedBuildTime;
+        if (auto localStore = dynamic_cast<LocalStore *>(&worker.store)) {
+            try {
+                if (auto t = localStore->queryExpectedBuildTime(drvPath, drv->platform))
+                    expectedBuildTime = *t;
+            } catch (Error & e) {
+                debug("cannot query the build history: %s", e.msg());
+            }
+        }
+    }
+    return *expectedBuildTime;
+}
+
 void DerivationBuildingGoal::killChild()
 {
 #ifndef _WIN32 // TODO enable build hook on Windows
     hook.reset();
+    if (remoteBuild) {
+        /* Drops the connection to the remote machine, which aborts the
+           build there. */
+        remoteBuild.reset();
+        worker.childTerminated(this);
+    }
 #endif
 #ifndef _WIN32 // TODO enable `DerivationBuilder` on Windows
     if (builder && builder->killChild())
         worker.childTerminated(this);
+    buildResources.reset();
 #endif
 }
 
@@ -266,6 +290,8 @@ Goal::Co DerivationBuildingGoal::tryToBuild()
 #ifndef _WIN32 // TODO enable build hook on Windows
         if (hook)
             msg += fmt(" on '%s'", hook->machineName);
+        else if (remoteBuild)
+            msg += fmt(" on '%s'", remoteBuild->machineName);
 #endif
         act = std::make_unique<Activity>(
             *logger,
@@ -275,7 +301,9 @@ Goal::Co DerivationBuildingGoal::tryToBuild()
             Logger::Fields{
                 worker.store.printStorePath(drvPath),
 #ifndef _WIN32 // TODO enable build hook on Windows
-                hook ? hook->machineName :
+                hook          ? hook->machineName
+                : remoteBuild ? remoteBuild->machineName
+                              :
 #endif
                      "",
                 1,
@@ -305,8 +333,9 @@ Goal::Co DerivationBuildingGoal::tryToBuild()
 
            The locks are automatically released when we exit this function or Nix
            crashes.  If we can't acquire the lock, then continue; hopefully some
-           other goal can start a build, and if not, the main loop will sleep a few
-           seconds and then retry this goal. */
+           other goal can start a build, and if not, the main loop will retry
+           this goal once the lock is released (or after a few seconds if it
+           can't watch the lock files). */
         std::set<std::filesystem::path> lockFiles;
         /* FIXME: Should lock something like the drv itself so we don't build same
            CA drv concurrently */
@@ -333,7 +362,7 @@ Goal::Co DerivationBuildingGoal::tryToBuild()
             /* Wait then try locking again, repeat until success (returned
                boolean is true). */
             do {
-                co_await waitForAWhile();
+                co_await waitForLocks(lockFiles);
             } while (!outputLocks.lockPaths(lockFiles, "", false));
         }
 
@@ -446,7 +475,7 @@ Goal::Co DerivationBuildingGoal::tryToBuild()
         co_await Suspend{};
 
 #ifndef _WIN32
-        assert(hook);
+        assert(hook || remoteBuild);
 #endif
 
         trace("hook build done");
@@ -454,12 +483,26 @@ Goal::Co DerivationBuildingGoal::tryToBuild()
         /* Since we got an EOF on the logger pipe, the builder is presumed
            to have terminated.  In fact, the builder could also have
            simply have closed its end of the pipe, so just to be sure,
-           kill it. */
-        int status =
+           kill it. A remote build thread closes its pipe just before
+           exiting, so wait for it. */
+        int status = 0;
+        std::optional<BuildError> remoteError;
 #ifndef _WIN32 // TODO enable build hook on Windows
-            hook->pid.kill();
-#else
-            0;
+        if (remoteBuild) {
+            remoteBuild->join();
+            if (remoteBuild->error) {
+                try {
+                    std::rethrow_exception(remoteBuild->error);
+                } catch (BuildError & e) {
+                    remoteError = std::move(e);
+                } catch (Error & e) {
+                    remoteError.emplace(BuildResult::Failure::MiscFailure, e.msg());
+                } catch (std::exception & e) {
+                    remoteError.emplace(BuildResult::Failure::MiscFailure, e.what());
+                }
+            }
+        } else
+            status = hook->pid.kill();
 #endif
 
         debug("build hook for '%s' finished", worker.store.printStorePath(drvPath));
@@ -472,13 +515,21 @@ Goal::Co DerivationBuildingGoal::tryToBuild()
 
         /* Close the read side of the logger pipe. */
 #ifndef _WIN32 // TODO enable build hook on Windows
-        hook->builderOut.readSide.close();
-        hook->fromHook.readSide.close();
+        if (hook) {
+            hook->builderOut.readSide.close();
+            hook->fromHook.readSide.close();
+        }
+        remoteBuild.reset();
 #endif
 
         /* Close the log file. */
         closeLogFile();
 
+        if (remoteError) {
+            outputLocks.unlock();
+            co_return doneFailure(std::move(*remoteError));
+        }
+
         /* Check the exit status. */
         if (!statusOk(status)) {
             auto e = fixupBuilderFailureErrorMessage({BuildResult::Failure::MiscFailure, status, ""});
@@ -644,9 +695,18 @@ Goal::Co DerivationBuildingGoal::tryToBuild()
                                             std::move(params));
         }
 
+        if (settings.adaptiveBuildResources && !buildResources) {
+            buildResources = worker.acquireBuildResources([this](const BuildBudget & budget) {
+                if (builder)
+                    builder->setBudget(budget);
+            });
+            builder->setBudget(buildResources->budget());
+        }
+
         if (auto builderOutOpt = builder->startBuild()) {
             builderOut = *std::move(builderOutOpt);
         } else {
+            buildResources.reset();
             if (!actLock)
                 actLock = std::make_unique<Activity>(
                     *logger,
@@ -669,6 +729,8 @@ Goal::Co DerivationBuildingGoal::tryToBuild()
 
     trace("build done");
 
+    buildResources.reset();
+
     SingleDrvOutputs builtOutputs;
     try {
         builtOutputs = builder->unprepareBuild();
@@ -834,6 +896,9 @@ HookReply DerivationBuildingGoal::tryBuildHook(
 #ifdef _WIN32 // TODO enable build hook on Windows
     return rpDecline;
 #else
+    if (settings.remoteBuildDispatcher)
+        return tryRemoteBuild(initialOutputs, drvOptions);
+
     /* This should use `worker.evalStore`, but per #13179 the build hook
        doesn't work with eval store anyways. */
     if (settings.buildHook.get().empty() || !worker.tryBuildHook || !worker.store.isValidPath(drvPath))
@@ -926,7 +991,7 @@ HookReply DerivationBuildingGoal::tryBuildHook(
     hook->toHook.writeSide.close();
 
     /* Create the log file and pipe. */
-    [[maybe_unused]] Path logFile = openLogFile();
+    [[maybe_unused]] Path logFileName = openLogFile();
 
     std::set<MuxablePipePollState::CommChannel> fds;
     fds.insert(hook->fromHook.readSide.get());
@@ -937,6 +1002,62 @@ HookReply DerivationBuildingGoal::tryBuildHook(
 #endif
 }
 
+HookReply DerivationBuildingGoal::tryRemoteBuild(
+    const std::map<std::string, InitialOutput> & initialOutputs, const DerivationOptions<StorePath> & drvOptions)
+{
+#ifdef _WIN32 // TODO enable build hook on Windows
+    return rpDecline;
+#else
+    if (!worker.tryBuildHook || !worker.store.isValidPath(drvPath))
+        return rpDecline;
+
+    if (!worker.remoteBuildDispatcher)
+        worker.remoteBuildDispatcher = std::make_unique<RemoteBuildDispatcher>(worker.store);
+
+    RemoteBuildDispatcher::Request request{
+        .drvPath = drvPath,
+        .system = drv->platform,
+        .requiredFeatures = drvOptions.getRequiredSystemFeatures(*drv),
+        .amWilling = worker.getNrLocalBuilds() < settings.maxBuildJobs,
+        .couldBuildLocally = settings.maxBuildJobs > 0 && drvOptions.canBuildLocally(worker.store, *drv),
+        .inputs = inputPaths,
+    };
+
+    for (auto & [outputName, status] : initialOutputs) {
+        if (buildMode != bmCheck && status.known && status.known->isValid())
+            continue;
+        request.wantedOutputs.insert(outputName);
+    }
+
+    auto res = worker.remoteBuildDispatcher->tryBuild(std::move(request));
+
+    if (auto * reply = std::get_if<RemoteBuildDispatcher::Reply>(&res)) {
+        switch (*reply) {
+        case RemoteBuildDispatcher::Reply::DeclinePermanently:
+            worker.tryBuildHook = false;
+            return rpDecline;
+        case RemoteBuildDispatcher::Reply::Decline:
+            return rpDecline;
+        case RemoteBuildDispatcher::Reply::Postpone:
+            return rpPostpone;
+        }
+        unreachable();
+    }
+
+    remoteBuild = std::move(std::get<std::unique_ptr<RemoteBuild>>(res));
+
+    /* There is no build log to capture: the remote store forwards the
+       log to our logger, and it is kept on the remote machine. So
+       don't open a local log file, which would stay empty and hide the
+       remote one. We only wait for the thread to close its pipe. */
+    /* The pipe carries no log output, so only enforce `build-timeout`
+       here. `max-silent-time` is enforced by the remote machine. */
+    worker.childStarted(shared_from_this(), {remoteBuild->done.readSide.get()}, false, true, false);
+
+    return rpAccept;
+#endif
+}
+
 Path DerivationBuildingGoal::openLogFile()
 {
     logSize = 0;
@@ -955,38 +1076,20 @@ Path DerivationBuildingGoal::openLogFile()
     Path dir = fmt("%s/%s/%s/", logDir, LocalFSStore::drvsLogDir, baseName.substr(0, 2));
     createDirs(dir);
 
-    Path logFileName = fmt("%s/%s%s", dir, baseName.substr(2), settings.compressLog ? ".bz2" : "");
-
-    fdLogFile = toDescriptor(open(
-        logFileName.c_str(),
-        O_CREAT | O_WRONLY | O_TRUNC
-#ifndef _WIN32
-            | O_CLOEXEC
-#endif
-        ,
-        0666));
-    if (!fdLogFile)
-        throw SysError("creating log file '%1%'", logFileName);
-
-    logFileSink = std::make_shared<FdSink>(fdLogFile.get());
+    Path logFileName = fmt("%s/%s%s", dir, baseName.substr(2), settings.compressLog ? ".zst" : "");
 
-    if (settings.compressLog)
-        logSink = std::shared_ptr<CompressionSink>(makeCompressionSink("bzip2", *logFileSink));
-    else
-        logSink = logFileSink;
+    logFile = std::make_unique<BuildLogFile>(
+        logFileName, settings.compressLog ? std::optional<std::string>("zstd") : std::nullopt);
 
     return logFileName;
 }
 
 void DerivationBuildingGoal::closeLogFile()
 {
-    auto logSink2 = std::dynamic_pointer_cast<CompressionSink>(logSink);
-    if (logSink2)
-        logSink2->finish();
-    if (logFileSink)
-        logFileSink->flush();
-    logSink = logFileSink = 0;
-    fdLogFile.close();
+    if (logFile) {
+        auto logFile2 = std::move(logFile);
+        logFile2->finish();
+    }
 }
 
 bool DerivationBuildingGoal::isReadDesc(Descriptor fd)
@@ -1027,8 +1130,8 @@ void DerivationBuildingGoal::handleChildOutput(Descriptor fd, std::string_view d
                 currentLogLine[currentLogLinePos++] = c;
             }
 
-        if (logSink)
-            (*logSink)(data);
+        if (logFile)
+            (*logFile)(data);
     }
 
 #ifndef _WIN32 // TODO enable build hook on Windows
@@ -1040,11 +1143,11 @@ void DerivationBuildingGoal::handleChildOutput(Descriptor fd, std::string_view d
                     auto s = handleJSONLogMessage(*json, worker.act, hook->activities, "the derivation builder", true);
                     // ensure that logs from a builder using `ssh-ng://` as protocol
                     // are also available to `nix log`.
-                    if (s && !isWrittenToLog && logSink) {
+                    if (s && !isWrittenToLog && logFile) {
                         const auto type = (*json)["type"];
                         const auto fields = (*json)["fields"];
                         if (type == resBuildLogLine) {
-                            (*logSink)((fields.size() > 0 ? fields[0].get<std::string>() : "") + "\n");
+                            (*logFile)((fields.size() > 0 ? fields[0].get<std::string>() : "") + "\n");
                         } else if (type == resSetPhase && !fields.is_null()) {
                             const auto phase = fields[0];
                             if (!phase.is_null()) {
@@ -1054,7 +1157,7 @@ void DerivationBuildingGoal::handleChildOutput(Descriptor fd, std::string_view d
                                 // The format is:
                                 //   @nix { "action": "setPhase", "phase": "$curPhase" }
                                 const auto logLine = nlohmann::json::object({{"action", "setPhase"}, {"phase", phase}});
-                                (*logSink)(
+                                (*logFile)(
                                     "@nix " + logLine.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace)
                                     + "\n");
                             }
@@ -1185,6 +1288,11 @@ Goal::Done DerivationBuildingGoal::doneSuccess(BuildResult::Success::Status stat
         .builtOutputs = std::move(builtOutputs),
     };
 
+    /* Record how long the build took, so that the scheduler can
+       prioritise it accordingly next time. */
+    if (status == BuildResult::Success::Built)
+        addToBuildHistory();
+
     logger->result(
         act ? act->id : getCurActivity(),
         resBuildResult,
@@ -1209,6 +1317,8 @@ Goal::Done DerivationBuildingGoal::doneFailure(BuildError ex)
         .errorMsg = fmt("%s", Uncolored(ex.info().msg)),
     };
 
+    addToBuildHistory();
+
     logger->result(
         act ? act->id : getCurActivity(),
         resBuildResult,
@@ -1230,4 +1340,26 @@ Goal::Done DerivationBuildingGoal::doneFailure(BuildError ex)
     return amDone(ecFailed, {std::move(ex)});
 }
 
+void DerivationBuildingGoal::addToBuildHistory()
+{
+    if (!buildResult.startTime)
+        return;
+
+    /* A builder that was killed, e.g. because it timed out, has no
+       stop time yet. */
+    if (buildResult.stopTime < buildResult.startTime)
+        buildResult.stopTime = time(0);
+
+    if (auto localStore = dynamic_cast<LocalStore *>(&worker.store)) {
+        try {
+            localStore->addBuildToHistory(drvPath, drv->platform, buildResult);
+        } catch (Error & e) {
+            debug(
+                "cannot record build of '%s' in the build history: %s",
+                worker.store.printStorePath(drvPath),
+                e.msg());
+        }
+    }
+}
+
 } // namespace nix
@@ -220,6 +220,13 @@ Goal::Co Goal::waitForAWhile()
     co_return Return{};
 }
 
+Goal::Co Goal::waitForLocks(std::set<std::filesystem::path> paths)
+{
+    worker.waitForLocks(shared_from_this(), paths);
+    co_await Suspend{};
+    co_return Return{};
+}
+
 Goal::Co Goal::waitForBuildSlot()
 {
     worker.waitForBuildSlot(shared_from_this());
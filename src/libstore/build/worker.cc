@@ -9,14 +9,29 @@
 #include "nix/store/build/derivation-trampoline-goal.hh"
 #ifndef _WIN32 // TODO Enable building on Windows
 #  include "nix/store/build/hook-instance.hh"
+#  include "nix/store/build/remote-build-dispatcher.hh"
 #endif
 #include "nix/util/signals.hh"
 #include "nix/store/globals.hh"
 
+#include <unistd.h>
+
 namespace nix {
 
+static std::optional<uint64_t> getTotalMemory()
+{
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+    auto pages = sysconf(_SC_PHYS_PAGES);
+    auto pageSize = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && pageSize > 0)
+        return (uint64_t) pages * pageSize;
+#endif
+    return std::nullopt;
+}
+
 Worker::Worker(Store & store, Store & evalStore)
-    : act(*logger, actRealise)
+    : buildResourcePool(settings.buildCores ? settings.buildCores : settings.getDefaultCores(), getTotalMemory())
+    , act(*logger, actRealise)
     , actDerivations(*logger, actBuilds)
     , actSubstitutions(*logger, actCopyPaths)
     , store(store)
@@ -39,6 +54,12 @@ Worker::~Worker()
        their destructors). */
     topGoals.clear();
 
+    /* Goals that are still running are kept alive by `children`.
+       Destroy them too, while the remote build dispatcher that their
+       remote builds refer to still exists. */
+    auto children2 = std::move(children);
+    children2.clear();
+
     assert(expectedSubstitutions == 0);
     assert(expectedDownloadSize == 0);
     assert(expectedNarSize == 0);
@@ -215,7 +236,11 @@ size_t Worker::getNrSubstitutions()
 }
 
 void Worker::childStarted(
-    GoalPtr goal, const std::set<MuxablePipePollState::CommChannel> & channels, bool inBuildSlot, bool respectTimeouts)
+    GoalPtr goal,
+    const std::set<MuxablePipePollState::CommChannel> & channels,
+    bool inBuildSlot,
+    bool respectTimeouts,
+    bool respectMaxSilentTime)
 {
     Child child;
     child.goal = goal;
@@ -224,6 +249,7 @@ void Worker::childStarted(
     child.timeStarted = child.lastOutput = steady_time_point::clock::now();
     child.inBuildSlot = inBuildSlot;
     child.respectTimeouts = respectTimeouts;
+    child.respectMaxSilentTime = respectMaxSilentTime;
     children.emplace_back(child);
     if (inBuildSlot) {
         switch (goal->jobCategory()) {
@@ -292,6 +318,28 @@ void Worker::waitForBuildSlot(GoalPtr goal)
         addToWeakGoals(wantingToBuild, goal);
 }
 
+std::unique_ptr<BuildResourcePool::Token> Worker::acquireBuildResources(BuildResourcePool::OnRebalance onRebalance)
+{
+    /* Assume that the goals waiting for a build slot will start soon,
+       up to the maximum number of concurrent builds. */
+    auto expectedBuilds = std::min<size_t>(settings.maxBuildJobs, nrLocalBuilds + 1 + wantingToBuild.size());
+    return buildResourcePool.acquire(expectedBuilds, std::move(onRebalance));
+}
+
+std::chrono::seconds Worker::getCriticalPath(Goal & goal, std::map<Goal *, std::chrono::seconds> & memo)
+{
+    auto [i, inserted] = memo.try_emplace(&goal, 0);
+    if (!inserted)
+        return i->second;
+
+    std::chrono::seconds longestWaiter{0};
+    for (auto & j : goal.waiters)
+        if (auto waiter = j.lock())
+            longestWaiter = std::max(longestWaiter, getCriticalPath(*waiter, memo));
+
+    return i->second = goal.expectedDuration() + longestWaiter;
+}
+
 void Worker::waitForAnyGoal(GoalPtr goal)
 {
     debug("wait for any goal");
@@ -304,6 +352,33 @@ void Worker::waitForAWhile(GoalPtr goal)
     addToWeakGoals(waitingForAWhile, goal);
 }
 
+void Worker::waitForLocks(GoalPtr goal, const std::set<std::filesystem::path> & paths)
+{
+    debug("wait for locks");
+    /* Keep polling in case the lock files can't be watched, or are
+       released before the watches are in place. */
+    addToWeakGoals(waitingForAWhile, goal);
+    bool watched = false;
+    for (auto & path : paths)
+        if (lockFileWatcher.watch(path)) {
+            addToWeakGoals(waitingForLock[path], goal);
+            watched = true;
+        }
+
+    /* A lock released between the goal's failed attempt and setting
+       up the watches isn't reported, so check once more. Releasing
+       the probe lock wakes up other waiters, like any release. */
+    if (watched) {
+        PathLocks probe;
+        if (probe.lockPaths(paths, "", false)) {
+            probe.unlock();
+            debug("locks were released while setting up the watches");
+            waitingForAWhile.erase(goal);
+            wakeUp(goal);
+        }
+    }
+}
+
 void Worker::run(const Goals & _topGoals)
 {
     std::vector<nix::DerivedPath> topPaths;
@@ -334,16 +409,24 @@ void Worker::run(const Goals & _topGoals)
         if (auto localStore = dynamic_cast<LocalStore *>(&store))
             localStore->autoGC(false);
 
-        /* Call every wake goal (in the ordering established by
+        /* Call every wake goal, in order of decreasing critical path
+           (and otherwise in the ordering established by
            CompareGoalPtrs). */
         while (!awake.empty() && !topGoals.empty()) {
-            Goals awake2;
+            Goals awakeSet;
             for (auto & i : awake) {
                 GoalPtr goal = i.lock();
                 if (goal)
-                    awake2.insert(goal);
+                    awakeSet.insert(goal);
             }
             awake.clear();
+            std::vector<GoalPtr> awake2(awakeSet.begin(), awakeSet.end());
+            std::map<Goal *, std::chrono::seconds> criticalPaths;
+            for (auto & goal : awake2)
+                getCriticalPath(*goal, criticalPaths);
+            std::stable_sort(awake2.begin(), awake2.end(), [&](const GoalPtr & a, const GoalPtr & b) {
+                return criticalPaths[a.get()] > criticalPaths[b.get()];
+            });
             for (auto & goal : awake2) {
                 checkInterrupt();
                 goal->work();
@@ -405,7 +488,7 @@ void Worker::waitForInput()
     for (auto & i : children) {
         if (!i.respectTimeouts)
             continue;
-        if (0 != settings.maxSilentTime)
+        if (0 != settings.maxSilentTime && i.respectMaxSilentTime)
             nearest = std::min(nearest, i.lastOutput + std::chrono::seconds(settings.maxSilentTime));
         if (0 != settings.buildTimeout)
             nearest = std::min(nearest, i.timeStarted + std::chrono::seconds(settings.buildTimeout));
@@ -444,6 +527,14 @@ void Worker::waitForInput()
             state.fdToPollStatus[j] = state.pollStatus.size() - 1;
         }
     }
+
+    /* Also wait for any of the locks that goals are waiting for to be
+       released. */
+    std::optional<size_t> lockWatcherPollStatus;
+    if (!waitingForLock.empty() && lockFileWatcher.getDescriptor() != INVALID_DESCRIPTOR) {
+        state.pollStatus.push_back((struct pollfd) {.fd = lockFileWatcher.getDescriptor(), .events = POLLIN});
+        lockWatcherPollStatus = state.pollStatus.size() - 1;
+    }
 #endif
 
     state.poll(
@@ -478,7 +569,7 @@ void Worker::waitForInput()
             });
 
         if (goal->exitCode == Goal::ecBusy && 0 != settings.maxSilentTime && j->respectTimeouts
-            && after - j->lastOutput >= std::chrono::seconds(settings.maxSilentTime)) {
+            && j->respectMaxSilentTime && after - j->lastOutput >= std::chrono::seconds(settings.maxSilentTime)) {
             goal->timedOut(
                 Error("%1% timed out after %2% seconds of silence", goal->getName(), settings.maxSilentTime));
         }
@@ -490,6 +581,26 @@ void Worker::waitForInput()
         }
     }
 
+#ifndef _WIN32
+    if (lockWatcherPollStatus && (state.pollStatus[*lockWatcherPollStatus].revents & POLLIN)) {
+        for (auto & path : lockFileWatcher.readEvents()) {
+            auto i = waitingForLock.find(path);
+            if (i == waitingForLock.end())
+                continue;
+            for (auto & j : i->second) {
+                /* Only wake up goals that are still waiting; others
+                   have already been woken up by polling. */
+                GoalPtr goal = j.lock();
+                if (goal && waitingForAWhile.erase(j)) {
+                    debug("lock on %s may have been released", path);
+                    wakeUp(goal);
+                }
+            }
+            waitingForLock.erase(i);
+        }
+    }
+#endif
+
     if (!waitingForAWhile.empty() && lastWokenUp + std::chrono::seconds(settings.pollInterval) <= after) {
         lastWokenUp = after;
         for (auto & i : waitingForAWhile) {
@@ -498,6 +609,7 @@ void Worker::waitForInput()
                 wakeUp(goal);
         }
         waitingForAWhile.clear();
+        waitingForLock.clear();
     }
 }
 
@@ -18,6 +18,7 @@
 #include "nix/util/logging.hh"
 #include "nix/store/globals.hh"
 #include "nix/store/active-builds.hh"
+#include "nix/store/build-history.hh"
 
 #ifndef _WIN32 // TODO need graceful async exit support on Windows?
 #  include "nix/util/monitor-fd.hh"
@@ -1026,6 +1027,20 @@ static void performOp(
         break;
     }
 
+    case WorkerProto::Op::QueryBuildHistory: {
+        BuildHistoryQuery query;
+        if (auto name = readString(conn.from); !name.empty())
+            query.name = std::move(name);
+        query.outputPath = WorkerProto::Serialise<std::optional<StorePath>>::read(*store, rconn);
+        query.limit = readNum<size_t>(conn.from);
+        logger->startWork();
+        auto & historyStore = require<BuildHistoryStore>(*store);
+        auto builds = historyStore.queryBuildHistory(query);
+        logger->stopWork();
+        conn.to << nlohmann::json(builds).dump();
+        break;
+    }
+
     default:
         throw Error("invalid operation %1%", op);
     }
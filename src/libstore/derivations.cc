@@ -10,10 +10,12 @@
 #include "nix/util/strings-inline.hh"
 #include "nix/util/json-utils.hh"
 #include "nix/store/async-path-writer.hh"
+#include "nix/store/sqlite.hh"
+#include "nix/util/users.hh"
 
 #include <boost/container/small_vector.hpp>
-#include <boost/unordered/concurrent_flat_map.hpp>
 #include <nlohmann/json.hpp>
+#include <cstring>
 #include <optional>
 
 namespace nix {
@@ -158,17 +160,26 @@ StorePath Store::writeDerivation(const Derivation & drv, RepairFlag repair)
 }
 
 StorePath writeDerivation(
-    Store & store, AsyncPathWriter & asyncPathWriter, const Derivation & drv, RepairFlag repair, bool readOnly)
+    Store & store,
+    AsyncPathWriter & asyncPathWriter,
+    const Derivation & drv,
+    RepairFlag repair,
+    bool readOnly,
+    std::optional<DrvHash> drvHash)
 {
-    auto references = drv.inputSrcs;
-    for (auto & i : drv.inputDrvs.map)
-        references.insert(i.first);
-    return asyncPathWriter.addPath(
-        drv.unparse(store, false),
-        std::string(drv.name) + drvExtension,
-        references,
-        repair,
-        readOnly || settings.readOnlyMode);
+    auto [suffix, contents, references, path] = infoForDerivation(store, drv);
+
+    /* The path writer unpins the entry once it has written the
+       derivation, so the entry must be pinned before the write is
+       queued. */
+    if (drvHash)
+        drvHashes.insert(path, std::move(*drvHash), true);
+
+    auto path2 = asyncPathWriter.addPath(
+        std::move(contents), std::move(suffix), std::move(references), repair, readOnly || settings.readOnlyMode);
+    assert(path2 == path);
+
+    return path;
 }
 
 namespace {
@@ -306,12 +317,24 @@ static bool endOfList(StringViewStream & str)
     return false;
 }
 
+/* Lists in derivations are sorted, so insert at the end of the
+   container, which is amortized constant time for sorted input. */
+
 static StringSet parseStrings(StringViewStream & str, bool arePaths)
 {
     StringSet res;
     expect(str, '[');
     while (!endOfList(str))
-        res.insert((arePaths ? parsePath(str) : parseString(str)).toOwned());
+        res.insert(res.end(), (arePaths ? parsePath(str) : parseString(str)).toOwned());
+    return res;
+}
+
+static StorePathSet parseStorePaths(const StoreDirConfig & store, StringViewStream & str)
+{
+    StorePathSet res;
+    expect(str, '[');
+    while (!endOfList(str))
+        res.insert(res.end(), store.parseStorePath(*parsePath(str)));
     return res;
 }
 
@@ -482,7 +505,7 @@ Derivation parseDerivation(
         expect(str, '(');
         std::string id = parseString(str).toOwned();
         auto output = parseDerivationOutput(store, str, xpSettings);
-        drv.outputs.emplace(std::move(id), std::move(output));
+        drv.outputs.emplace_hint(drv.outputs.end(), std::move(id), std::move(output));
     }
 
     /* Parse the list of input derivations. */
@@ -492,12 +515,12 @@ Derivation parseDerivation(
         auto drvPath = parsePath(str);
         expect(str, ',');
         drv.inputDrvs.map.insert_or_assign(
-            store.parseStorePath(*drvPath), parseDerivedPathMapNode(store, str, version));
+            drv.inputDrvs.map.end(), store.parseStorePath(*drvPath), parseDerivedPathMapNode(store, str, version));
         expect(str, ')');
     }
 
     expect(str, ',');
-    drv.inputSrcs = store.parseStorePathSet(parseStrings(str, true));
+    drv.inputSrcs = parseStorePaths(store, str);
     expect(str, ',');
     drv.platform = parseString(str).toOwned();
     expect(str, ',');
@@ -518,7 +541,7 @@ Derivation parseDerivation(
         if (name == StructuredAttrs::envVarName) {
             drv.structuredAttrs = StructuredAttrs::parse(*std::move(value));
         } else {
-            drv.env.insert_or_assign(std::move(name), std::move(value).toOwned());
+            drv.env.insert_or_assign(drv.env.end(), std::move(name), std::move(value).toOwned());
         }
         expect(str, ')');
     }
@@ -527,8 +550,64 @@ Derivation parseDerivation(
     return drv;
 }
 
+namespace {
+
+/**
+ * Writes an unparsed derivation to a `Sink` through a small buffer, so
+ * that the unparser doesn't make a virtual call for every character.
+ * Implements the subset of the `std::string` interface that the
+ * unparser uses.
+ */
+struct ATermSinkWriter
+{
+    Sink & sink;
+    std::array<char, 8192> buffer;
+    size_t used = 0;
+
+    ATermSinkWriter(Sink & sink)
+        : sink(sink)
+    {
+    }
+
+    void flush()
+    {
+        sink({buffer.data(), used});
+        used = 0;
+    }
+
+    void append(const char * data, size_t size)
+    {
+        if (used + size > buffer.size()) {
+            flush();
+            if (size > buffer.size()) {
+                sink({data, size});
+                return;
+            }
+        }
+        std::memcpy(buffer.data() + used, data, size);
+        used += size;
+    }
+
+    ATermSinkWriter & operator+=(std::string_view s)
+    {
+        append(s.data(), s.size());
+        return *this;
+    }
+
+    ATermSinkWriter & operator+=(char c)
+    {
+        if (used == buffer.size())
+            flush();
+        buffer[used++] = c;
+        return *this;
+    }
+};
+
+} // namespace
+
 /**
- * Print a derivation string literal to an `std::string`.
+ * Print a derivation string literal to an `std::string` or
+ * `ATermSinkWriter`.
  *
  * This syntax does not generalize to the expression language, which needs to
  * escape `$`.
@@ -536,9 +615,11 @@ Derivation parseDerivation(
  * @param res Where to print to
  * @param s Which logical string to print
  */
-static void printString(std::string & res, std::string_view s)
+template<typename Out>
+static void printString(Out & res, std::string_view s)
 {
-    res.reserve(res.size() + s.size() * 2 + 2);
+    if constexpr (std::is_same_v<Out, std::string>)
+        res.reserve(res.size() + s.size() * 2 + 2);
     res += '"';
     static constexpr auto chunkSize = 1024;
     std::array<char, 2 * chunkSize + 2> buffer;
@@ -567,15 +648,30 @@ static void printString(std::string & res, std::string_view s)
     res += '"';
 }
 
-static void printUnquotedString(std::string & res, std::string_view s)
+template<typename Out>
+static void printUnquotedString(Out & res, std::string_view s)
 {
     res += '"';
-    res.append(s);
+    res += s;
     res += '"';
 }
 
-template<class ForwardIterator>
-static void printStrings(std::string & res, ForwardIterator i, ForwardIterator j)
+/**
+ * Like `printUnquotedString(res, store.printStorePath(path))`, but
+ * without building the path as a temporary string.
+ */
+template<typename Out>
+static void printStorePath(Out & res, const StoreDirConfig & store, const StorePath & path)
+{
+    res += '"';
+    res += store.storeDir;
+    res += '/';
+    res += path.to_string();
+    res += '"';
+}
+
+template<typename Out, class ForwardIterator>
+static void printStrings(Out & res, ForwardIterator i, ForwardIterator j)
 {
     res += '[';
     bool first = true;
@@ -589,8 +685,8 @@ static void printStrings(std::string & res, ForwardIterator i, ForwardIterator j
     res += ']';
 }
 
-template<class ForwardIterator>
-static void printUnquotedStrings(std::string & res, ForwardIterator i, ForwardIterator j)
+template<typename Out, class ForwardIterator>
+static void printUnquotedStrings(Out & res, ForwardIterator i, ForwardIterator j)
 {
     res += '[';
     bool first = true;
@@ -604,8 +700,9 @@ static void printUnquotedStrings(std::string & res, ForwardIterator i, ForwardIt
     res += ']';
 }
 
+template<typename Out>
 static void unparseDerivedPathMapNode(
-    const StoreDirConfig & store, std::string & s, const DerivedPathMap<StringSet>::ChildNode & node)
+    const StoreDirConfig & store, Out & s, const DerivedPathMap<StringSet>::ChildNode & node)
 {
     s += ',';
     if (node.childMap.empty()) {
@@ -647,16 +744,18 @@ static bool hasDynamicDrvDep(const Derivation & drv)
            != drv.inputDrvs.map.end();
 }
 
-std::string Derivation::unparse(
-    const StoreDirConfig & store, bool maskOutputs, DerivedPathMap<StringSet>::ChildNode::Map * actualInputs) const
+template<typename Out>
+static void unparseDerivation(
+    const Derivation & drv,
+    Out & s,
+    const StoreDirConfig & store,
+    bool maskOutputs,
+    const DerivedPathMap<StringSet>::ChildNode::Map * actualInputs)
 {
-    std::string s;
-    s.reserve(65536);
-
     /* Use older unversioned form if possible, for wider compat. Use
        newer form only if we need it, which we do for
        `Xp::DynamicDerivations`. */
-    if (hasDynamicDrvDep(*this)) {
+    if (hasDynamicDrvDep(drv)) {
         s += "DrvWithVersion("sv;
         // Only version we have so far
         printUnquotedString(s, "xp-dyn-drv"sv);
@@ -667,7 +766,7 @@ std::string Derivation::unparse(
 
     bool first = true;
     s += '[';
-    for (auto & i : outputs) {
+    for (auto & i : drv.outputs) {
         if (first)
             first = false;
         else
@@ -678,7 +777,10 @@ std::string Derivation::unparse(
             overloaded{
                 [&](const DerivationOutput::InputAddressed & doi) {
                     s += ',';
-                    printUnquotedString(s, maskOutputs ? ""sv : store.printStorePath(doi.path));
+                    if (maskOutputs)
+                        printUnquotedString(s, ""sv);
+                    else
+                        printStorePath(s, store, doi.path);
                     s += ',';
                     printUnquotedString(s, {});
                     s += ',';
@@ -686,7 +788,10 @@ std::string Derivation::unparse(
                 },
                 [&](const DerivationOutput::CAFixed & dof) {
                     s += ',';
-                    printUnquotedString(s, maskOutputs ? ""sv : store.printStorePath(dof.path(store, name, i.first)));
+                    if (maskOutputs)
+                        printUnquotedString(s, ""sv);
+                    else
+                        printStorePath(s, store, dof.path(store, drv.name, i.first));
                     s += ',';
                     printUnquotedString(s, dof.ca.printMethodAlgo());
                     s += ',';
@@ -735,33 +840,42 @@ std::string Derivation::unparse(
             s += ')';
         }
     } else {
-        for (auto & [drvPath, childMap] : inputDrvs.map) {
+        for (auto & [drvPath, childMap] : drv.inputDrvs.map) {
             if (first)
                 first = false;
             else
                 s += ',';
             s += '(';
-            printUnquotedString(s, store.printStorePath(drvPath));
+            printStorePath(s, store, drvPath);
             unparseDerivedPathMapNode(store, s, childMap);
             s += ')';
         }
     }
 
-    s += "],"sv;
-    auto paths = store.printStorePathSet(inputSrcs); // FIXME: slow
-    printUnquotedStrings(s, paths.begin(), paths.end());
+    /* Store paths sort in the same order as their printed form, since
+       they all have the same prefix. */
+    s += "],["sv;
+    first = true;
+    for (auto & path : drv.inputSrcs) {
+        if (first)
+            first = false;
+        else
+            s += ',';
+        printStorePath(s, store, path);
+    }
+    s += ']';
 
     s += ',';
-    printUnquotedString(s, platform);
+    printUnquotedString(s, drv.platform);
     s += ',';
-    printString(s, builder);
+    printString(s, drv.builder);
     s += ',';
-    printStrings(s, args.begin(), args.end());
+    printStrings(s, drv.args.begin(), drv.args.end());
 
     s += ",["sv;
     first = true;
 
-    auto unparseEnv = [&](const StringPairs atermEnv) {
+    auto unparseEnv = [&](const StringPairs & atermEnv) {
         for (auto & i : atermEnv) {
             if (first)
                 first = false;
@@ -770,25 +884,43 @@ std::string Derivation::unparse(
             s += '(';
             printString(s, i.first);
             s += ',';
-            printString(s, maskOutputs && outputs.count(i.first) ? ""sv : i.second);
+            printString(s, maskOutputs && drv.outputs.count(i.first) ? ""sv : i.second);
             s += ')';
         }
     };
 
-    StructuredAttrs::checkKeyNotInUse(env);
-    if (structuredAttrs) {
-        StringPairs scratch = env;
-        scratch.insert(structuredAttrs->unparse());
+    StructuredAttrs::checkKeyNotInUse(drv.env);
+    if (drv.structuredAttrs) {
+        StringPairs scratch = drv.env;
+        scratch.insert(drv.structuredAttrs->unparse());
         unparseEnv(scratch);
     } else {
-        unparseEnv(env);
+        unparseEnv(drv.env);
     }
 
     s += "])"sv;
+}
 
+std::string Derivation::unparse(
+    const StoreDirConfig & store, bool maskOutputs, DerivedPathMap<StringSet>::ChildNode::Map * actualInputs) const
+{
+    std::string s;
+    s.reserve(65536);
+    unparseDerivation(*this, s, store, maskOutputs, actualInputs);
     return s;
 }
 
+void Derivation::unparse(
+    Sink & sink,
+    const StoreDirConfig & store,
+    bool maskOutputs,
+    DerivedPathMap<StringSet>::ChildNode::Map * actualInputs) const
+{
+    ATermSinkWriter writer(sink);
+    unparseDerivation(*this, writer, store, maskOutputs, actualInputs);
+    writer.flush();
+}
+
 // FIXME: remove
 bool isDerivation(std::string_view fileName)
 {
@@ -866,8 +998,219 @@ DerivationType BasicDerivation::type() const
     return ty.value();
 }
 
+size_t DrvHashes::entrySize(const StorePath & drvPath, const DrvHash & hash)
+{
+    /* A rough estimate of the memory used by an entry, including the
+       nodes of the maps. */
+    size_t size = sizeof(Map::value_type) + 2 * sizeof(void *) + drvPath.to_string().size();
+    for (auto & [outputName, _] : hash.hashes)
+        size += sizeof(std::pair<const std::string, Hash>) + 4 * sizeof(void *) + outputName.size();
+    return size;
+}
+
+Sync<DrvHashes::State> & DrvHashes::shardFor(const StorePath & drvPath)
+{
+    return shards[std::hash<StorePath>{}(drvPath) % nrShards];
+}
+
+void DrvHashes::addCurrent(State & state, const StorePath & drvPath, Entry && entry)
+{
+    state.currentSize += entry.size;
+    state.current.insert_or_assign(drvPath, std::move(entry));
+
+    /* Each shard gets an equal part of the size limit. */
+    if (state.currentSize > settings.derivationHashCacheSize / 2 / nrShards) {
+        debug("evicting %d derivation hashes", state.previous.size());
+        state.previous = std::move(state.current);
+        state.current.clear();
+        state.currentSize = 0;
+    }
+}
+
+std::optional<DrvHash> DrvHashes::get(const StorePath & drvPath)
+{
+    auto state(shardFor(drvPath).lock());
+
+    if (auto i = state->pinned.find(drvPath); i != state->pinned.end())
+        return i->second.hash;
+
+    if (auto i = state->current.find(drvPath); i != state->current.end())
+        return i->second.hash;
+
+    if (auto node = state->previous.extract(drvPath)) {
+        auto hash = node.mapped().hash;
+        addCurrent(*state, drvPath, std::move(node.mapped()));
+        return hash;
+    }
+
+    return std::nullopt;
+}
+
+void DrvHashes::insert(const StorePath & drvPath, DrvHash hash, bool pinned)
+{
+    auto state(shardFor(drvPath).lock());
+
+    auto size = entrySize(drvPath, hash);
+    Entry entry{.hash = std::move(hash), .size = size};
+
+    if (pinned || state->pinned.contains(drvPath)) {
+        state->current.erase(drvPath);
+        state->previous.erase(drvPath);
+        state->pinned.insert_or_assign(drvPath, std::move(entry));
+        return;
+    }
+
+    state->previous.erase(drvPath);
+    if (auto i = state->current.find(drvPath); i != state->current.end())
+        i->second.hash = std::move(entry.hash);
+    else
+        addCurrent(*state, drvPath, std::move(entry));
+}
+
+void DrvHashes::unpin(const StorePath & drvPath)
+{
+    auto state(shardFor(drvPath).lock());
+    if (auto node = state->pinned.extract(drvPath))
+        addCurrent(*state, drvPath, std::move(node.mapped()));
+}
+
+size_t DrvHashes::size()
+{
+    size_t n = 0;
+    for (auto & shard : shards) {
+        auto state(shard.lock());
+        n += state->pinned.size() + state->current.size() + state->previous.size();
+    }
+    return n;
+}
+
 DrvHashes drvHashes;
 
+namespace {
+
+const char * drvHashesSchema = R"sql(
+
+create table if not exists DrvHashes (
+    drvPath  text not null,
+    output   text not null,
+    hash     text not null,
+    deferred integer not null,
+    primary key (drvPath, output)
+);
+)sql";
+
+/**
+ * A persistent table of the results of `pathDerivationModulo()`, so
+ * that other processes don't need to read and hash the closure of a
+ * derivation again. Since store paths of derivations are determined by
+ * their contents, entries never become stale.
+ *
+ * This cache is optional: if the database can't be read or written,
+ * we warn once and compute the hashes ourselves from then on.
+ */
+struct DrvHashDiskCache
+{
+    struct State
+    {
+        SQLite db;
+        SQLiteStmt insert, lookup;
+    };
+
+    Sync<State> state_;
+
+    std::atomic<bool> disabled{false};
+
+    void disable(const Error & e)
+    {
+        if (!disabled.exchange(true))
+            warn("disabling the derivation hash cache: %s", e.msg());
+    }
+
+    DrvHashDiskCache()
+    {
+        auto state(state_.lock());
+
+        auto dbPath = getCacheDir() / "drv-hashes-v1.sqlite";
+        createDirs(dbPath.parent_path());
+
+        state->db = SQLite(dbPath);
+        state->db.isCache();
+        state->db.exec(drvHashesSchema);
+
+        state->insert.create(
+            state->db, "insert or replace into DrvHashes(drvPath, output, hash, deferred) values (?, ?, ?, ?)");
+
+        state->lookup.create(state->db, "select output, hash, deferred from DrvHashes where drvPath = ?");
+    }
+
+    std::optional<DrvHash> lookup(const std::string & drvPath)
+    {
+        if (disabled)
+            return std::nullopt;
+
+        try {
+            return retrySQLite<std::optional<DrvHash>>([&]() {
+                auto state(state_.lock());
+
+                std::optional<DrvHash> res;
+                auto stmt(state->lookup.use()(drvPath));
+                while (stmt.next()) {
+                    if (!res)
+                        res = DrvHash{.kind = stmt.getInt(2) ? DrvHash::Kind::Deferred : DrvHash::Kind::Regular};
+                    res->hashes.insert_or_assign(stmt.getStr(0), Hash::parseAnyPrefixed(stmt.getStr(1)));
+                }
+                return res;
+            });
+        } catch (SQLiteError & e) {
+            disable(e);
+        } catch (BadHash & e) {
+            /* The entry is replaced once we have computed the hash. */
+            warn("ignoring corrupt entry for '%s' in the derivation hash cache: %s", drvPath, e.msg());
+        }
+        return std::nullopt;
+    }
+
+    void insert(const std::string & drvPath, const DrvHash & hash)
+    {
+        if (disabled)
+            return;
+
+        try {
+            retrySQLite<void>([&]() {
+                auto state(state_.lock());
+
+                SQLiteTxn txn(state->db);
+                for (auto & [outputName, h] : hash.hashes)
+                    state->insert.use()(drvPath)(outputName)(h.to_string(HashFormat::Base16, true))(
+                            hash.kind == DrvHash::Kind::Deferred ? 1 : 0)
+                        .exec();
+                txn.commit();
+            });
+        } catch (SQLiteError & e) {
+            disable(e);
+        }
+    }
+};
+
+DrvHashDiskCache * getDrvHashDiskCache()
+{
+    if (!settings.derivationHashDiskCache)
+        return nullptr;
+
+    static auto cache = []() -> std::unique_ptr<DrvHashDiskCache> {
+        try {
+            return std::make_unique<DrvHashDiskCache>();
+        } catch (Error & e) {
+            warn("cannot open the derivation hash cache: %s", e.msg());
+            return nullptr;
+        }
+    }();
+
+    return cache.get();
+}
+
+} // namespace
+
 /* pathDerivationModulo and hashDerivationModulo are mutually recursive
  */
 
@@ -876,13 +1219,24 @@ DrvHashes drvHashes;
  */
 static const DrvHash pathDerivationModulo(Store & store, const StorePath & drvPath)
 {
-    std::optional<DrvHash> hash;
-    if (drvHashes.cvisit(drvPath, [&hash](const auto & kv) { hash.emplace(kv.second); })) {
+    if (auto hash = drvHashes.get(drvPath))
         return *hash;
+
+    auto diskCache = getDrvHashDiskCache();
+    auto drvPathS = store.printStorePath(drvPath);
+
+    if (diskCache) {
+        if (auto hash = diskCache->lookup(drvPathS)) {
+            drvHashes.insert(drvPath, *hash);
+            return *hash;
+        }
     }
+
     auto h = hashDerivationModulo(store, store.readInvalidDerivation(drvPath), false);
     // Cache it
-    drvHashes.insert_or_assign(drvPath, h);
+    drvHashes.insert(drvPath, h);
+    if (diskCache)
+        diskCache->insert(drvPathS, h);
     return h;
 }
 
@@ -950,7 +1304,9 @@ DrvHash hashDerivationModulo(Store & store, const Derivation & drv, bool maskOut
         }
     }
 
-    auto hash = hashString(HashAlgorithm::SHA256, drv.unparse(store, maskOutputs, &inputs2));
+    HashSink hashSink(HashAlgorithm::SHA256);
+    drv.unparse(hashSink, store, maskOutputs, &inputs2);
+    auto hash = hashSink.finish().hash;
 
     std::map<std::string, Hash> outputHashes;
     for (const auto & [outputName, _] : drv.outputs) {
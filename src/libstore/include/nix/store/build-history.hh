@@ -0,0 +1,82 @@
+#pragma once
+///@file
+
+#include "nix/util/json-impls.hh"
+#include "nix/store/path.hh"
+
+#include <chrono>
+#include <map>
+
+namespace nix {
+
+/**
+ * A finished build, successful or not, as recorded in the build history
+ * of a store.
+ */
+struct BuildHistoryEntry
+{
+    StorePath drvPath;
+
+    std::string system;
+
+    time_t startTime = 0, stopTime = 0;
+
+    /**
+     * The status of the build, as in the JSON representation of
+     * `BuildResult`, e.g. `Built`, `PermanentFailure` or `TimedOut`.
+     */
+    std::string status;
+
+    std::optional<std::chrono::microseconds> cpuUser, cpuSystem;
+
+    /**
+     * Peak memory usage in bytes.
+     */
+    std::optional<uint64_t> peakMemory;
+
+    /**
+     * Bytes read from and written to block devices.
+     */
+    std::optional<uint64_t> ioReadBytes, ioWriteBytes;
+
+    /**
+     * The outputs produced by the build.
+     */
+    std::map<std::string, StorePath> outputs;
+};
+
+/**
+ * Which builds to return from `BuildHistoryStore::queryBuildHistory()`.
+ */
+struct BuildHistoryQuery
+{
+    /**
+     * Only return builds of derivations with this name, ignoring the
+     * version.
+     */
+    std::optional<std::string> name;
+
+    /**
+     * Only return builds that produced this output path.
+     */
+    std::optional<StorePath> outputPath;
+
+    /**
+     * Return at most this many builds.
+     */
+    size_t limit = 100;
+};
+
+struct BuildHistoryStore
+{
+    inline static std::string operationName = "Querying the build history";
+
+    /**
+     * Return the recorded builds matching `query`, most recent first.
+     */
+    virtual std::vector<BuildHistoryEntry> queryBuildHistory(const BuildHistoryQuery & query) = 0;
+};
+
+} // namespace nix
+
+JSON_IMPL(BuildHistoryEntry)
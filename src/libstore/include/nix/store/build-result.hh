@@ -144,6 +144,14 @@ struct BuildResult
      */
     std::optional<std::chrono::microseconds> cpuUser, cpuSystem;
 
+    /**
+     * Peak memory usage of the build in bytes, and the number of bytes
+     * it read from and wrote to block devices. These are currently
+     * only known for local builds in a cgroup, and are not transferred
+     * over the worker protocol.
+     */
+    std::optional<uint64_t> peakMemory, ioReadBytes, ioWriteBytes;
+
     bool operator==(const BuildResult &) const noexcept;
     std::strong_ordering operator<=>(const BuildResult &) const noexcept;
 
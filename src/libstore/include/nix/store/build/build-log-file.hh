@@ -0,0 +1,98 @@
+#pragma once
+///@file
+
+#include "nix/util/file-descriptor.hh"
+#include "nix/util/serialise.hh"
+#include "nix/util/sync.hh"
+
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+namespace nix {
+
+struct CompressionSink;
+
+/**
+ * A build log file that is compressed and written by a thread of its
+ * own, so that the worker doesn't spend its time compressing the
+ * output of chatty builds.
+ */
+class BuildLogFile
+{
+public:
+
+    /**
+     * Create the log file `path`, compressed with `compression` (a
+     * method supported by `makeCompressionSink()`), if any.
+     */
+    BuildLogFile(const Path & path, std::optional<std::string> compression);
+
+    /**
+     * Calls `finish()` if that hasn't been done, ignoring errors.
+     */
+    ~BuildLogFile();
+
+    /**
+     * Queue `data` to be written. This never blocks: if the writer
+     * thread has fallen far behind, `data` is dropped with a warning,
+     * and the log records how much output is missing.
+     */
+    void operator()(std::string_view data);
+
+    /**
+     * Write the remaining data, and close the file. Throws if writing
+     * the log failed.
+     */
+    void finish();
+
+private:
+
+    struct State
+    {
+        std::deque<std::string> pending;
+
+        /**
+         * The number of bytes in `pending`.
+         */
+        size_t pendingSize = 0;
+
+        /**
+         * The number of bytes dropped since data was last queued.
+         */
+        size_t dropped = 0;
+
+        /**
+         * Whether we warned about dropping output.
+         */
+        bool warned = false;
+
+        bool finishing = false;
+
+        std::exception_ptr error;
+    };
+
+    Sync<State> state_;
+
+    /**
+     * Signalled when data is queued or the log is finished.
+     */
+    std::condition_variable wakeup;
+
+    Path path;
+
+    AutoCloseFD fd;
+    FdSink fileSink;
+    std::shared_ptr<CompressionSink> compressionSink;
+
+    std::thread thread;
+
+    void run();
+
+    /**
+     * Queue a note about the data that has been dropped, if any.
+     */
+    void queueDropped(State & state);
+};
+
+} // namespace nix
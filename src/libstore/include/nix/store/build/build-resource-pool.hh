@@ -0,0 +1,94 @@
+#pragma once
+///@file
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <optional>
+
+namespace nix {
+
+/**
+ * The share of the machine's resources allotted to a local build.
+ */
+struct BuildBudget
+{
+    unsigned int cores;
+
+    /**
+     * Memory in bytes, if the amount of memory of the machine is known.
+     */
+    std::optional<uint64_t> memory;
+
+    bool operator==(const BuildBudget &) const = default;
+};
+
+/**
+ * A pool of CPU cores and memory that is divided evenly between the
+ * running local builds (see the `adaptive-build-resources` setting).
+ * Each build holds a `Token`; the budgets of all builds are
+ * recomputed whenever a token is acquired or released.
+ *
+ * This is not thread-safe; it is only used by the `Worker`.
+ */
+class BuildResourcePool
+{
+public:
+
+    using OnRebalance = std::function<void(const BuildBudget &)>;
+
+    class Token
+    {
+        friend class BuildResourcePool;
+
+        BuildResourcePool & pool;
+        std::list<Token *>::iterator pos;
+        BuildBudget budget_{.cores = 0};
+        OnRebalance onRebalance;
+
+        Token(BuildResourcePool & pool, OnRebalance onRebalance);
+
+    public:
+
+        Token(const Token &) = delete;
+        ~Token();
+
+        const BuildBudget & budget() const
+        {
+            return budget_;
+        }
+    };
+
+    BuildResourcePool(unsigned int cores, std::optional<uint64_t> memory);
+
+    /**
+     * Acquire a share of the pool for a new build. The shares of the
+     * other builds shrink accordingly, and their `onRebalance`
+     * callbacks are called.
+     *
+     * @param expectedBuilds The number of builds that are expected to
+     * run concurrently, including this one. Cores are divided as if
+     * that many builds were running, so that a build started just
+     * before many others doesn't get (and advertise to the builder,
+     * e.g. via `NIX_BUILD_CORES`) the entire machine. Memory is only
+     * divided between the builds that hold a token.
+     *
+     * @param onRebalance Called when the share of this build changes
+     * later on because other builds acquire or release tokens.
+     */
+    std::unique_ptr<Token> acquire(size_t expectedBuilds, OnRebalance onRebalance);
+
+private:
+
+    unsigned int cores;
+    std::optional<uint64_t> memory;
+
+    std::list<Token *> tokens;
+
+    size_t expectedBuilds = 0;
+
+    void rebalance(Token * skip);
+};
+
+} // namespace nix
@@ -12,6 +12,7 @@
 #include "nix/util/json-impls.hh"
 #include "nix/store/restricted-store.hh"
 #include "nix/store/build/derivation-env-desugar.hh"
+#include "nix/store/build/build-resource-pool.hh"
 
 namespace nix {
 
@@ -185,6 +186,14 @@ struct DerivationBuilder : RestrictionContext
      * killed.
      */
     virtual bool killChild() = 0;
+
+    /**
+     * Set the share of the machine's cores and memory that the build
+     * may use (see `BuildResourcePool`). This is called before
+     * `startBuild()`, and again whenever the share changes while the
+     * build is running.
+     */
+    virtual void setBudget(const BuildBudget & budget) = 0;
 };
 
 struct ExternalBuilder
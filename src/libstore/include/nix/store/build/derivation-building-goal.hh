@@ -9,6 +9,8 @@
 #include "nix/store/store-api.hh"
 #include "nix/store/pathlocks.hh"
 #include "nix/store/build/goal.hh"
+#include "nix/store/build/build-resource-pool.hh"
+#include "nix/store/build/build-log-file.hh"
 
 namespace nix {
 
@@ -17,6 +19,7 @@ using std::map;
 struct BuilderFailureError;
 #ifndef _WIN32 // TODO enable build hook on Windows
 struct HookInstance;
+struct RemoteBuild;
 struct DerivationBuilder;
 #endif
 
@@ -65,8 +68,7 @@ private:
     /**
      * File descriptor for the log file.
      */
-    AutoCloseFD fdLogFile;
-    std::shared_ptr<BufferedSink> logFileSink, logSink;
+    std::unique_ptr<BuildLogFile> logFile;
 
     /**
      * Number of bytes received from the builder's stdout/stderr.
@@ -89,7 +91,19 @@ private:
      */
     std::unique_ptr<HookInstance> hook;
 
+    /**
+     * The remote build started by the `RemoteBuildDispatcher`, if
+     * `remote-build-dispatcher` is enabled.
+     */
+    std::unique_ptr<RemoteBuild> remoteBuild;
+
     std::unique_ptr<DerivationBuilder> builder;
+
+    /**
+     * Our share of the worker's `BuildResourcePool`, while the builder
+     * is running.
+     */
+    std::unique_ptr<BuildResourcePool::Token> buildResources;
 #endif
 
     BuildMode buildMode;
@@ -100,6 +114,11 @@ private:
 
     std::map<ActivityId, Activity> builderActivities;
 
+    /**
+     * Cached result of `expectedDuration()`.
+     */
+    std::optional<std::chrono::seconds> expectedBuildTime;
+
     void timedOut(Error && ex) override;
 
     std::string key() override;
@@ -116,6 +135,13 @@ private:
     HookReply tryBuildHook(
         const std::map<std::string, InitialOutput> & initialOutputs, const DerivationOptions<StorePath> & drvOptions);
 
+    /**
+     * Like `tryBuildHook()`, but using the worker's
+     * `RemoteBuildDispatcher` instead of the build hook.
+     */
+    HookReply tryRemoteBuild(
+        const std::map<std::string, InitialOutput> & initialOutputs, const DerivationOptions<StorePath> & drvOptions);
+
     /**
      * Open a log file and a pipe to it.
      */
@@ -159,12 +185,31 @@ private:
 
     Done doneFailure(BuildError ex);
 
+    /**
+     * Record the finished build in the build history of the local
+     * store, if the builder was started at all.
+     */
+    void addToBuildHistory();
+
     BuildError fixupBuilderFailureErrorMessage(BuilderFailureError msg);
 
     JobCategory jobCategory() const override
     {
         return JobCategory::Build;
     };
+
+    /**
+     * The average duration of previous builds of this derivation
+     * recorded in the store's build history, or
+     * `defaultExpectedBuildTime` if there are none.
+     */
+    std::chrono::seconds expectedDuration() override;
+
+    /**
+     * The duration assumed for derivations that haven't been built
+     * before.
+     */
+    static constexpr std::chrono::seconds defaultExpectedBuildTime{60};
 };
 
 } // namespace nix
@@ -4,7 +4,9 @@
 #include "nix/store/store-api.hh"
 #include "nix/store/build-result.hh"
 
+#include <chrono>
 #include <coroutine>
+#include <filesystem>
 
 namespace nix {
 
@@ -476,10 +478,21 @@ public:
      */
     virtual JobCategory jobCategory() const = 0;
 
+    /**
+     * @brief Hint for the scheduler, how long this goal is expected to
+     * keep a build slot busy, not counting the goals it waits for.
+     * @see Worker::getCriticalPath
+     */
+    virtual std::chrono::seconds expectedDuration()
+    {
+        return std::chrono::seconds(0);
+    }
+
 protected:
     Co await(Goals waitees);
 
     Co waitForAWhile();
+    Co waitForLocks(std::set<std::filesystem::path> paths);
     Co waitForBuildSlot();
     Co yield();
 };
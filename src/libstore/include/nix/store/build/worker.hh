@@ -5,7 +5,9 @@
 #include "nix/store/store-api.hh"
 #include "nix/store/derived-path-map.hh"
 #include "nix/store/build/goal.hh"
+#include "nix/store/build/build-resource-pool.hh"
 #include "nix/store/realisation.hh"
+#include "nix/store/pathlocks.hh"
 #include "nix/util/muxable-pipe.hh"
 
 #include <future>
@@ -50,6 +52,11 @@ struct Child
     Goal * goal2; // ugly hackery
     std::set<MuxablePipePollState::CommChannel> channels;
     bool respectTimeouts;
+    /**
+     * Whether `max-silent-time` applies to this child, i.e. whether
+     * its channels carry its log output.
+     */
+    bool respectMaxSilentTime;
     bool inBuildSlot;
     /**
      * Time we last got output on stdout/stderr
@@ -61,6 +68,7 @@ struct Child
 #ifndef _WIN32 // TODO Enable building on Windows
 /* Forward definition. */
 struct HookInstance;
+class RemoteBuildDispatcher;
 #endif
 
 /**
@@ -132,11 +140,26 @@ private:
      */
     steady_time_point lastWokenUp;
 
+    /**
+     * Goals in `waitingForAWhile` that can be woken up early because
+     * the lock they are waiting for may have been released, keyed by
+     * the locked path.
+     */
+    std::map<std::filesystem::path, WeakGoals> waitingForLock;
+
+    LockFileWatcher lockFileWatcher;
+
     /**
      * Cache for pathContentsGood().
      */
     std::map<StorePath, bool> pathContentsGoodCache;
 
+    /**
+     * The cores and memory divided between local builds if
+     * `adaptive-build-resources` is enabled.
+     */
+    BuildResourcePool buildResourcePool;
+
 public:
 
     const Activity act;
@@ -173,6 +196,13 @@ public:
 
 #ifndef _WIN32 // TODO Enable building on Windows
     std::unique_ptr<HookInstance> hook;
+
+    /**
+     * Created on first use if `remote-build-dispatcher` is enabled.
+     * The remote builds started by goals refer to it, so `~Worker()`
+     * destroys all goals before it.
+     */
+    std::unique_ptr<RemoteBuildDispatcher> remoteBuildDispatcher;
 #endif
 
     uint64_t expectedBuilds = 0;
@@ -273,13 +303,15 @@ public:
 
     /**
      * Registers a running child process.  `inBuildSlot` means that
-     * the process counts towards the jobs limit.
+     * the process counts towards the jobs limit. `respectMaxSilentTime`
+     * only has an effect if `respectTimeouts` is set.
      */
     void childStarted(
         GoalPtr goal,
         const std::set<MuxablePipePollState::CommChannel> & channels,
         bool inBuildSlot,
-        bool respectTimeouts);
+        bool respectTimeouts,
+        bool respectMaxSilentTime = true);
 
     /**
      * Unregisters a running child process.  `wakeSleepers` should be
@@ -295,6 +327,23 @@ public:
      */
     void waitForBuildSlot(GoalPtr goal);
 
+    /**
+     * Acquire a share of the cores and memory of the machine for a
+     * local build that is about to start. See `BuildResourcePool`.
+     */
+    std::unique_ptr<BuildResourcePool::Token> acquireBuildResources(BuildResourcePool::OnRebalance onRebalance);
+
+    /**
+     * Return the length of the critical path from `goal` to the
+     * top-level goals, i.e. the expected duration of `goal` plus the
+     * longest chain of goals (transitively) waiting for it. Goals that
+     * are woken up at the same time are run in order of decreasing
+     * critical path, so that build slots (local or remote) go first to
+     * the goals that hold up the most work. `memo` caches results for
+     * the current round of the goal loop.
+     */
+    std::chrono::seconds getCriticalPath(Goal & goal, std::map<Goal *, std::chrono::seconds> & memo);
+
     /**
      * Wait for any goal to finish.  Pretty indiscriminate way to
      * wait for some resource that some other goal is holding.
@@ -309,6 +358,13 @@ public:
      */
     void waitForAWhile(GoalPtr goal);
 
+    /**
+     * Like `waitForAWhile()`, but wake up the goal as soon as the lock
+     * on any of `paths` (as passed to `PathLocks`) may have been
+     * released.
+     */
+    void waitForLocks(GoalPtr goal, const std::set<std::filesystem::path> & paths);
+
     /**
      * Loop until the specified top-level goals have finished.
      */
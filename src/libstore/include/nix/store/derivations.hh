@@ -11,13 +11,15 @@
 #include "nix/util/sync.hh"
 #include "nix/util/variant-wrapper.hh"
 
-#include <boost/unordered/concurrent_flat_map_fwd.hpp>
+#include <array>
+#include <unordered_map>
 #include <variant>
 
 namespace nix {
 
 struct StoreDirConfig;
 struct AsyncPathWriter;
+struct Sink;
 
 /* Abstract syntax of derivations. */
 
@@ -341,6 +343,16 @@ struct Derivation : BasicDerivation
         bool maskOutputs,
         DerivedPathMap<StringSet>::ChildNode::Map * actualInputs = nullptr) const;
 
+    /**
+     * Like the above, but write the derivation to `sink` (e.g. a
+     * `HashSink`) instead of building it as a string.
+     */
+    void unparse(
+        Sink & sink,
+        const StoreDirConfig & store,
+        bool maskOutputs,
+        DerivedPathMap<StringSet>::ChildNode::Map * actualInputs = nullptr) const;
+
     /**
      * Return the underlying basic derivation but with these changes:
      *
@@ -458,16 +470,6 @@ class Store;
  */
 StorePath writeDerivation(Store & store, const Derivation & drv, RepairFlag repair = NoRepair, bool readOnly = false);
 
-/**
- * Asynchronously write a derivation to the Nix store, and return its path.
- */
-StorePath writeDerivation(
-    Store & store,
-    AsyncPathWriter & asyncPathWriter,
-    const Derivation & drv,
-    RepairFlag repair = NoRepair,
-    bool readOnly = false);
-
 /**
  * Read a derivation from a file.
  */
@@ -563,26 +565,88 @@ DrvHash hashDerivationModulo(Store & store, const Derivation & drv, bool maskOut
  */
 std::map<std::string, Hash> staticOutputHashes(Store & store, const Derivation & drv);
 
-struct DrvHashFct
+/**
+ * Memoisation of hashDerivationModulo(), bounded in size by the
+ * `derivation-hash-cache-size` setting.
+ *
+ * Entries are kept in two generations. New entries go into the current
+ * generation, and entries found in the previous generation are moved
+ * back into it. When the current generation reaches half the size
+ * limit, the previous generation is dropped and the current one takes
+ * its place. So entries that have not been used for a while are
+ * evicted, without having to track the order of every lookup.
+ *
+ * Entries whose derivation may not be readable from the store (because
+ * it hasn't been written yet, or never will be in read-only mode) can
+ * be pinned, which exempts them from eviction until `unpin()` is
+ * called.
+ *
+ * The entries are spread over a number of independently locked shards,
+ * so that parallel evaluation threads rarely contend for a lock.
+ */
+class DrvHashes
 {
-    using is_avalanching = std::true_type;
+    struct Entry
+    {
+        DrvHash hash;
+        size_t size;
+    };
+
+    using Map = std::unordered_map<StorePath, Entry>;
 
-    std::size_t operator()(const StorePath & path) const noexcept
+    struct State
     {
-        return std::hash<std::string_view>{}(path.to_string());
-    }
-};
+        Map current, previous, pinned;
+        size_t currentSize = 0;
+    };
 
-/**
- * Memoisation of hashDerivationModulo().
- */
-typedef boost::concurrent_flat_map<StorePath, DrvHash, DrvHashFct> DrvHashes;
+    static constexpr size_t nrShards = 16;
+
+    std::array<Sync<State>, nrShards> shards;
+
+    Sync<State> & shardFor(const StorePath & drvPath);
+
+    static size_t entrySize(const StorePath & drvPath, const DrvHash & hash);
+
+    static void addCurrent(State & state, const StorePath & drvPath, Entry && entry);
+
+public:
+
+    std::optional<DrvHash> get(const StorePath & drvPath);
+
+    void insert(const StorePath & drvPath, DrvHash hash, bool pinned = false);
+
+    /**
+     * Make a pinned entry evictable, e.g. once the derivation has been
+     * written to the store.
+     */
+    void unpin(const StorePath & drvPath);
+
+    /**
+     * Return the number of entries.
+     */
+    size_t size();
+};
 
 // FIXME: global, though at least thread-safe.
 extern DrvHashes drvHashes;
 
+/**
+ * Asynchronously write a derivation to the Nix store, and return its path.
+ *
+ * If `drvHash` is given, it is added to `drvHashes` and pinned before
+ * the write is queued, so that the entry stays pinned exactly until the
+ * derivation has been written.
+ */
+StorePath writeDerivation(
+    Store & store,
+    AsyncPathWriter & asyncPathWriter,
+    const Derivation & drv,
+    RepairFlag repair = NoRepair,
+    bool readOnly = false,
+    std::optional<DrvHash> drvHash = std::nullopt);
+
 struct Source;
-struct Sink;
 
 Source & readDerivation(Source & in, const StoreDirConfig & store, BasicDerivation & drv, std::string_view name);
 void writeDerivation(Sink & out, const StoreDirConfig & store, const BasicDerivation & drv);
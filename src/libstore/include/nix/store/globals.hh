@@ -207,6 +207,20 @@ public:
         )",
         {"build-cores"}};
 
+    Setting<bool> adaptiveBuildResources{
+        this,
+        false,
+        "adaptive-build-resources",
+        R"(
+          If set to `true`, the CPU cores given by [`cores`](#conf-cores) and the memory of the machine are treated as a pool that is divided evenly between the local builds that run concurrently, rather than given in full to every build.
+          `NIX_BUILD_CORES` is set to the share of a build when it starts.
+
+          On Linux, if builds run in cgroups (see [`use-cgroups`](#conf-use-cgroups)), the share is also enforced by setting the `cpu.max` and `memory.high` limits of the build's cgroup.
+          These limits are adjusted as other builds start and finish, so that a build that runs alone can use the whole machine.
+          Nix only enables the `cpu` and `memory` controllers for the builds' cgroups if the Nix daemon runs in a cgroup that is delegated to it (e.g. with systemd's `Delegate=yes`); otherwise, they must already be enabled.
+          While builds wait for a build slot, cores are already reserved for them, but memory is only divided between the running builds.
+        )"};
+
     /**
      * Read-only mode.  Don't copy stuff to the store, don't change
      * the database.
@@ -287,6 +301,26 @@ public:
           > Set to `nix __build-remote` to re-enable at your own risk.
         )"};
 
+    Setting<bool> remoteBuildDispatcher{
+        this,
+        false,
+        "remote-build-dispatcher",
+        R"(
+          If set to `true`, Nix dispatches remote builds to the machines
+          listed in [`builders`](#conf-builders) itself instead of running
+          the [`build-hook`](#conf-build-hook) for every build.
+
+          Nix then reads the machines list only once, tracks the load of
+          the machines in memory and combines the uploads of builds that go
+          to the same machine.
+          The load of a machine only accounts for the builds of the current
+          Nix process; the `current-load` directory used by the build hook is
+          not consulted.
+
+          The build log of a remote build is shown on the terminal but not
+          stored in the local log directory.
+        )"};
+
     Setting<std::string> builders{
         this,
         "@" + nixConfDir.string() + "/machines",
@@ -584,8 +618,13 @@ public:
         "compress-build-log",
         R"(
           If set to `true` (the default), build logs written to
-          `/nix/var/log/nix/drvs` are compressed on the fly using bzip2.
-          Otherwise, they are not compressed.
+          `/nix/var/log/nix/drvs` are compressed on the fly using zstd.
+          Otherwise, they are not compressed. Compression and writing
+          happen on a separate thread, so they don't slow down the
+          processing of build output.
+
+          Logs compressed with bzip2 by older versions of Nix can still
+          be read.
         )",
         {"build-compress-log"}};
 
@@ -733,6 +772,20 @@ public:
     Setting<bool> sandboxFallback{
         this, true, "sandbox-fallback", "Whether to disable sandboxing when the kernel doesn't allow it."};
 
+    Setting<bool> inProcessBuiltins{
+        this,
+        true,
+        "in-process-builtins",
+        R"(
+          Whether to run the builtin builders `builtin:buildenv` and
+          `builtin:unpack-channel` inside the Nix process instead of in a
+          separate builder process, which avoids the cost of setting up the
+          sandbox. This is only done if the builder would run as the
+          current user anyway (i.e. if [`build-users-group`](#conf-build-users-group)
+          is not used), and if Nix is not running as root with sandboxing
+          enabled.
+        )"};
+
 #ifndef _WIN32
     Setting<bool> requireDropSupplementaryGroups{
         this,
@@ -1373,6 +1426,32 @@ public:
           Set it to 1 to warn on all paths.
         )"};
 
+    Setting<uint64_t> derivationHashCacheSize{
+        this,
+        64 * 1024 * 1024,
+        "derivation-hash-cache-size",
+        R"(
+          The approximate amount of memory, in bytes, that Nix uses to cache the
+          hashes of derivations that it needs to compute output paths. When the
+          cache is full, the hashes that haven't been used recently are evicted,
+          and are computed again from the derivations in the store if needed.
+
+          The hashes of derivations that have not been written to the store yet
+          (such as those instantiated with `--readonly-mode`) are never evicted.
+        )"};
+
+    Setting<bool> derivationHashDiskCache{
+        this,
+        false,
+        "derivation-hash-disk-cache",
+        R"(
+          If set to true, the hashes of derivations that Nix computes by reading
+          their closure from the store are also stored in
+          `~/.cache/nix/drv-hashes-v1.sqlite`. Other Nix processes can then use
+          them instead of reading and hashing the closure of those derivations
+          again.
+        )"};
+
     using ExternalBuilders = std::vector<ExternalBuilder>;
 
     Setting<ExternalBuilders> externalBuilders{
@@ -69,6 +69,14 @@ struct LegacySSHStore : public virtual Store
 
     SSHMaster master;
 
+    /**
+     * The connections opened so far, so that `shutdownConnections()`
+     * can reach those that are in use.
+     */
+    Sync<std::vector<std::weak_ptr<Connection>>> openConnections;
+
+    std::atomic_bool shutDown{false};
+
     LegacySSHStore(ref<const Config>);
 
     ref<Connection> openConnection();
@@ -191,6 +199,8 @@ public:
 
     void connect() override;
 
+    void shutdownConnections() override;
+
     unsigned int getProtocol() override;
 
     struct ConnectionStats
@@ -7,6 +7,7 @@
 #include "nix/store/store-api.hh"
 #include "nix/store/indirect-root-store.hh"
 #include "nix/store/active-builds.hh"
+#include "nix/store/build-history.hh"
 #include "nix/util/sync.hh"
 
 #include <chrono>
@@ -111,6 +112,16 @@ public:
           > While the filesystem the database resides on might appear to be read-only, consider whether another user or system might have write access to it.
         )"};
 
+    Setting<unsigned int> buildHistoryMaxAge{
+        this,
+        90,
+        "build-history-max-age",
+        R"(
+          The number of days for which builds are kept in the build history (see [`nix store build-history`](@docroot@/command-ref/new-cli/nix3-store-build-history.md)).
+          Older builds are removed whenever a build is recorded.
+          `0` keeps builds forever.
+        )"};
+
     static const std::string name()
     {
         return "Local Store";
@@ -131,7 +142,8 @@ public:
 class LocalStore : public virtual IndirectRootStore,
                    public virtual GcStore,
                    public virtual TrackActiveBuildsStore,
-                   public virtual QueryActiveBuildsStore
+                   public virtual QueryActiveBuildsStore,
+                   public virtual BuildHistoryStore
 {
 public:
 
@@ -202,9 +214,12 @@ private:
 public:
 
     /**
-     * Hack for build-remote.cc.
+     * Output paths whose locks are held by the caller (e.g. the goal
+     * waiting for a remote build), and that `addToStore()` must
+     * therefore not lock again. Hack for build-remote.cc and
+     * `RemoteBuildDispatcher`.
      */
-    PathSet locksHeld;
+    Sync<PathSet> locksHeld;
 
     /**
      * Initialise the local store, upgrading the schema if
@@ -396,6 +411,22 @@ public:
     void queryRealisationUncached(
         const DrvOutput &, Callback<std::shared_ptr<const UnkeyedRealisation>> callback) noexcept override;
 
+    /**
+     * Record in the build history that `drvPath` was built for
+     * `system`, with the times, resource usage and outputs in
+     * `result`.
+     */
+    void addBuildToHistory(const StorePath & drvPath, std::string_view system, const BuildResult & result);
+
+    std::vector<BuildHistoryEntry> queryBuildHistory(const BuildHistoryQuery & query) override;
+
+    /**
+     * Return the average duration of the most recent builds of
+     * derivations with the same name (ignoring the version) as
+     * `drvPath` for `system`, or `std::nullopt` if there are none.
+     */
+    std::optional<std::chrono::seconds> queryExpectedBuildTime(const StorePath & drvPath, std::string_view system);
+
     std::optional<std::string> getVersion() override;
 
 protected:
@@ -454,6 +485,22 @@ private:
     Strings readDirectoryIgnoringInodes(const Path & path, const InodeHash & inodeHash);
     void
     optimisePath_(Activity * act, OptimiseStats & stats, const Path & path, InodeHash & inodeHash, RepairFlag repair);
+    void optimisePath(const Path & path, RepairFlag repair, InodeHash & inodeHash);
+
+    /**
+     * The maximum size of files that are buffered in memory while
+     * restoring a NAR so that they can be linked by `findLinkTarget()`
+     * rather than written.
+     */
+    static constexpr uint64_t maxLinkableFileSize = 16 * 1024 * 1024;
+
+    /**
+     * Return the file in `linksDir` that `path` would be linked to by
+     * `optimisePath_()` if it had the given contents and executable
+     * bit, if it exists. Its inode is added to `inodeHash`.
+     */
+    std::optional<std::filesystem::path>
+    findLinkTarget(const Path & path, std::string_view contents, bool executable, InodeHash & inodeHash);
 
     // Internal versions that are not wrapped in retry_sqlite.
     bool isValidPath_(State & state, const StorePath & path);
@@ -28,9 +28,25 @@ public:
     virtual std::pair<Outcome, std::shared_ptr<NarInfo>>
     lookupNarInfo(const std::string & uri, const std::string & hashPart) = 0;
 
+    /**
+     * Look up the entries for many hash parts of the same binary cache
+     * in a single transaction. Hash parts for which nothing is known
+     * are omitted from the result, so every value is either `oValid`
+     * or `oInvalid`.
+     */
+    virtual std::map<std::string, std::pair<Outcome, std::shared_ptr<NarInfo>>>
+    lookupNarInfos(const std::string & uri, const StringSet & hashParts) = 0;
+
     virtual void
     upsertNarInfo(const std::string & uri, const std::string & hashPart, std::shared_ptr<const ValidPathInfo> info) = 0;
 
+    /**
+     * Like `upsertNarInfo()`, but records the result of many lookups in
+     * a single transaction. A null info marks the path as missing.
+     */
+    virtual void upsertNarInfos(
+        const std::string & uri, const std::map<std::string, std::shared_ptr<const ValidPathInfo>> & infos) = 0;
+
     virtual void upsertRealisation(const std::string & uri, const Realisation & realisation) = 0;
     virtual void upsertAbsentRealisation(const std::string & uri, const DrvOutput & id) = 0;
     virtual std::pair<Outcome, std::shared_ptr<Realisation>>
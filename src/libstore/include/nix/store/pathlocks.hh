@@ -2,6 +2,7 @@
 ///@file
 
 #include <filesystem>
+#include <map>
 
 #include "nix/util/file-descriptor.hh"
 
@@ -39,6 +40,55 @@ public:
     void setDeletion(bool deletePaths);
 };
 
+/**
+ * Notifies a process waiting for `PathLocks` held by another process
+ * that the locks may have been released, so that it doesn't have to
+ * poll them. On Linux this uses inotify to watch for the lock files
+ * being touched or deleted, which `PathLocks::unlock()` does when it
+ * releases a lock; elsewhere `watch()` always fails and callers must
+ * fall back to polling.
+ *
+ * Closing a lock file is not an event, since processes that merely
+ * failed to acquire the lock close it too. Events are still a hint
+ * (another waiter may get the lock first), so the waiter must try to
+ * lock the path again and resume waiting if that fails.
+ */
+class LockFileWatcher
+{
+    AutoCloseFD fd;
+
+    /**
+     * Maps watch descriptors to the paths passed to `watch()`.
+     */
+    std::map<int, std::filesystem::path> watches;
+
+public:
+    LockFileWatcher();
+
+    /**
+     * The descriptor that becomes readable when `readEvents()` has
+     * something to return, or `INVALID_DESCRIPTOR` if not supported.
+     */
+    Descriptor getDescriptor() const
+    {
+        return fd.get();
+    }
+
+    /**
+     * Watch the lock file that `PathLocks` uses for `path`. Returns
+     * `false` if the lock file can't be watched; in particular if it
+     * doesn't exist anymore, in which case the lock has already been
+     * released.
+     */
+    bool watch(const std::filesystem::path & path);
+
+    /**
+     * Return the paths whose lock files may have been released since
+     * the last call, and stop watching them. Does not block.
+     */
+    std::set<std::filesystem::path> readEvents();
+};
+
 struct FdLock
 {
     Descriptor desc;
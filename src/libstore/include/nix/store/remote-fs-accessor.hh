@@ -25,6 +25,12 @@ class RemoteFSAccessor : public SourceAccessor
 
     ref<SourceAccessor> addToCache(std::string_view hashPart, std::string && nar);
 
+    /**
+     * Write the binary index of a cached NAR, which lets later
+     * accessors look up files without parsing the NAR or a listing.
+     */
+    void writeIndex(std::string_view hashPart, SourceAccessor & narAccessor);
+
 public:
 
     /**
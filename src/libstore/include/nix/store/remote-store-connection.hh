@@ -21,6 +21,12 @@ struct RemoteStore::Connection : WorkerProto::BasicClientConnection, WorkerProto
      * Time this connection was established.
      */
     std::chrono::time_point<std::chrono::steady_clock> startTime;
+
+    /**
+     * Interrupt any blocking read or write on this connection, possibly
+     * from another thread. The connection cannot be used afterwards.
+     */
+    virtual void shutdown() = 0;
 };
 
 /**
@@ -8,6 +8,7 @@
 #include "nix/store/gc-store.hh"
 #include "nix/store/log-store.hh"
 #include "nix/store/active-builds.hh"
+#include "nix/store/build-history.hh"
 
 namespace nix {
 
@@ -40,7 +41,8 @@ struct RemoteStoreConfig : virtual StoreConfig
 struct RemoteStore : public virtual Store,
                      public virtual GcStore,
                      public virtual LogStore,
-                     public virtual QueryActiveBuildsStore
+                     public virtual QueryActiveBuildsStore,
+                     public virtual BuildHistoryStore
 {
     using Config = RemoteStoreConfig;
 
@@ -149,10 +151,14 @@ struct RemoteStore : public virtual Store,
 
     std::vector<ActiveBuildInfo> queryActiveBuilds() override;
 
+    std::vector<BuildHistoryEntry> queryBuildHistory(const BuildHistoryQuery & query) override;
+
     std::optional<std::string> getVersion() override;
 
     void connect() override;
 
+    void shutdownConnections() override;
+
     unsigned int getProtocol() override;
 
     std::optional<TrustedFlag> isTrustedClient() override;
@@ -197,6 +203,12 @@ private:
 
     std::atomic_bool failed{false};
 
+    /**
+     * The connections opened so far, so that `shutdownConnections()`
+     * can reach those that are in use.
+     */
+    Sync<std::vector<std::weak_ptr<Connection>>> openConnections;
+
     void copyDrvsFromEvalStore(const std::vector<DerivedPath> & paths, std::shared_ptr<Store> evalStore);
 };
 
@@ -74,6 +74,13 @@ public:
          * `[0, INT_MAX]`.
          */
         void trySetBufferSize(size_t size);
+
+        /**
+         * Kill the SSH process without waiting for it, so that reads
+         * from `out` and writes to `in` fail. Unlike closing them,
+         * this is safe while another thread is using them.
+         */
+        void shutdown();
     };
 
     /**
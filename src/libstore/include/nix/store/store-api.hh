@@ -405,6 +405,19 @@ public:
      */
     std::optional<std::shared_ptr<const ValidPathInfo>> queryPathInfoFromClientCache(const StorePath & path);
 
+    /**
+     * Query information about many paths at once and remember the
+     * results in the in-memory and on-disk narinfo caches, so that
+     * subsequent `queryPathInfo()` calls for these paths are answered
+     * from the cache. The uncached queries are issued concurrently and
+     * their results are written to the disk cache in a single
+     * transaction.
+     *
+     * Errors are ignored; they will resurface when the path is queried
+     * individually.
+     */
+    void prefetchPathInfos(const StorePathSet & paths);
+
     /**
      * Query the information about a realisation.
      */
@@ -886,6 +899,14 @@ public:
      */
     virtual void connect() {};
 
+    /**
+     * Shut down all connections to the store, so that operations
+     * blocked on one of them fail. This may be called while another
+     * thread is using the store. The store cannot be used anymore
+     * afterwards.
+     */
+    virtual void shutdownConnections() {};
+
     /**
      * Get the protocol version of this store or it's connection.
      */
@@ -87,6 +87,7 @@ private:
     {
         AutoCloseFD fd;
         void closeWrite() override;
+        void shutdown() override;
     };
 
     ref<RemoteStore::Connection> openConnection() override;
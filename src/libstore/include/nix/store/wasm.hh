@@ -0,0 +1,67 @@
+#pragma once
+///@file
+
+#include "nix/util/error.hh"
+
+#include <span>
+
+#include <wasmtime.hh>
+
+namespace nix::wasm {
+
+template<typename T, typename E = Error>
+T unwrap(wasmtime::Result<T, E> && res)
+{
+    if (res)
+        return res.ok();
+    throw Error(res.err().message());
+}
+
+inline std::span<uint8_t> string2span(std::string_view s)
+{
+    return std::span<uint8_t>((uint8_t *) s.data(), s.size());
+}
+
+inline std::string_view span2string(std::span<uint8_t> s)
+{
+    return std::string_view((char *) s.data(), s.size());
+}
+
+/**
+ * The maximum number of compiled modules kept in `~/.cache/nix/wasm`.
+ * When a new module is added, the least recently used ones beyond this
+ * number are deleted.
+ */
+constexpr size_t maxCachedModules = 64;
+
+/**
+ * Create a new wasmtime engine with the default allocator, for
+ * processes that run a single module, such as WASI builders. Unlike
+ * `getEngine()`, it can be used in a child process after `fork()`,
+ * since it doesn't depend on the locks and threads of the parent.
+ */
+wasmtime::Engine createEngine();
+
+/**
+ * The process-wide wasmtime engine, used for `builtins.wasm`. It uses
+ * the pooling allocator and must not be used after `fork()`.
+ */
+wasmtime::Engine & getEngine();
+
+/**
+ * Compile the WebAssembly module `wasm` for `engine`. Compiled modules
+ * are cached in `~/.cache/nix/wasm`, keyed by the SHA-256 hash of
+ * `wasm`, so that a module is compiled only once rather than by every
+ * process that uses it. At most `maxCachedModules` modules are kept.
+ *
+ * @param name The name of the module, for error messages.
+ */
+wasmtime::Module compileModule(wasmtime::Engine & engine, std::string_view wasm, std::string_view name);
+
+/**
+ * Compile the WebAssembly module `wasm` for `getEngine()`. In addition
+ * to the cache on disk, compiled modules are cached in memory.
+ */
+wasmtime::Module compileModule(std::string_view wasm, std::string_view name);
+
+} // namespace nix::wasm
@@ -141,6 +141,8 @@ struct WorkerProto
 
     static constexpr std::string_view featureQueryActiveBuilds{"queryActiveBuilds"};
 
+    static constexpr std::string_view featureQueryBuildHistory{"queryBuildHistory"};
+
     static const FeatureSet allFeatures;
 };
 
@@ -190,6 +192,7 @@ enum struct WorkerProto::Op : uint64_t {
     BuildPathsWithResults = 46,
     AddPermRoot = 47,
     QueryActiveBuilds = 48,
+    QueryBuildHistory = 49,
 };
 
 struct WorkerProto::ClientHandshakeInfo
@@ -62,6 +62,13 @@ ref<LegacySSHStore::Connection> LegacySSHStore::openConnection()
         command.push_back(config->remoteStore.get());
     }
     conn->sshConn = master.startCommand(std::move(command), std::list{config->extraSshArgs});
+    {
+        auto conns(openConnections.lock());
+        if (shutDown)
+            throw Error("connection to '%s' was shut down", config->authority.host);
+        std::erase_if(*conns, [](auto & c) { return c.expired(); });
+        conns->push_back(conn.get_ptr());
+    }
     if (config->connPipeSize) {
         conn->sshConn->trySetBufferSize(*config->connPipeSize);
     }
@@ -286,6 +293,15 @@ void LegacySSHStore::connect()
     auto conn(connections->get());
 }
 
+void LegacySSHStore::shutdownConnections()
+{
+    auto conns(openConnections.lock());
+    shutDown = true;
+    for (auto & c : *conns)
+        if (auto conn = c.lock())
+            conn->sshConn->shutdown();
+}
+
 unsigned int LegacySSHStore::getProtocol()
 {
     auto conn(connections->get());
@@ -0,0 +1,89 @@
+#include "nix/store/bind-mount.hh"
+#include "nix/util/error.hh"
+#include "nix/util/file-descriptor.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/logging.hh"
+
+#include <atomic>
+#include <fcntl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "store-config-private.hh"
+
+namespace nix::linux {
+
+static void bindMount(
+    const std::filesystem::path & storeDir,
+    Descriptor storeDirFd,
+    const std::filesystem::path & targetDir,
+    Descriptor targetDirFd,
+    const std::string & name)
+{
+#if HAVE_OPEN_TREE
+    /* Fall back to mount() on kernels older than 5.2 (ENOSYS), and
+       where a seccomp profile rejects the new mount API (EPERM), as
+       the default ones of Docker and Podman do. Remember this so that
+       we don't try again for every store path. */
+    static std::atomic<bool> haveOpenTree{true};
+
+    auto unsupported = [](int err) { return err == ENOSYS || err == EPERM; };
+
+    if (haveOpenTree) {
+        AutoCloseFD tree = open_tree(storeDirFd, name.c_str(), OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | AT_RECURSIVE);
+        if (tree) {
+            if (move_mount(tree.get(), "", targetDirFd, name.c_str(), MOVE_MOUNT_F_EMPTY_PATH) == 0)
+                return;
+            if (!unsupported(errno))
+                throw SysError("bind mount from '%1%' to '%2%' failed", storeDir / name, targetDir / name);
+        } else if (!unsupported(errno))
+            throw SysError("bind mount from '%1%' to '%2%' failed", storeDir / name, targetDir / name);
+        debug("open_tree() or move_mount() is not available, falling back to mount()");
+        haveOpenTree = false;
+    }
+#endif
+
+    auto source = storeDir / name;
+    auto target = targetDir / name;
+    if (mount(source.c_str(), target.c_str(), "", MS_BIND | MS_REC, 0) == -1)
+        throw SysError("bind mount from '%1%' to '%2%' failed", source, target);
+}
+
+void bindMountStoreObjects(
+    const std::filesystem::path & storeDir, const std::filesystem::path & targetDir, const StringSet & names)
+{
+    AutoCloseFD storeDirFd = open(storeDir.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (!storeDirFd)
+        throw SysError("opening directory '%1%'", storeDir);
+
+    AutoCloseFD targetDirFd = open(targetDir.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (!targetDirFd)
+        throw SysError("opening directory '%1%'", targetDir);
+
+    for (auto & name : names) {
+        debug("bind mounting '%1%' to '%2%'", storeDir / name, targetDir / name);
+
+        struct stat st;
+        if (fstatat(storeDirFd.get(), name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == -1)
+            throw SysError("getting attributes of path '%1%'", storeDir / name);
+
+        if (S_ISDIR(st.st_mode)) {
+            if (mkdirat(targetDirFd.get(), name.c_str(), 0777) == -1 && errno != EEXIST)
+                throw SysError("creating directory '%1%'", targetDir / name);
+            bindMount(storeDir, storeDirFd.get(), targetDir, targetDirFd.get(), name);
+        } else if (S_ISLNK(st.st_mode)) {
+            // Symlinks can (apparently) not be bind-mounted, so just copy it
+            auto target = readLink(storeDir / name);
+            if (symlinkat(target.c_str(), targetDirFd.get(), name.c_str()) == -1)
+                throw SysError("creating symlink '%1%'", targetDir / name);
+        } else {
+            AutoCloseFD fd = openat(targetDirFd.get(), name.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0666);
+            if (!fd)
+                throw SysError("creating file '%1%'", targetDir / name);
+            bindMount(storeDir, storeDirFd.get(), targetDir, targetDirFd.get(), name);
+        }
+    }
+}
+
+} // namespace nix::linux
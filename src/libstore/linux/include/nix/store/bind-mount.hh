@@ -0,0 +1,24 @@
+#pragma once
+///@file
+
+#include "nix/util/types.hh"
+
+#include <filesystem>
+
+namespace nix::linux {
+
+/**
+ * Make the store objects `names` in the store directory `storeDir`
+ * appear under the same names in `targetDir`. Directories and regular
+ * files are bind-mounted, symlinks are copied.
+ *
+ * This is used to populate the Nix store of a sandbox, which can have
+ * thousands of inputs. All operations are relative to file descriptors
+ * for the two directories and use the new mount API (`open_tree()` and
+ * `move_mount()`) where available, so each store object costs a few
+ * system calls that resolve a single path component.
+ */
+void bindMountStoreObjects(
+    const std::filesystem::path & storeDir, const std::filesystem::path & targetDir, const StringSet & names);
+
+} // namespace nix::linux
@@ -123,15 +123,17 @@ std::optional<std::string> LocalFSStore::getBuildLogExact(const StorePath & path
         Path logPath =
             j == 0 ? fmt("%s/%s/%s/%s", config.logDir.get(), drvsLogDir, baseName.substr(0, 2), baseName.substr(2))
                    : fmt("%s/%s/%s", config.logDir.get(), drvsLogDir, baseName);
-        Path logBz2Path = logPath + ".bz2";
 
         if (pathExists(logPath))
             return readFile(logPath);
 
-        else if (pathExists(logBz2Path)) {
-            try {
-                return decompress("bzip2", readFile(logBz2Path));
-            } catch (Error &) {
+        for (auto & [ext, method] : {std::pair{".zst", "zstd"}, std::pair{".bz2", "bzip2"}}) {
+            Path compressedPath = logPath + ext;
+            if (pathExists(compressedPath)) {
+                try {
+                    return decompress(method, readFile(compressedPath));
+                } catch (Error &) {
+                }
             }
         }
     }
@@ -16,6 +16,7 @@
 #include "nix/store/posix-fs-canonicalise.hh"
 #include "nix/util/posix-source-accessor.hh"
 #include "nix/store/keys.hh"
+#include "nix/store/names.hh"
 #include "nix/util/url.hh"
 #include "nix/util/users.hh"
 #include "nix/store/store-open.hh"
@@ -112,6 +113,12 @@ struct LocalStore::State::Stmts
     SQLiteStmt QueryValidPaths;
     SQLiteStmt QueryRealisationReferences;
     SQLiteStmt AddRealisationReference;
+    SQLiteStmt AddBuildToHistory;
+    SQLiteStmt AddBuildHistoryOutput;
+    SQLiteStmt QueryBuildTimes;
+    SQLiteStmt QueryBuildHistory;
+    SQLiteStmt QueryBuildHistoryOutputs;
+    SQLiteStmt PruneBuildHistory;
 };
 
 LocalStore::LocalStore(ref<const Config> config)
@@ -408,6 +415,37 @@ LocalStore::LocalStore(ref<const Config> config)
                     (select id from Realisations where drvPath = ? and outputName = ?));
             )");
     }
+    if (!config->readOnly) {
+        state->stmts->AddBuildToHistory.create(
+            state->db,
+            R"(
+                insert into BuildHistory (name, system, drvPath, startTime, stopTime, status,
+                    cpuUser, cpuSystem, peakMemory, ioReadBytes, ioWriteBytes)
+                values (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);
+            )");
+        state->stmts->AddBuildHistoryOutput.create(
+            state->db, "insert or replace into BuildHistoryOutputs (build, outputName, path) values (?, ?, ?);");
+        state->stmts->QueryBuildTimes.create(
+            state->db,
+            R"(
+                select stopTime - startTime from BuildHistory
+                where name = ? and system = ? and status = 'Built'
+                order by id desc limit 5;
+            )");
+        state->stmts->PruneBuildHistory.create(state->db, "delete from BuildHistory where stopTime < ?;");
+        state->stmts->QueryBuildHistory.create(
+            state->db,
+            R"(
+                select id, drvPath, system, startTime, stopTime, status,
+                    cpuUser, cpuSystem, peakMemory, ioReadBytes, ioWriteBytes
+                from BuildHistory
+                where (?1 is null or name = ?1)
+                    and (?2 is null or id in (select build from BuildHistoryOutputs where path = ?2))
+                order by id desc limit ?3;
+            )");
+        state->stmts->QueryBuildHistoryOutputs.create(
+            state->db, "select outputName, path from BuildHistoryOutputs where build = ?;");
+    }
 }
 
 AutoCloseFD LocalStore::openGCLock()
@@ -597,6 +635,12 @@ void LocalStore::upgradeDBSchema(State & state)
             "20220326-ca-derivations",
 #include "ca-specific-schema.sql.gen.hh"
         );
+
+    if (!config->readOnly)
+        doUpgrade(
+            "20261018-build-history",
+#include "build-history-schema.sql.gen.hh"
+        );
 }
 
 /* To improve purity, users may want to make the Nix store a read-only
@@ -1072,7 +1116,7 @@ void LocalStore::addToStore(const ValidPathInfo & info, Source & source, RepairF
             /* Lock the output path.  But don't lock if we're being called
             from a build hook (whose parent process already acquired a
             lock on this path). */
-            if (!locksHeld.count(printStorePath(info.path)))
+            if (!locksHeld.lock()->count(printStorePath(info.path)))
                 outputLock.lockPaths({realPath});
 
             if (repair || !isValidPath(info.path)) {
@@ -1085,8 +1129,23 @@ void LocalStore::addToStore(const ValidPathInfo & info, Source & source, RepairF
 
                 TeeSource wrapperSource{source, hashSink};
 
+                RestoreSink restoreSink{settings.fsyncStorePaths};
+                restoreSink.dstPath = realPath;
+
+                /* If we're going to optimise the path anyway, link
+                   files whose contents are already in the store
+                   rather than writing them first. */
+                InodeHash inodeHash;
+                if (settings.autoOptimiseStore && !repair) {
+                    restoreSink.maxBufferedFileSize = maxLinkableFileSize;
+                    restoreSink.findLinkTarget =
+                        [&](const std::filesystem::path & path, std::string_view contents, bool executable) {
+                            return findLinkTarget(path.string(), contents, executable, inodeHash);
+                        };
+                }
+
                 narRead = true;
-                restorePath(realPath, wrapperSource, settings.fsyncStorePaths);
+                parseDump(restoreSink, wrapperSource);
 
                 auto hashResult = hashSink.finish();
 
@@ -1144,7 +1203,7 @@ void LocalStore::addToStore(const ValidPathInfo & info, Source & source, RepairF
 
                 canonicalisePathMetaData(realPath);
 
-                optimisePath(realPath, repair); // FIXME: combine with hashPath()
+                optimisePath(realPath, repair, inodeHash); // FIXME: combine with hashPath()
 
                 if (settings.fsyncStorePaths) {
                     recursiveSync(realPath);
@@ -1583,6 +1642,135 @@ void LocalStore::addSignatures(const StorePath & storePath, const StringSet & si
     });
 }
 
+/**
+ * The key under which builds of `drvPath` are recorded in the build
+ * history: the derivation name without its version, so that the
+ * history carries over to new versions of the same package.
+ */
+static std::string buildHistoryName(const StorePath & drvPath)
+{
+    auto name = drvPath.name();
+    if (drvPath.isDerivation())
+        name.remove_suffix(drvExtension.size());
+    return DrvName(name).name;
+}
+
+void LocalStore::addBuildToHistory(const StorePath & drvPath, std::string_view system, const BuildResult & result)
+{
+    if (config->readOnly)
+        return;
+
+    auto toInt = [](auto n) -> int64_t {
+        if constexpr (requires { n.count(); })
+            return n.count();
+        else
+            return n;
+    };
+
+    std::optional<int64_t> resources[] = {
+        result.cpuUser.transform(toInt),
+        result.cpuSystem.transform(toInt),
+        result.peakMemory.transform(toInt),
+        result.ioReadBytes.transform(toInt),
+        result.ioWriteBytes.transform(toInt),
+    };
+
+    std::string status(
+        result.tryGetSuccess() ? BuildResult::Success::statusToString(result.tryGetSuccess()->status)
+                               : BuildResult::Failure::statusToString(result.tryGetFailure()->status));
+
+    retrySQLite<void>([&]() {
+        auto state(_state->lock());
+
+        SQLiteTxn txn(state->db);
+
+        if (config->buildHistoryMaxAge)
+            state->stmts->PruneBuildHistory
+                .use()((int64_t) time(0) - (int64_t) config->buildHistoryMaxAge.get() * 24 * 60 * 60)
+                .exec();
+
+        auto useAdd(state->stmts->AddBuildToHistory.use());
+        useAdd(buildHistoryName(drvPath))(system)(printStorePath(drvPath))((int64_t) result.startTime)(
+            (int64_t) result.stopTime)(status);
+        for (auto & n : resources)
+            useAdd(n.value_or(0), n.has_value());
+        useAdd.exec();
+
+        auto id = state->db.getLastInsertedRowId();
+
+        if (auto success = result.tryGetSuccess())
+            for (auto & [outputName, realisation] : success->builtOutputs)
+                state->stmts->AddBuildHistoryOutput
+                    .use()((int64_t) id)(outputName)(printStorePath(realisation.outPath))
+                    .exec();
+
+        txn.commit();
+    });
+}
+
+std::vector<BuildHistoryEntry> LocalStore::queryBuildHistory(const BuildHistoryQuery & query)
+{
+    if (config->readOnly)
+        return {};
+
+    return retrySQLite<std::vector<BuildHistoryEntry>>([&]() {
+        auto state(_state->lock());
+
+        std::vector<BuildHistoryEntry> res;
+
+        auto useQuery(state->stmts->QueryBuildHistory.use()(query.name.value_or(""), query.name.has_value())(
+            query.outputPath ? printStorePath(*query.outputPath) : "", query.outputPath.has_value())(
+            (int64_t) query.limit));
+
+        auto getOptional = [&](int col) -> std::optional<uint64_t> {
+            if (useQuery.isNull(col))
+                return std::nullopt;
+            return useQuery.getInt(col);
+        };
+
+        while (useQuery.next()) {
+            auto & entry = res.emplace_back(BuildHistoryEntry{
+                .drvPath = parseStorePath(useQuery.getStr(1)),
+                .system = useQuery.getStr(2),
+                .startTime = (time_t) useQuery.getInt(3),
+                .stopTime = (time_t) useQuery.getInt(4),
+                .status = useQuery.getStr(5),
+                .cpuUser = getOptional(6).transform([](auto n) { return std::chrono::microseconds(n); }),
+                .cpuSystem = getOptional(7).transform([](auto n) { return std::chrono::microseconds(n); }),
+                .peakMemory = getOptional(8),
+                .ioReadBytes = getOptional(9),
+                .ioWriteBytes = getOptional(10),
+            });
+
+            auto useOutputs(state->stmts->QueryBuildHistoryOutputs.use()(useQuery.getInt(0)));
+            while (useOutputs.next())
+                entry.outputs.insert_or_assign(useOutputs.getStr(0), parseStorePath(useOutputs.getStr(1)));
+        }
+
+        return res;
+    });
+}
+
+std::optional<std::chrono::seconds>
+LocalStore::queryExpectedBuildTime(const StorePath & drvPath, std::string_view system)
+{
+    if (config->readOnly)
+        return std::nullopt;
+
+    return retrySQLite<std::optional<std::chrono::seconds>>([&]() -> std::optional<std::chrono::seconds> {
+        auto state(_state->lock());
+        auto use(state->stmts->QueryBuildTimes.use()(buildHistoryName(drvPath))(system));
+        int64_t total = 0, count = 0;
+        while (use.next()) {
+            total += std::max<int64_t>(use.getInt(0), 0);
+            count++;
+        }
+        if (!count)
+            return std::nullopt;
+        return std::chrono::seconds(total / count);
+    });
+}
+
 std::optional<std::pair<int64_t, UnkeyedRealisation>>
 LocalStore::queryRealisationCore_(LocalStore::State & state, const DrvOutput & id)
 {
@@ -1652,7 +1840,12 @@ void LocalStore::addBuildLog(const StorePath & drvPath, std::string_view log)
 
     auto baseName = drvPath.to_string();
 
-    auto logPath = fmt("%s/%s/%s/%s.bz2", config->logDir, drvsLogDir, baseName.substr(0, 2), baseName.substr(2));
+    auto logPath = fmt("%s/%s/%s/%s", config->logDir, drvsLogDir, baseName.substr(0, 2), baseName.substr(2));
+
+    if (pathExists(logPath + ".bz2"))
+        return;
+
+    logPath += ".zst";
 
     if (pathExists(logPath))
         return;
@@ -1661,7 +1854,7 @@ void LocalStore::addBuildLog(const StorePath & drvPath, std::string_view log)
 
     auto tmpFile = fmt("%s.tmp.%d", logPath, getpid());
 
-    writeFile(tmpFile, compress("bzip2", log));
+    writeFile(tmpFile, compress("zstd", log));
 
     std::filesystem::rename(tmpFile, logPath);
 }
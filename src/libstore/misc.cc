@@ -267,6 +267,18 @@ MissingPaths Store::queryMissing(const std::vector<DerivedPath> & targets)
                     }
 
                     if (knownOutputPaths && settings.useSubstitutes && drvOptions.substitutesAllowed()) {
+                        if (invalid.size() > 1) {
+                            /* Warm the narinfo caches for all outputs at
+                               once, rather than one at a time in
+                               checkOutput(). */
+                            auto * cap = getDerivationCA(*drv);
+                            StorePathCAMap outputs;
+                            for (auto & output : invalid)
+                                outputs.emplace(output, cap ? std::optional{*cap} : std::nullopt);
+                            SubstitutablePathInfos infos;
+                            querySubstitutablePathInfos(outputs, infos);
+                        }
+
                         auto drvState = make_ref<Sync<DrvState>>(DrvState(invalid.size()));
                         for (auto & output : invalid)
                             pool.enqueue(std::bind(checkOutput, drvPath, drv, output, drvState));
@@ -296,6 +308,26 @@ MissingPaths Store::queryMissing(const std::vector<DerivedPath> & targets)
                         state->res.narSize += info->second.narSize;
                     }
 
+                    /* Warm the narinfo caches for all references that
+                       still need to be substituted at once, rather than
+                       one at a time in doPath(). */
+                    StorePathCAMap refs;
+                    {
+                        auto state(state_.lock());
+                        for (auto & ref : info->second.references)
+                            if (!state->done.contains(DerivedPath::Opaque{ref}.to_string(*this)))
+                                refs.emplace(ref, std::nullopt);
+                    }
+                    if (refs.size() > 1) {
+                        StorePathSet refPaths;
+                        for (auto & [ref, _] : refs)
+                            refPaths.insert(ref);
+                        for (auto & ref : queryValidPaths(refPaths))
+                            refs.erase(ref);
+                        SubstitutablePathInfos refInfos;
+                        querySubstitutablePathInfos(refs, refInfos);
+                    }
+
                     for (auto & ref : info->second.references)
                         pool.enqueue(std::bind(doPath, DerivedPath::Opaque{ref}));
                 },
@@ -6,6 +6,7 @@
 
 #include <sqlite3.h>
 #include <nlohmann/json.hpp>
+#include <boost/unordered/unordered_flat_map.hpp>
 
 #include "nix/util/strings.hh"
 
@@ -76,12 +77,21 @@ public:
         int priority;
     };
 
+    /* The hash parts that a binary cache is known not to have, mapped
+       to the time at which that was recorded. */
+    typedef boost::unordered_flat_map<std::string, time_t> KnownMissing;
+
     struct State
     {
         SQLite db;
-        SQLiteStmt insertCache, queryCache, insertNAR, insertMissingNAR, queryNAR, insertRealisation,
-            insertMissingRealisation, queryRealisation, purgeCache;
+        SQLiteStmt insertCache, queryCache, insertNAR, insertMissingNAR, queryNAR, queryMissingNARs,
+            insertRealisation, insertMissingRealisation, queryRealisation, purgeCache;
         std::map<std::string, Cache> caches;
+
+        /* Negative lookup results per cache id. This is loaded by the
+           first bulk lookup for a cache, after which negative lookups
+           for that cache are answered without querying the database. */
+        std::map<int, KnownMissing> knownMissing;
     };
 
     Sync<State> _state;
@@ -118,6 +128,9 @@ public:
             state->db,
             "select present, namePart, url, compression, fileHash, fileSize, narHash, narSize, refs, deriver, sigs, ca from NARs where cache = ? and hashPart = ? and ((present = 0 and timestamp > ?) or (present = 1 and timestamp > ?))");
 
+        state->queryMissingNARs.create(
+            state->db, "select hashPart, timestamp from NARs where cache = ? and present = 0 and timestamp > ?");
+
         state->insertRealisation.create(
             state->db,
             R"(
@@ -252,38 +265,124 @@ public:
 
                 auto & cache(getCache(*state, uri));
 
-                auto now = time(0);
+                return lookupNarInfo(*state, cache, hashPart, time(0));
+            });
+    }
 
-                auto queryNAR(state->queryNAR.use()(cache.id)(hashPart) (now - settings.ttlNegativeNarInfoCache)(
-                    now - settings.ttlPositiveNarInfoCache));
+    std::map<std::string, std::pair<Outcome, std::shared_ptr<NarInfo>>>
+    lookupNarInfos(const std::string & uri, const StringSet & hashParts) override
+    {
+        return retrySQLite<std::map<std::string, std::pair<Outcome, std::shared_ptr<NarInfo>>>>([&]() {
+            std::map<std::string, std::pair<Outcome, std::shared_ptr<NarInfo>>> res;
 
-                if (!queryNAR.next())
-                    return {oUnknown, 0};
+            auto state(_state.lock());
 
-                if (!queryNAR.getInt(0))
-                    return {oInvalid, 0};
+            auto & cache(getCache(*state, uri));
 
-                auto namePart = queryNAR.getStr(1);
-                auto narInfo = make_ref<NarInfo>(
-                    cache.storeDir, StorePath(hashPart + "-" + namePart), Hash::parseAnyPrefixed(queryNAR.getStr(6)));
-                narInfo->url = queryNAR.getStr(2);
-                narInfo->compression = queryNAR.getStr(3);
-                if (!queryNAR.isNull(4))
-                    narInfo->fileHash = Hash::parseAnyPrefixed(queryNAR.getStr(4));
-                narInfo->fileSize = queryNAR.getInt(5);
-                narInfo->narSize = queryNAR.getInt(7);
-                for (auto & r : tokenizeString<Strings>(queryNAR.getStr(8), " "))
-                    narInfo->references.insert(StorePath(r));
-                if (!queryNAR.isNull(9))
-                    narInfo->deriver = StorePath(queryNAR.getStr(9));
-                for (auto & sig : tokenizeString<Strings>(queryNAR.getStr(10), " "))
-                    narInfo->sigs.insert(sig);
-                narInfo->ca = ContentAddress::parseOpt(queryNAR.getStr(11));
-
-                return {oValid, narInfo};
-            });
+            auto now = time(0);
+
+            SQLiteTxn txn(state->db);
+
+            if (!state->knownMissing.contains(cache.id)) {
+                KnownMissing knownMissing;
+                auto query(state->queryMissingNARs.use()(cache.id)(now - settings.ttlNegativeNarInfoCache));
+                while (query.next())
+                    knownMissing.insert_or_assign(query.getStr(0), query.getInt(1));
+                debug("loaded %d negative NAR info cache entries for '%s'", knownMissing.size(), uri);
+                state->knownMissing.insert_or_assign(cache.id, std::move(knownMissing));
+            }
+
+            for (auto & hashPart : hashParts) {
+                auto r = lookupNarInfo(*state, cache, hashPart, now);
+                if (r.first != oUnknown)
+                    res.insert_or_assign(hashPart, std::move(r));
+            }
+
+            txn.commit();
+
+            return res;
+        });
     }
 
+private:
+
+    std::pair<Outcome, std::shared_ptr<NarInfo>>
+    lookupNarInfo(State & state, const Cache & cache, const std::string & hashPart, time_t now)
+    {
+        if (auto knownMissing = get(state.knownMissing, cache.id)) {
+            auto i = knownMissing->find(hashPart);
+            if (i != knownMissing->end() && i->second > now - (time_t) settings.ttlNegativeNarInfoCache)
+                return {oInvalid, 0};
+        }
+
+        auto queryNAR(state.queryNAR.use()(cache.id)(hashPart) (now - settings.ttlNegativeNarInfoCache)(
+            now - settings.ttlPositiveNarInfoCache));
+
+        if (!queryNAR.next())
+            return {oUnknown, 0};
+
+        if (!queryNAR.getInt(0))
+            return {oInvalid, 0};
+
+        auto namePart = queryNAR.getStr(1);
+        auto narInfo = make_ref<NarInfo>(
+            cache.storeDir, StorePath(hashPart + "-" + namePart), Hash::parseAnyPrefixed(queryNAR.getStr(6)));
+        narInfo->url = queryNAR.getStr(2);
+        narInfo->compression = queryNAR.getStr(3);
+        if (!queryNAR.isNull(4))
+            narInfo->fileHash = Hash::parseAnyPrefixed(queryNAR.getStr(4));
+        narInfo->fileSize = queryNAR.getInt(5);
+        narInfo->narSize = queryNAR.getInt(7);
+        for (auto & r : tokenizeString<Strings>(queryNAR.getStr(8), " "))
+            narInfo->references.insert(StorePath(r));
+        if (!queryNAR.isNull(9))
+            narInfo->deriver = StorePath(queryNAR.getStr(9));
+        for (auto & sig : tokenizeString<Strings>(queryNAR.getStr(10), " "))
+            narInfo->sigs.insert(sig);
+        narInfo->ca = ContentAddress::parseOpt(queryNAR.getStr(11));
+
+        return {oValid, narInfo};
+    }
+
+    void upsertNarInfo(
+        State & state,
+        const Cache & cache,
+        const std::string & hashPart,
+        std::shared_ptr<const ValidPathInfo> info,
+        time_t now)
+    {
+        auto knownMissing = get(state.knownMissing, cache.id);
+
+        if (info) {
+
+            auto narInfo = std::dynamic_pointer_cast<const NarInfo>(info);
+
+            // assert(hashPart == storePathToHash(info->path));
+
+            state.insertNAR
+                .use()(cache.id)(hashPart) (std::string(info->path.name()))(
+                    narInfo ? narInfo->url : "", narInfo != 0)(narInfo ? narInfo->compression : "", narInfo != 0)(
+                    narInfo && narInfo->fileHash ? narInfo->fileHash->to_string(HashFormat::Nix32, true) : "",
+                    narInfo && narInfo->fileHash)(
+                    narInfo ? narInfo->fileSize : 0, narInfo != 0 && narInfo->fileSize)(info->narHash.to_string(
+                    HashFormat::Nix32, true))(info->narSize)(concatStringsSep(" ", info->shortRefs()))(
+                    info->deriver ? std::string(info->deriver->to_string()) : "", (bool) info->deriver)(
+                    concatStringsSep(" ", info->sigs))(renderContentAddress(info->ca))(now)
+                .exec();
+
+            if (knownMissing)
+                knownMissing->erase(hashPart);
+
+        } else {
+            state.insertMissingNAR.use()(cache.id)(hashPart) (now).exec();
+
+            if (knownMissing)
+                knownMissing->insert_or_assign(hashPart, now);
+        }
+    }
+
+public:
+
     std::pair<Outcome, std::shared_ptr<Realisation>>
     lookupRealisation(const std::string & uri, const DrvOutput & id) override
     {
@@ -324,26 +423,26 @@ public:
 
             auto & cache(getCache(*state, uri));
 
-            if (info) {
+            upsertNarInfo(*state, cache, hashPart, info, time(0));
+        });
+    }
+
+    void upsertNarInfos(
+        const std::string & uri, const std::map<std::string, std::shared_ptr<const ValidPathInfo>> & infos) override
+    {
+        retrySQLite<void>([&]() {
+            auto state(_state.lock());
+
+            auto & cache(getCache(*state, uri));
 
-                auto narInfo = std::dynamic_pointer_cast<const NarInfo>(info);
+            auto now = time(0);
 
-                // assert(hashPart == storePathToHash(info->path));
+            SQLiteTxn txn(state->db);
 
-                state->insertNAR
-                    .use()(cache.id)(hashPart) (std::string(info->path.name()))(
-                        narInfo ? narInfo->url : "", narInfo != 0)(narInfo ? narInfo->compression : "", narInfo != 0)(
-                        narInfo && narInfo->fileHash ? narInfo->fileHash->to_string(HashFormat::Nix32, true) : "",
-                        narInfo && narInfo->fileHash)(
-                        narInfo ? narInfo->fileSize : 0, narInfo != 0 && narInfo->fileSize)(info->narHash.to_string(
-                        HashFormat::Nix32, true))(info->narSize)(concatStringsSep(" ", info->shortRefs()))(
-                        info->deriver ? std::string(info->deriver->to_string()) : "", (bool) info->deriver)(
-                        concatStringsSep(" ", info->sigs))(renderContentAddress(info->ca))(time(0))
-                    .exec();
+            for (auto & [hashPart, info] : infos)
+                upsertNarInfo(*state, cache, hashPart, info, now);
 
-            } else {
-                state->insertMissingNAR.use()(cache.id)(hashPart) (time(0)).exec();
-            }
+            txn.commit();
         });
     }
 
@@ -3,6 +3,7 @@
 #include "nix/util/signals.hh"
 #include "nix/store/posix-fs-canonicalise.hh"
 #include "nix/util/posix-source-accessor.hh"
+#include "nix/util/archive.hh"
 
 #include <cstdlib>
 #include <cstring>
@@ -96,13 +97,8 @@ Strings LocalStore::readDirectoryIgnoringInodes(const Path & path, const InodeHa
     return names;
 }
 
-void LocalStore::optimisePath_(
-    Activity * act, OptimiseStats & stats, const Path & path, InodeHash & inodeHash, RepairFlag repair)
+static bool canLink(const Path & path)
 {
-    checkInterrupt();
-
-    auto st = lstat(path);
-
 #ifdef __APPLE__
     /* HFS/macOS has some undocumented security feature disabling hardlinking for
        special files within .app dirs. Known affected paths include
@@ -112,9 +108,21 @@ void LocalStore::optimisePath_(
 
     if (std::regex_search(path, std::regex("\\.app/Contents/.+$"))) {
         debug("'%1%' is not allowed to be linked in macOS", path);
-        return;
+        return false;
     }
 #endif
+    return true;
+}
+
+void LocalStore::optimisePath_(
+    Activity * act, OptimiseStats & stats, const Path & path, InodeHash & inodeHash, RepairFlag repair)
+{
+    checkInterrupt();
+
+    auto st = lstat(path);
+
+    if (!canLink(path))
+        return;
 
     if (S_ISDIR(st.st_mode)) {
         Strings names = readDirectoryIgnoringInodes(path, inodeHash);
@@ -321,11 +329,46 @@ void LocalStore::optimiseStore()
 
 void LocalStore::optimisePath(const Path & path, RepairFlag repair)
 {
-    OptimiseStats stats;
     InodeHash inodeHash;
+    optimisePath(path, repair, inodeHash);
+}
+
+void LocalStore::optimisePath(const Path & path, RepairFlag repair, InodeHash & inodeHash)
+{
+    OptimiseStats stats;
 
     if (settings.autoOptimiseStore)
         optimisePath_(nullptr, stats, path, inodeHash, repair);
 }
 
+std::optional<std::filesystem::path>
+LocalStore::findLinkTarget(const Path & path, std::string_view contents, bool executable, InodeHash & inodeHash)
+{
+    if (!canLink(path))
+        return std::nullopt;
+
+    /* This must be the same hash as computed by optimisePath_(),
+       i.e. the hash of the NAR serialisation of the file. */
+    HashSink hashSink(HashAlgorithm::SHA256);
+    hashSink << narVersionMagic1 << "(" << "type" << "regular";
+    if (executable)
+        hashSink << "executable" << "";
+    hashSink << "contents" << contents << ")";
+    auto hash = hashSink.finish().hash;
+
+    std::filesystem::path linkPath = std::filesystem::path{linksDir} / hash.to_string(HashFormat::Nix32, false);
+
+    /* Like optimisePath_(), don't use links whose size doesn't match;
+       they are corrupt. */
+    auto stLink = maybeLstat(linkPath.string());
+    if (!stLink || !S_ISREG(stLink->st_mode) || (uint64_t) stLink->st_size != contents.size())
+        return std::nullopt;
+
+    printMsg(lvlTalkative, "linking '%1%' to %2%", path, linkPath);
+
+    inodeHash.insert(stLink->st_ino);
+
+    return linkPath;
+}
+
 } // namespace nix
@@ -1,6 +1,7 @@
 #include <nlohmann/json.hpp>
 #include "nix/store/remote-fs-accessor.hh"
 #include "nix/util/nar-accessor.hh"
+#include "nix/util/nar-index.hh"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -37,18 +38,24 @@ ref<SourceAccessor> RemoteFSAccessor::addToCache(std::string_view hashPart, std:
     auto narAccessor = makeNarAccessor(std::move(nar));
     nars.emplace(hashPart, narAccessor);
 
-    if (cacheDir != "") {
-        try {
-            nlohmann::json j = listNarDeep(*narAccessor, CanonPath::root);
-            writeFile(makeCacheFile(hashPart, "ls"), j.dump());
-        } catch (...) {
-            ignoreExceptionExceptInterrupt();
-        }
-    }
+    if (cacheDir != "")
+        writeIndex(hashPart, *narAccessor);
 
     return narAccessor;
 }
 
+void RemoteFSAccessor::writeIndex(std::string_view hashPart, SourceAccessor & narAccessor)
+{
+    try {
+        auto indexFile = makeCacheFile(hashPart, "nidx");
+        auto tmpFile = indexFile + ".tmp";
+        writeFile(tmpFile, makeNarIndex(narAccessor));
+        std::filesystem::rename(tmpFile, indexFile);
+    } catch (...) {
+        ignoreExceptionExceptInterrupt();
+    }
+}
+
 std::pair<ref<SourceAccessor>, CanonPath> RemoteFSAccessor::fetch(const CanonPath & path)
 {
     auto [storePath, restPath] = store->toStorePath(store->storeDir + path.abs());
@@ -68,11 +75,25 @@ std::shared_ptr<SourceAccessor> RemoteFSAccessor::accessObject(const StorePath &
 
     if (cacheDir != "" && nix::pathExists(cacheFile = makeCacheFile(storePath.hashPart(), "nar"))) {
 
+        try {
+            auto narAccessor = openIndexedNarAccessor(
+                makeCacheFile(storePath.hashPart(), "nidx"), seekableGetNarBytes(cacheFile));
+
+            nars.emplace(storePath.hashPart(), narAccessor);
+            return narAccessor;
+
+        } catch (Error &) {
+        }
+
+        /* Caches written by older versions only have a JSON listing;
+           upgrade them to an index. */
         try {
             listing = nix::readFile(makeCacheFile(storePath.hashPart(), "ls"));
             auto listingJson = nlohmann::json::parse(listing);
             auto narAccessor = makeLazyNarAccessor(listingJson, seekableGetNarBytes(cacheFile));
 
+            writeIndex(storePath.hashPart(), *narAccessor);
+
             nars.emplace(storePath.hashPart(), narAccessor);
             return narAccessor;
 
@@ -54,12 +54,21 @@ ref<RemoteStore::Connection> RemoteStore::openConnectionWrapper()
 {
     if (failed)
         throw Error("opening a connection to remote store '%s' previously failed", config.getHumanReadableURI());
-    try {
-        return openConnection();
-    } catch (...) {
-        failed = true;
-        throw;
-    }
+    ref<Connection> conn = [&]() {
+        try {
+            return openConnection();
+        } catch (...) {
+            failed = true;
+            throw;
+        }
+    }();
+    auto conns(openConnections.lock());
+    /* Don't hand out connections after `shutdownConnections()`. */
+    if (failed)
+        throw Error("connection to remote store '%s' was shut down", config.getHumanReadableURI());
+    std::erase_if(*conns, [](auto & c) { return c.expired(); });
+    conns->push_back(conn.get_ptr());
+    return conn;
 }
 
 void RemoteStore::initConnection(Connection & conn)
@@ -779,6 +788,18 @@ std::vector<ActiveBuildInfo> RemoteStore::queryActiveBuilds()
     return nlohmann::json::parse(readString(conn->from)).get<std::vector<ActiveBuildInfo>>();
 }
 
+std::vector<BuildHistoryEntry> RemoteStore::queryBuildHistory(const BuildHistoryQuery & query)
+{
+    auto conn(getConnection());
+    if (!conn->features.count(WorkerProto::featureQueryBuildHistory))
+        throw Error("remote store does not support querying the build history");
+    conn->to << WorkerProto::Op::QueryBuildHistory << query.name.value_or("");
+    WorkerProto::write(*this, *conn, query.outputPath);
+    conn->to << query.limit;
+    conn.processStderr();
+    return nlohmann::json::parse(readString(conn->from)).get<std::vector<BuildHistoryEntry>>();
+}
+
 std::optional<std::string> RemoteStore::getVersion()
 {
     auto conn(getConnection());
@@ -790,6 +811,15 @@ void RemoteStore::connect()
     auto conn(getConnection());
 }
 
+void RemoteStore::shutdownConnections()
+{
+    auto conns(openConnections.lock());
+    failed = true;
+    for (auto & c : *conns)
+        if (auto conn = c.lock())
+            conn->shutdown();
+}
+
 unsigned int RemoteStore::getProtocol()
 {
     auto conn(connections->get());
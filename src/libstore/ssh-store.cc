@@ -70,6 +70,11 @@ protected:
         {
             sshConn->in.close();
         }
+
+        void shutdown() override
+        {
+            sshConn->shutdown();
+        }
     };
 
     ref<RemoteStore::Connection> openConnection() override;
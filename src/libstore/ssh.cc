@@ -289,6 +289,14 @@ Path SSHMaster::startMaster()
 
 #endif
 
+void SSHMaster::Connection::shutdown()
+{
+#ifndef _WIN32
+    if (sshPid != -1)
+        ::kill(sshPid, SIGTERM);
+#endif
+}
+
 void SSHMaster::Connection::trySetBufferSize(size_t size)
 {
 #ifdef F_SETPIPE_SZ
@@ -414,6 +414,42 @@ void Store::querySubstitutablePathInfos(const StorePathCAMap & paths, Substituta
     if (!settings.useSubstitutes)
         return;
 
+    /* When querying many paths, first fetch their path info from each
+       substituter in bulk, so that the per-path queries below are
+       answered from the narinfo caches. Paths that a substituter has
+       are not looked up in lower-priority substituters. */
+    if (paths.size() > 1) {
+        StorePathCAMap remaining = paths;
+        for (auto & sub : getDefaultSubstituters()) {
+            if (remaining.empty())
+                break;
+
+            std::map<StorePath, StorePath> subPaths;
+            for (auto & [path, ca] : remaining) {
+                if (ca)
+                    subPaths.insert_or_assign(
+                        path, makeFixedOutputPathFromCA(path.name(), ContentAddressWithReferences::withoutRefs(*ca)));
+                else if (sub->storeDir == storeDir)
+                    subPaths.insert_or_assign(path, path);
+            }
+
+            try {
+                StorePathSet toPrefetch;
+                for (auto & [_, subPath] : subPaths)
+                    toPrefetch.insert(subPath);
+                sub->prefetchPathInfos(toPrefetch);
+
+                for (auto & [path, subPath] : subPaths) {
+                    auto info = sub->queryPathInfoFromClientCache(subPath);
+                    if (info && *info)
+                        remaining.erase(path);
+                }
+            } catch (Error &) {
+                /* Reported by the per-path queries below. */
+            }
+        }
+    }
+
     for (auto & path : paths) {
         std::optional<Error> lastStoresException = std::nullopt;
         for (auto & sub : getDefaultSubstituters()) {
@@ -628,6 +664,90 @@ void Store::queryPathInfo(const StorePath & storePath, Callback<ref<const ValidP
         }});
 }
 
+void Store::prefetchPathInfos(const StorePathSet & paths)
+{
+    std::map<std::string, StorePath> todo;
+
+    {
+        auto cache(pathInfoCache->lock());
+        for (auto & path : paths) {
+            auto res = cache->get(path);
+            if (!res || !res->isKnownNow())
+                todo.emplace(std::string(path.hashPart()), path);
+        }
+    }
+
+    if (todo.empty())
+        return;
+
+    auto uri = config.getReference().render(/*FIXME withParams=*/false);
+
+    if (diskCache) {
+        StringSet hashParts;
+        for (auto & [hashPart, _] : todo)
+            hashParts.insert(hashPart);
+
+        auto cached = diskCache->lookupNarInfos(uri, hashParts);
+
+        auto cache(pathInfoCache->lock());
+        for (auto & [hashPart, res] : cached) {
+            auto i = todo.find(hashPart);
+            assert(i != todo.end());
+            stats.narInfoReadAverted++;
+            cache->upsert(
+                i->second,
+                res.first == NarInfoDiskCache::oInvalid ? PathInfoCacheValue{}
+                                                        : PathInfoCacheValue{.value = res.second});
+            todo.erase(i);
+        }
+    }
+
+    if (todo.empty())
+        return;
+
+    debug("prefetching info about %d paths from '%s'", todo.size(), config.getHumanReadableURI());
+
+    struct State
+    {
+        size_t pending;
+        std::map<std::string, std::shared_ptr<const ValidPathInfo>> infos;
+    };
+
+    Sync<State> state_(State{.pending = todo.size()});
+
+    std::condition_variable wakeup;
+
+    for (auto & [hashPart, storePath] : todo) {
+        queryPathInfoUncached(
+            storePath, {[&, hashPart](std::future<std::shared_ptr<const ValidPathInfo>> fut) {
+                std::optional<std::shared_ptr<const ValidPathInfo>> info;
+                try {
+                    info = fut.get();
+                } catch (...) {
+                    /* Ignore; the error will be reported when the path
+                       is queried individually. */
+                }
+                auto state(state_.lock());
+                if (info)
+                    state->infos.insert_or_assign(hashPart, *info);
+                assert(state->pending);
+                if (!--state->pending)
+                    wakeup.notify_one();
+            }});
+    }
+
+    auto state(state_.lock());
+    while (state->pending)
+        state.wait(wakeup);
+
+    if (diskCache)
+        diskCache->upsertNarInfos(uri, state->infos);
+
+    auto cache(pathInfoCache->lock());
+    for (auto & [hashPart, info] : state->infos)
+        cache->upsert(todo.at(hashPart), PathInfoCacheValue{.value = info});
+}
+
 void Store::queryRealisation(
     const DrvOutput & id, Callback<std::shared_ptr<const UnkeyedRealisation>> callback) noexcept
 {
@@ -77,7 +77,12 @@ StoreReference UDSRemoteStoreConfig::getReference() const
 
 void UDSRemoteStore::Connection::closeWrite()
 {
-    shutdown(toSocket(fd.get()), SHUT_WR);
+    ::shutdown(toSocket(fd.get()), SHUT_WR);
+}
+
+void UDSRemoteStore::Connection::shutdown()
+{
+    ::shutdown(toSocket(fd.get()), SHUT_RDWR);
 }
 
 ref<RemoteStore::Connection> UDSRemoteStore::openConnection()
@@ -93,6 +93,12 @@ protected:
 
     std::unique_ptr<DerivationBuilderCallbacks> miscMethods;
 
+    /**
+     * The share of the machine's resources given to this build, if
+     * `adaptive-build-resources` is enabled.
+     */
+    std::optional<BuildBudget> budget;
+
 public:
 
     DerivationBuilderImpl(
@@ -231,6 +237,11 @@ public:
 
     SingleDrvOutputs unprepareBuild() override;
 
+    void setBudget(const BuildBudget & budget) override
+    {
+        this->budget = budget;
+    }
+
 protected:
 
     /**
@@ -307,6 +318,15 @@ protected:
      */
     virtual void startChild();
 
+    /**
+     * Called by unprepareBuild() to make sure that the child process
+     * has terminated. Returns its wait status.
+     */
+    virtual int reapChild()
+    {
+        return pid.kill();
+    }
+
 #if NIX_WITH_AWS_AUTH
     /**
      * Pre-resolve AWS credentials for S3 URLs in builtin:fetchurl.
@@ -513,7 +533,7 @@ SingleDrvOutputs DerivationBuilderImpl::unprepareBuild()
        to have terminated.  In fact, the builder could also have
        simply have closed its end of the pipe, so just to be sure,
        kill it. */
-    int status = pid.kill();
+    int status = reapChild();
 
     debug("builder process for '%s' finished", store.printStorePath(drvPath));
 
@@ -1076,7 +1096,11 @@ void DerivationBuilderImpl::initEnv()
     env["NIX_STORE"] = store.storeDir;
 
     /* The maximum number of cores to utilize for parallel building. */
-    env["NIX_BUILD_CORES"] = fmt("%d", settings.buildCores ? settings.buildCores : settings.getDefaultCores());
+    env["NIX_BUILD_CORES"] = fmt(
+        "%d",
+        budget                ? budget->cores
+        : settings.buildCores ? settings.buildCores
+                              : settings.getDefaultCores());
 
     /* Write the final environment. Note that this is intentionally
        *not* `drv.env`, because we've desugared things like like
@@ -1996,6 +2020,7 @@ StorePath DerivationBuilderImpl::makeFallbackPath(const StorePath & path)
 #include "linux-derivation-builder.cc"
 #include "darwin-derivation-builder.cc"
 #include "external-derivation-builder.cc"
+#include "in-process-derivation-builder.cc"
 #include "wasi-derivation-builder.cc"
 
 namespace nix {
@@ -2053,6 +2078,13 @@ std::unique_ptr<DerivationBuilder> makeDerivationBuilder(
     if (!useSandbox && params.drvOptions.useUidRange(params.drv))
         throw Error("feature 'uid-range' is only supported in sandboxed builds");
 
+    /* Run trusted builtins in-process if the builder would run as the
+       current user anyway, and the sandbox wouldn't protect anything
+       that the current user can't access. */
+    if (settings.inProcessBuiltins && InProcessDerivationBuilder::isSupported(params.drv) && !useBuildUsers()
+        && (!useSandbox || !isRootUser()) && store.storeDir == store.config->realStoreDir.get())
+        return std::make_unique<InProcessDerivationBuilder>(store, std::move(miscMethods), std::move(params));
+
 #ifdef __APPLE__
     return std::make_unique<DarwinDerivationBuilder>(store, std::move(miscMethods), std::move(params), useSandbox);
 #elif defined(__linux__)
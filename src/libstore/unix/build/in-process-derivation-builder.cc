@@ -0,0 +1,140 @@
+#include <sys/wait.h>
+
+#include <atomic>
+#include <thread>
+
+namespace nix {
+
+/**
+ * Runs builtin builders that only create files from their inputs
+ * (`builtin:buildenv` and `builtin:unpack-channel`) in the Nix process
+ * itself, instead of forking a (possibly sandboxed) child. This is only
+ * used if the child would run with our own privileges anyway; see
+ * `makeDerivationBuilder()`.
+ *
+ * The builtin runs on a thread of its own, so that it doesn't hold up
+ * the worker's other goals. Everything else, in particular output
+ * registration, is the same as for other builds.
+ */
+struct InProcessDerivationBuilder : DerivationBuilderImpl
+{
+    /**
+     * The wait status of the builtin, as if it had run in a child
+     * process. Only valid once `thread` has been joined.
+     */
+    int status = 0;
+
+    /**
+     * Makes the builtin throw `Interrupted` at its next interruption
+     * point.
+     */
+    std::atomic<bool> cancelled{false};
+
+    std::thread thread;
+
+    using DerivationBuilderImpl::DerivationBuilderImpl;
+
+    ~InProcessDerivationBuilder()
+    {
+        /* The base class cleans up the build directory, so the builtin
+           must be gone by then. */
+        try {
+            killChild();
+        } catch (...) {
+            ignoreExceptionInDestructor();
+        }
+    }
+
+    static bool isSupported(const BasicDerivation & drv)
+    {
+        return drv.builder == "builtin:buildenv" || drv.builder == "builtin:unpack-channel";
+    }
+
+    void startChild() override
+    {
+        /* Write the build log to the pseudoterminal, like a child
+           would. Once the thread closes the slave, the worker sees
+           EOF. */
+        AutoCloseFD slave = open(getPtsName(builderOut.get()).c_str(), O_RDWR | O_NOCTTY);
+        if (!slave)
+            throw SysError("opening pseudoterminal slave");
+
+        struct termios term;
+        if (tcgetattr(slave.get(), &term))
+            throw SysError("getting pseudoterminal attributes");
+
+        cfmakeraw(&term);
+
+        if (tcsetattr(slave.get(), TCSANOW, &term))
+            throw SysError("putting pseudoterminal into raw mode");
+
+        /* Indicate that we managed to set up the build environment. */
+        writeFull(slave.get(), std::string("\2\n"));
+
+        BuiltinBuilderContext ctx{
+            .drv = drv,
+            .tmpDirInSandbox = tmpDirInSandbox(),
+        };
+
+        for (auto & e : drv.outputs)
+            ctx.outputs.insert_or_assign(e.first, realPathInHost(store.printStorePath(scratchOutputs.at(e.first))));
+
+        debug("running builder '%s' in-process", drv.builder);
+
+        thread = std::thread([this, slave = std::move(slave), ctx = std::move(ctx)]() {
+            unix::interruptCheck = [this]() { return cancelled.load(); };
+
+            /* Messages of the builtin (e.g. collision warnings) go to the
+               build log, like those of a builtin in a child process. */
+            auto buildLogger = makeJSONLogger(slave.get());
+            PushThreadLogger pushLogger(*buildLogger);
+
+            try {
+                std::string builtinName = drv.builder.substr(8);
+                if (auto builtin = get(RegisterBuiltinBuilder::builtinBuilders(), builtinName))
+                    (*builtin)(ctx);
+                else
+                    throw Error("unsupported builtin builder '%1%'", builtinName);
+                status = 0;
+            } catch (std::exception & e) {
+                status = W_EXITCODE(1, 0);
+                try {
+                    writeFull(slave.get(), std::string(e.what()) + "\n");
+                } catch (...) {
+                    /* The build was cancelled, or nobody is reading
+                       the log anymore. */
+                }
+            }
+
+            /* `slave` is closed when the thread exits, which makes the
+               worker see EOF. */
+        });
+    }
+
+    int reapChild() override
+    {
+        if (thread.joinable())
+            thread.join();
+        return status;
+    }
+
+    bool killChild() override
+    {
+        if (!thread.joinable())
+            return false;
+        cancelled = true;
+        thread.join();
+        activeBuildHandle.reset();
+        return true;
+    }
+
+    ActiveBuild getActiveBuild() override
+    {
+        /* The builtin runs in this process. */
+        auto build = DerivationBuilderImpl::getActiveBuild();
+        build.mainPid = getpid();
+        return build;
+    }
+};
+
+} // namespace nix
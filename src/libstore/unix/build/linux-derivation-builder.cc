@@ -1,6 +1,7 @@
 #ifdef __linux__
 
 #  include "nix/store/personality.hh"
+#  include "nix/store/bind-mount.hh"
 #  include "nix/util/cgroup.hh"
 #  include "nix/util/linux-namespaces.hh"
 #  include "nix/util/logging.hh"
@@ -17,18 +18,22 @@
 
 #  if HAVE_SECCOMP
 #    include <seccomp.h>
+#    include <linux/filter.h>
+#    include <linux/seccomp.h>
+#    include <sys/prctl.h>
 #  endif
 
 #  define pivot_root(new_root, put_old) (syscall(SYS_pivot_root, new_root, put_old))
 
 namespace nix {
 
-static void setupSeccomp()
-{
-    if (!settings.filterSyscalls)
-        return;
-
 #  if HAVE_SECCOMP
+
+/**
+ * Compile the syscall filter for builders into a BPF program.
+ */
+static std::vector<struct sock_filter> compileSeccompFilter()
+{
     scmp_filter_ctx ctx;
 
     if (!(ctx = seccomp_init(SCMP_ACT_ALLOW)))
@@ -110,10 +115,66 @@ static void setupSeccomp()
         || seccomp_rule_add(ctx, SCMP_ACT_ERRNO(ENOTSUP), SCMP_SYS(fsetxattr), 0) != 0)
         throw SysError("unable to add seccomp rule");
 
-    if (seccomp_attr_set(ctx, SCMP_FLTATR_CTL_NNP, settings.allowNewPrivileges ? 0 : 1) != 0)
-        throw SysError("unable to set 'no new privileges' seccomp attribute");
+    /* Export the program rather than loading it, so that every
+       builder can load it without recompiling. */
+    AutoCloseFD fd = memfd_create("nix-seccomp-filter", MFD_CLOEXEC);
+    if (!fd)
+        throw SysError("creating memfd for the seccomp BPF program");
+
+    if (int res = seccomp_export_bpf(ctx, fd.get()); res != 0)
+        throw SysError(-res, "unable to export seccomp BPF program");
+
+    if (lseek(fd.get(), 0, SEEK_SET) == -1)
+        throw SysError("seeking in the seccomp BPF program");
+
+    auto bpf = drainFD(fd.get());
+    if (bpf.empty() || bpf.size() % sizeof(struct sock_filter) != 0)
+        throw Error("seccomp BPF program has an invalid size of %d bytes", bpf.size());
+
+    std::vector<struct sock_filter> filter(bpf.size() / sizeof(struct sock_filter));
+    std::memcpy(filter.data(), bpf.data(), bpf.size());
+    return filter;
+}
+
+/**
+ * The syscall filter for builders. Compiling it with libseccomp takes
+ * a significant part of the time it takes to start a trivial build,
+ * so it is done once per process. This must be called before forking
+ * the builder.
+ */
+static const std::vector<struct sock_filter> & getSeccompFilter()
+{
+    static auto filter = compileSeccompFilter();
+    return filter;
+}
+
+#  endif
+
+static void prepareSeccomp()
+{
+#  if HAVE_SECCOMP
+    if (settings.filterSyscalls)
+        getSeccompFilter();
+#  endif
+}
+
+static void setupSeccomp()
+{
+    if (!settings.filterSyscalls)
+        return;
+
+#  if HAVE_SECCOMP
+    auto & filter = getSeccompFilter();
+
+    if (!settings.allowNewPrivileges && prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1)
+        throw SysError("unable to set 'no new privileges'");
+
+    struct sock_fprog prog{
+        .len = (unsigned short) filter.size(),
+        .filter = const_cast<struct sock_filter *>(filter.data()),
+    };
 
-    if (seccomp_load(ctx) != 0)
+    if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) == -1)
         throw SysError("unable to load seccomp BPF program");
 #  else
     throw Error(
@@ -158,6 +219,12 @@ struct LinuxDerivationBuilder : virtual DerivationBuilderImpl
 {
     using DerivationBuilderImpl::DerivationBuilderImpl;
 
+    void startChild() override
+    {
+        prepareSeccomp();
+        DerivationBuilderImpl::startChild();
+    }
+
     void enterChroot() override
     {
         setupSeccomp();
@@ -191,6 +258,14 @@ struct ChrootLinuxDerivationBuilder : ChrootDerivationBuilder, LinuxDerivationBu
      */
     std::optional<Path> cgroup;
 
+    /**
+     * Whether the parent of `cgroup` belongs to us, i.e. it is the
+     * root cgroup of a daemon that has moved itself into a
+     * `nix-daemon` sub-cgroup (see `nix-daemon`). Only then do we
+     * change which controllers are enabled in it.
+     */
+    bool ownsParentCgroup = false;
+
     ChrootLinuxDerivationBuilder(
         LocalStore & store, std::unique_ptr<DerivationBuilderCallbacks> miscMethods, DerivationBuilderParams params)
         : DerivationBuilderImpl{store, std::move(miscMethods), std::move(params)}
@@ -236,6 +311,8 @@ struct ChrootLinuxDerivationBuilder : ChrootDerivationBuilder, LinuxDerivationBu
             cgroup = buildUser ? fmt("%s/nix-build-uid-%d", rootCgroupPath, buildUser->getUID())
                                : fmt("%s/nix-build-pid-%d-%d", rootCgroupPath, getpid(), counter++);
 
+            ownsParentCgroup = getCurrentCgroup() == canonPath(rootCgroup + "/nix-daemon");
+
             debug("using cgroup '%s'", *cgroup);
 
             /* When using a build user, record the cgroup we used for that
@@ -265,17 +342,72 @@ struct ChrootLinuxDerivationBuilder : ChrootDerivationBuilder, LinuxDerivationBu
         ChrootDerivationBuilder::prepareSandbox();
 
         if (cgroup) {
+            /* Make the CPU and memory controllers available to the
+               build's cgroup, so that its budget can be enforced. Only
+               do this in the daemon's own (delegated) cgroup, not in
+               e.g. the user's session or a systemd slice, and only for
+               the controllers that are delegated to it. */
+            if (budget && ownsParentCgroup)
+                try {
+                    auto parent = dirOf(*cgroup);
+                    auto available = tokenizeString<StringSet>(readFile(parent + "/cgroup.controllers"));
+                    auto enabled = tokenizeString<StringSet>(readFile(parent + "/cgroup.subtree_control"));
+                    Strings wanted;
+                    for (auto controller : {"cpu", "memory"})
+                        if (available.contains(controller) && !enabled.contains(controller))
+                            wanted.push_back(fmt("+%s", controller));
+                    if (!wanted.empty())
+                        writeFile(parent + "/cgroup.subtree_control", concatStringsSep(" ", wanted));
+                } catch (SysError & e) {
+                    debug("cannot enable cgroup controllers: %s", e.msg());
+                }
+
             if (mkdir(cgroup->c_str(), 0755) != 0)
                 throw SysError("creating cgroup '%s'", *cgroup);
             chownToBuilder(*cgroup);
             chownToBuilder(*cgroup + "/cgroup.procs");
             chownToBuilder(*cgroup + "/cgroup.threads");
             // chownToBuilder(*cgroup + "/cgroup.subtree_control");
+
+            applyBudget();
+        }
+    }
+
+    void setBudget(const BuildBudget & budget) override
+    {
+        DerivationBuilderImpl::setBudget(budget);
+        if (cgroup && pathExists(*cgroup))
+            applyBudget();
+    }
+
+    /**
+     * Enforce `budget` through the `cpu.max` and `memory.high` limits
+     * of the build's cgroup, if the controllers are available.
+     */
+    void applyBudget()
+    {
+        if (!budget)
+            return;
+
+        static constexpr unsigned int cpuPeriod = 100000; // microseconds
+
+        try {
+            auto cpuMax = *cgroup + "/cpu.max";
+            if (pathExists(cpuMax))
+                writeFile(cpuMax, fmt("%d %d", (uint64_t) budget->cores * cpuPeriod, cpuPeriod));
+
+            auto memoryHigh = *cgroup + "/memory.high";
+            if (budget->memory && pathExists(memoryHigh))
+                writeFile(memoryHigh, fmt("%d", *budget->memory));
+        } catch (SysError & e) {
+            debug("cannot set the resource limits of cgroup '%s': %s", *cgroup, e.msg());
         }
     }
 
     void startChild() override
     {
+        prepareSeccomp();
+
         RunChildArgs args{
 #  if NIX_WITH_AWS_AUTH
             .awsCredentials = preResolveAwsCredentials(),
@@ -566,11 +698,30 @@ struct ChrootLinuxDerivationBuilder : ChrootDerivationBuilder, LinuxDerivationBu
 
         /* Bind-mount all the directories from the "host"
            filesystem that we want in the chroot
-           environment. */
+           environment. Consecutive store objects (typically the
+           inputs of the derivation, of which there can be
+           thousands) are mounted in batches. */
+        StringSet storeObjects;
+
+        auto flushStoreObjects = [&]() {
+            if (storeObjects.empty())
+                return;
+            linux::bindMountStoreObjects(store.config->realStoreDir.get(), chrootStoreDir, storeObjects);
+            storeObjects.clear();
+        };
+
         for (auto & i : pathsInChroot) {
             if (i.second.source == "/proc")
                 continue; // backwards compatibility
 
+            if (!i.second.optional && dirOf(i.first) == store.storeDir
+                && i.second.source == store.toRealPath(i.first)) {
+                storeObjects.insert(std::string(baseNameOf(i.first)));
+                continue;
+            }
+
+            flushStoreObjects();
+
 #  if HAVE_EMBEDDED_SANDBOX_SHELL
             if (i.second.source == "__embedded_sandbox_shell__") {
                 static unsigned char sh[] = {
@@ -587,6 +738,8 @@ struct ChrootLinuxDerivationBuilder : ChrootDerivationBuilder, LinuxDerivationBu
             }
         }
 
+        flushStoreObjects();
+
         /* Bind a new instance of procfs on /proc. */
         createDirs(chrootRootDir + "/proc");
         if (mount("none", (chrootRootDir + "/proc").c_str(), "proc", 0, 0) == -1)
@@ -702,6 +855,9 @@ struct ChrootLinuxDerivationBuilder : ChrootDerivationBuilder, LinuxDerivationBu
             if (getStats) {
                 buildResult.cpuUser = stats.cpuUser;
                 buildResult.cpuSystem = stats.cpuSystem;
+                buildResult.peakMemory = stats.memoryPeak;
+                buildResult.ioReadBytes = stats.ioReadBytes;
+                buildResult.ioWriteBytes = stats.ioWriteBytes;
             }
             return;
         }
@@ -0,0 +1,346 @@
+#include "nix/store/build/remote-build-dispatcher.hh"
+#include "nix/store/build-result.hh"
+#include "nix/store/local-store.hh"
+#include "nix/store/derivations.hh"
+#include "nix/store/globals.hh"
+#include "nix/util/finally.hh"
+#include "nix/util/signals.hh"
+#include "nix/util/util.hh"
+
+namespace nix {
+
+void RemoteBuild::join()
+{
+    if (thread.joinable())
+        thread.join();
+}
+
+void RemoteBuild::cancel()
+{
+    if (!thread.joinable())
+        return;
+
+    cancelled = true;
+
+    /* Interrupt any blocking read or write of the thread. If it hasn't
+       opened the remote store yet, it will notice `cancelled` right
+       after doing so. */
+    if (auto store = *remoteStore.lock())
+        store->shutdownConnections();
+
+    join();
+}
+
+RemoteBuild::~RemoteBuild()
+{
+    try {
+        cancel();
+    } catch (...) {
+        ignoreExceptionInDestructor();
+    }
+}
+
+RemoteBuildDispatcher::RemoteBuildDispatcher(Store & store)
+    : store(store)
+{
+    auto state(state_.lock());
+    for (auto & machine : getMachines())
+        state->machines.push_back(MachineState{.machine = machine});
+    debug("got %d remote builders", state->machines.size());
+}
+
+RemoteBuildDispatcher::~RemoteBuildDispatcher() = default;
+
+std::variant<RemoteBuildDispatcher::Reply, std::unique_ptr<RemoteBuild>>
+RemoteBuildDispatcher::tryBuild(Request request)
+{
+    while (true) {
+        size_t machineIndex = 0;
+        std::optional<Machine> machine;
+        bool reachable;
+
+        {
+            auto state(state_.lock());
+
+            if (state->machines.empty())
+                return Reply::DeclinePermanently;
+
+            bool rightType = false;
+            MachineState * best = nullptr;
+
+            for (auto && [i, m] : enumerate(state->machines)) {
+                if (!m.machine.enabled || !m.machine.systemSupported(request.system)
+                    || !m.machine.allSupported(request.requiredFeatures)
+                    || !m.machine.mandatoryMet(request.requiredFeatures))
+                    continue;
+
+                rightType = true;
+
+                if (m.currentJobs >= m.machine.maxJobs)
+                    continue;
+
+                /* Prefer the machine with the lowest load relative to
+                   its speed, then the fastest machine, then the one
+                   with the fewest jobs. */
+                auto load = m.currentJobs / m.machine.speedFactor;
+                if (!best || load < best->currentJobs / best->machine.speedFactor
+                    || (load == best->currentJobs / best->machine.speedFactor
+                        && (m.machine.speedFactor > best->machine.speedFactor
+                            || (m.machine.speedFactor == best->machine.speedFactor
+                                && m.currentJobs < best->currentJobs)))) {
+                    best = &m;
+                    machineIndex = i;
+                }
+            }
+
+            if (!best) {
+                if (rightType && !(request.amWilling && request.couldBuildLocally))
+                    return Reply::Postpone;
+
+                printMsg(
+                    request.couldBuildLocally ? lvlChatty : lvlWarn,
+                    "Failed to find a machine for remote build!\n"
+                    "derivation: %s\n"
+                    "required (system, features): (%s, [%s])",
+                    request.drvPath.to_string(),
+                    request.system,
+                    concatStringsSep<StringSet>(", ", request.requiredFeatures));
+
+                return Reply::Decline;
+            }
+
+            /* Claim a slot on the machine. */
+            best->currentJobs++;
+            machine.emplace(best->machine);
+            reachable = best->reachable;
+        }
+
+        auto storeUri = machine->storeUri.render();
+
+        /* The store that the first build on a machine uses is opened
+           here, to find out whether the machine is reachable at all.
+           Later builds open their own store in their thread. */
+        std::shared_ptr<Store> remoteStore;
+
+        if (!reachable) {
+            try {
+                Activity act(*logger, lvlTalkative, actUnknown, fmt("connecting to '%s'", storeUri));
+                auto newStore = machine->openStore();
+                newStore->connect();
+                remoteStore = newStore.get_ptr();
+            } catch (std::exception & e) {
+                printError("cannot build on '%s': %s", storeUri, e.what());
+                auto state(state_.lock());
+                state->machines[machineIndex].machine.enabled = false;
+                state->machines[machineIndex].currentJobs--;
+                continue;
+            }
+
+            state_.lock()->machines[machineIndex].reachable = true;
+        }
+
+        auto build = std::make_unique<RemoteBuild>();
+        build->machineName = storeUri;
+        build->done.create();
+
+        build->thread = std::thread([this,
+                                     build = build.get(),
+                                     machineIndex,
+                                     machine = std::move(*machine),
+                                     remoteStore = std::move(remoteStore),
+                                     request = std::move(request)]() mutable {
+            unix::interruptCheck = [build]() { return build->cancelled.load(); };
+
+            try {
+                /* Each build has its own store, and thus its own
+                   connections, so that `RemoteBuild::cancel()` can shut
+                   them down without affecting other builds. */
+                if (!remoteStore)
+                    remoteStore = machine.openStore().get_ptr();
+                *build->remoteStore.lock() = remoteStore;
+                checkInterrupt();
+                runBuild(machineIndex, ref(remoteStore), request);
+            } catch (...) {
+                build->error = std::current_exception();
+            }
+
+            state_.lock()->machines[machineIndex].currentJobs--;
+
+            try {
+                build->done.writeSide.close();
+            } catch (...) {
+                ignoreExceptionExceptInterrupt();
+            }
+        });
+
+        return build;
+    }
+}
+
+void RemoteBuildDispatcher::upload(size_t machineIndex, Store & remoteStore, const StorePathSet & paths)
+{
+    auto substitute = settings.buildersUseSubstitutes ? Substitute : NoSubstitute;
+
+    /* Don't trust `uploaded`: the machine may have garbage-collected
+       paths since we copied them. */
+    auto valid = remoteStore.queryValidPaths(paths);
+
+    {
+        auto state(state_.lock());
+        auto & m = state->machines[machineIndex];
+        for (auto & path : paths)
+            if (valid.contains(path))
+                m.uploaded.insert(path);
+            else {
+                m.uploaded.erase(path);
+                m.pendingUploads.insert(path);
+            }
+    }
+
+    while (true) {
+        StorePathSet batch;
+
+        {
+            auto state(state_.lock());
+
+            while (true) {
+                auto & m = state->machines[machineIndex];
+                if (std::ranges::all_of(paths, [&](auto & path) { return m.uploaded.contains(path); }))
+                    return;
+                if (!m.uploading)
+                    break;
+                /* Wake up periodically so that a cancelled build stops
+                   waiting. */
+                state.wait_for(uploadDone, std::chrono::seconds(1));
+                checkInterrupt();
+            }
+
+            /* Upload everything that is pending for this machine,
+               including the paths of other builds that are waiting for
+               the current upload to finish. */
+            auto & m = state->machines[machineIndex];
+            batch = std::move(m.pendingUploads);
+            m.pendingUploads.clear();
+            m.uploading = true;
+        }
+
+        bool success = false;
+
+        Finally done([&]() {
+            auto state(state_.lock());
+            auto & m = state->machines[machineIndex];
+            m.uploading = false;
+            if (success)
+                m.uploaded.insert(batch.begin(), batch.end());
+            else
+                /* Let the next waiter retry. */
+                m.pendingUploads.insert(batch.begin(), batch.end());
+            uploadDone.notify_all();
+        });
+
+        debug("uploading %d paths to '%s'", batch.size(), remoteStore.config.getHumanReadableURI());
+        copyPaths(store, remoteStore, batch, NoRepair, NoCheckSigs, substitute);
+        success = true;
+    }
+}
+
+void RemoteBuildDispatcher::runBuild(size_t machineIndex, ref<Store> remoteStore, const Request & request)
+{
+    auto storeUri = remoteStore->config.getHumanReadableURI();
+
+    {
+        Activity act(*logger, lvlTalkative, actUnknown, fmt("copying dependencies to '%s'", storeUri));
+        upload(machineIndex, *remoteStore, request.inputs);
+    }
+
+    auto drv = store.readDerivation(request.drvPath);
+
+    BuildResult result;
+
+    /* See `build-remote.cc` and the comment in
+       `case WorkerProto::Op::BuildDerivation:` in `daemon.cc` for the
+       trust model here. */
+    bool trustedOrLegacy = ({
+        std::optional trusted = remoteStore->isTrustedClient();
+        !trusted || *trusted;
+    });
+
+    if (trustedOrLegacy || drv.type().isCA()) {
+        if (!drv.inputDrvs.map.empty())
+            drv.inputSrcs = request.inputs;
+        result = remoteStore->buildDerivation(request.drvPath, static_cast<const BasicDerivation &>(drv));
+    } else {
+        StorePathSet closure;
+        store.computeFSClosure(request.drvPath, closure);
+        upload(machineIndex, *remoteStore, closure);
+        auto res = remoteStore->buildPathsWithResults({DerivedPath::Built{
+            .drvPath = makeConstantStorePathRef(request.drvPath),
+            .outputs = OutputsSpec::All{},
+        }});
+        assert(res.size() == 1);
+        result = std::move(res[0]);
+    }
+
+    /* Keep the status of the remote failure, so that e.g. timeouts
+       enforced by the remote machine are reported as such. */
+    if (auto * failure = result.tryGetFailure())
+        throw BuildError(
+            failure->status,
+            "build of '%s' on '%s' failed: %s",
+            store.printStorePath(request.drvPath),
+            storeUri,
+            failure->errorMsg);
+
+    std::set<Realisation> missingRealisations;
+    StorePathSet missingPaths;
+    if (experimentalFeatureSettings.isEnabled(Xp::CaDerivations) && !drv.type().hasKnownOutputPaths()) {
+        auto outputHashes = staticOutputHashes(store, drv);
+        for (auto & outputName : request.wantedOutputs) {
+            auto thisOutputId = DrvOutput{outputHashes.at(outputName), outputName};
+            if (!store.queryRealisation(thisOutputId)) {
+                if (auto * success = result.tryGetSuccess()) {
+                    auto i = success->builtOutputs.find(outputName);
+                    assert(i != success->builtOutputs.end());
+                    missingRealisations.insert(i->second);
+                    missingPaths.insert(i->second.outPath);
+                }
+            }
+        }
+    } else {
+        for (auto & [outputName, output] : drv.outputsAndOptPaths(store)) {
+            assert(output.second);
+            if (!store.isValidPath(*output.second))
+                missingPaths.insert(*output.second);
+        }
+    }
+
+    if (!missingPaths.empty()) {
+        Activity act(*logger, lvlTalkative, actUnknown, fmt("copying outputs from '%s'", storeUri));
+
+        /* The goal holds the locks on the output paths; tell the local
+           store not to lock them again. */
+        auto localStore = dynamic_cast<LocalStore *>(&store);
+        if (localStore)
+            for (auto & path : missingPaths)
+                localStore->locksHeld.lock()->insert(store.printStorePath(path));
+        Finally unlock([&]() {
+            if (localStore)
+                for (auto & path : missingPaths)
+                    localStore->locksHeld.lock()->erase(store.printStorePath(path));
+        });
+
+        copyPaths(*remoteStore, store, missingPaths, NoRepair, NoCheckSigs, NoSubstitute);
+    }
+
+    for (auto & realisation : missingRealisations) {
+        experimentalFeatureSettings.require(Xp::CaDerivations);
+        store.registerDrvOutput(realisation);
+    }
+
+    /* The outputs are now valid on the remote machine. */
+    auto state(state_.lock());
+    for (auto & path : missingPaths)
+        state->machines[machineIndex].uploaded.insert(path);
+}
+
+} // namespace nix
@@ -1,22 +1,7 @@
-#include <wasmtime.hh>
+#include "nix/store/wasm.hh"
 
 namespace nix {
 
-// FIXME: cut&paste
-template<typename T, typename E = Error>
-T unwrap(wasmtime::Result<T, E> && res)
-{
-    if (res)
-        return res.ok();
-    throw Error(res.err().message());
-}
-
-// FIXME: cut&paste
-static std::span<uint8_t> string2span(std::string_view s)
-{
-    return std::span<uint8_t>((uint8_t *) s.data(), s.size());
-}
-
 struct WasiDerivationBuilder : DerivationBuilderImpl
 {
     WasiDerivationBuilder(
@@ -29,8 +14,16 @@ struct WasiDerivationBuilder : DerivationBuilderImpl
     void execBuilder(const Strings & args, const Strings & envStrs) override
     {
         using namespace wasmtime;
+        using wasm::unwrap;
+
+        /* Compile the module here rather than in the parent, so that
+           compiling doesn't hold up the worker and untrusted code is
+           only compiled in the builder process. Don't use the engine
+           of the parent, whose locks and threads may be in any state
+           after forking. */
+        auto engine = wasm::createEngine();
+        auto module = wasm::compileModule(engine, readFile(realPathInHost(drv.builder)), drv.builder);
 
-        Engine engine;
         Linker linker(engine);
         unwrap(linker.define_wasi());
 
@@ -53,7 +46,6 @@ struct WasiDerivationBuilder : DerivationBuilderImpl
             throw Error("cannot add store directory to WASI config");
         // FIXME: add temp dir
 
-        auto module = unwrap(Module::compile(engine, string2span(readFile(realPathInHost(drv.builder)))));
         wasmtime::Store wasmStore(engine);
         unwrap(wasmStore.context().set_wasi(std::move(wasiConfig)));
         auto instance = unwrap(linker.instantiate(wasmStore, module));
@@ -0,0 +1,204 @@
+#pragma once
+///@file
+
+#include "nix/store/machines.hh"
+#include "nix/store/path.hh"
+#include "nix/util/file-descriptor.hh"
+#include "nix/util/sync.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <thread>
+#include <variant>
+
+namespace nix {
+
+class Store;
+
+/**
+ * A build running on a remote machine, in a thread of its own.
+ */
+struct RemoteBuild
+{
+    std::string machineName;
+
+    /**
+     * Closed by the thread when the build has finished, so that
+     * the worker sees EOF on the read side.
+     */
+    Pipe done;
+
+    /**
+     * The error that made the build fail, if any. Only valid after
+     * `join()`. Failures reported by the remote machine are thrown as
+     * `BuildError` with the remote status.
+     */
+    std::exception_ptr error;
+
+    /**
+     * Makes the thread throw `Interrupted` at its next interruptible
+     * operation.
+     */
+    std::atomic<bool> cancelled{false};
+
+    /**
+     * The store the thread talks to, once it has opened it. Used by
+     * `cancel()` to interrupt blocking reads and writes.
+     */
+    Sync<std::shared_ptr<Store>> remoteStore;
+
+    std::thread thread;
+
+    void join();
+
+    /**
+     * Stop the build and wait for the thread to exit. The thread's
+     * connections to the remote machine are shut down, which
+     * interrupts its blocking I/O and makes the remote side abort the
+     * build.
+     */
+    void cancel();
+
+    /**
+     * Cancels the build if it is still running.
+     */
+    ~RemoteBuild();
+};
+
+/**
+ * Dispatches builds to the remote builders (see the `builders`
+ * setting) from within the worker, as an alternative to the build hook
+ * (see the `remote-build-dispatcher` setting).
+ *
+ * Unlike the build hook, which forks a process, reads the machines
+ * file, connects to the chosen machine and uploads the inputs for every
+ * remote build, the dispatcher lives as long as the `Worker`. It reads
+ * the machines file once, only checks once per machine that it is
+ * reachable, tracks the load of the machines in memory, and batches
+ * the uploads of builds that go to the same machine.
+ *
+ * The in-memory load model only accounts for the builds of this
+ * process, so concurrent Nix processes may oversubscribe a machine.
+ */
+class RemoteBuildDispatcher
+{
+public:
+
+    enum class Reply {
+        /**
+         * No machine can build this derivation.
+         */
+        Decline,
+
+        /**
+         * There are no remote machines at all.
+         */
+        DeclinePermanently,
+
+        /**
+         * A suitable machine exists, but it is busy.
+         */
+        Postpone,
+    };
+
+    struct Request
+    {
+        StorePath drvPath;
+        std::string system;
+        StringSet requiredFeatures;
+
+        /**
+         * Whether we are willing to build the derivation locally
+         * (right now) instead.
+         */
+        bool amWilling;
+
+        /**
+         * Whether we would be able to build the derivation locally
+         * once build slots become free.
+         */
+        bool couldBuildLocally;
+
+        /**
+         * The closure of the inputs of the derivation.
+         */
+        StorePathSet inputs;
+
+        /**
+         * The outputs to copy back.
+         */
+        StringSet wantedOutputs;
+    };
+
+    RemoteBuildDispatcher(Store & store);
+
+    ~RemoteBuildDispatcher();
+
+    /**
+     * Start building `request.drvPath` on the least loaded suitable
+     * machine, or explain why it can't be done right now.
+     */
+    std::variant<Reply, std::unique_ptr<RemoteBuild>> tryBuild(Request request);
+
+private:
+
+    struct MachineState
+    {
+        Machine machine;
+
+        /**
+         * The number of builds running on this machine.
+         */
+        unsigned int currentJobs = 0;
+
+        /**
+         * Whether we have managed to connect to this machine. Until
+         * then, connecting is done synchronously by `tryBuild()`, so
+         * that an unreachable machine can be disabled and another one
+         * chosen.
+         */
+        bool reachable = false;
+
+        /**
+         * Paths that were valid on this machine when last checked.
+         * Only used to combine concurrent uploads; `upload()` checks
+         * with the machine before relying on it, since the machine
+         * may have garbage-collected them since.
+         */
+        StorePathSet uploaded;
+
+        /**
+         * Paths that builds are waiting for to be uploaded.
+         */
+        StorePathSet pendingUploads;
+
+        /**
+         * Whether a thread is currently uploading paths to this
+         * machine.
+         */
+        bool uploading = false;
+    };
+
+    struct State
+    {
+        std::vector<MachineState> machines;
+    };
+
+    Store & store;
+
+    Sync<State> state_;
+
+    std::condition_variable uploadDone;
+
+    void runBuild(size_t machineIndex, ref<Store> remoteStore, const Request & request);
+
+    /**
+     * Make sure that `paths` are valid on the given machine. Uploads
+     * requested by concurrent builds are combined into one
+     * `copyPaths()` call.
+     */
+    void upload(size_t machineIndex, Store & remoteStore, const StorePathSet & paths);
+};
+
+} // namespace nix
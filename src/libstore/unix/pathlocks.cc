@@ -11,6 +11,10 @@
 #include <sys/stat.h>
 #include <sys/file.h>
 
+#ifdef __linux__
+#  include <sys/inotify.h>
+#endif
+
 namespace nix {
 
 AutoCloseFD openLockFile(const std::filesystem::path & path, bool create)
@@ -100,8 +104,14 @@ bool PathLocks::lockPaths(const std::set<std::filesystem::path> & paths, const s
                     lockFile(fd.get(), ltWrite, true);
                 } else {
                     /* Failed to lock this path; release all other
-                       locks. */
-                    unlock();
+                       locks. Unlike unlock(), don't touch the lock
+                       files: this is not a release that processes
+                       waiting for them should wake up for, since
+                       otherwise waiters that each get some of the
+                       locks would keep waking each other up. */
+                    for (auto & i : fds)
+                        close(i.first);
+                    fds.clear();
                     return false;
                 }
             }
@@ -135,6 +145,10 @@ void PathLocks::unlock()
     for (auto & i : fds) {
         if (deletePaths)
             deleteLockFile(i.second, i.first);
+        else
+            /* Touch the lock file to wake up processes waiting for it
+               (see `LockFileWatcher`). Deleting it does so as well. */
+            futimens(i.first, nullptr);
 
         if (close(i.first) == -1)
             printError("error (ignored): cannot close lock file on %1%", i.second);
@@ -145,6 +159,77 @@ void PathLocks::unlock()
     fds.clear();
 }
 
+LockFileWatcher::LockFileWatcher()
+{
+#ifdef __linux__
+    fd = AutoCloseFD{inotify_init1(IN_NONBLOCK | IN_CLOEXEC)};
+    if (!fd)
+        debug("cannot watch lock files: %s", strerror(errno));
+#endif
+}
+
+bool LockFileWatcher::watch(const std::filesystem::path & path)
+{
+#ifdef __linux__
+    if (!fd)
+        return false;
+
+    auto lockPath = path + ".lock";
+
+    /* The holder of a lock touches or unlinks the lock file when it
+       releases the lock. Don't watch for the lock file being closed:
+       waiters that fail to acquire the lock close it as well, and
+       would wake each other up. */
+    int wd = inotify_add_watch(fd.get(), lockPath.c_str(), IN_ATTRIB | IN_DELETE_SELF | IN_ONESHOT);
+    if (wd == -1) {
+        if (errno != ENOENT)
+            debug("cannot watch lock file %s: %s", lockPath, strerror(errno));
+        return false;
+    }
+
+    watches.insert_or_assign(wd, path);
+    return true;
+#else
+    return false;
+#endif
+}
+
+std::set<std::filesystem::path> LockFileWatcher::readEvents()
+{
+    std::set<std::filesystem::path> res;
+
+#ifdef __linux__
+    if (!fd)
+        return res;
+
+    alignas(struct inotify_event) char buf[4096];
+
+    while (true) {
+        auto n = read(fd.get(), buf, sizeof(buf));
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+            throw SysError("reading lock file events");
+        }
+
+        for (char * p = buf; p < buf + n;) {
+            auto event = (struct inotify_event *) p;
+            /* The watches are one-shot, so the kernel has already
+               removed this one (and will report IN_IGNORED for it). */
+            if (auto i = watches.find(event->wd); i != watches.end()) {
+                res.insert(std::move(i->second));
+                watches.erase(i);
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+#endif
+
+    return res;
+}
+
 FdLock::FdLock(Descriptor desc, LockType lockType, bool wait, std::string_view waitMsg)
     : desc(desc)
 {
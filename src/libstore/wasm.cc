@@ -0,0 +1,117 @@
+#include "nix/store/wasm.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/hash.hh"
+#include "nix/util/logging.hh"
+#include "nix/util/sync.hh"
+#include "nix/util/users.hh"
+
+#include <algorithm>
+
+namespace nix::wasm {
+
+wasmtime::Engine createEngine()
+{
+    wasmtime::Config config;
+    config.memory_init_cow(true);
+    return wasmtime::Engine(std::move(config));
+}
+
+wasmtime::Engine & getEngine()
+{
+    static wasmtime::Engine engine = []() {
+        /* The pooling allocator makes instantiation cheap for
+           `builtins.wasm`, which instantiates modules over and over,
+           at the cost of reserving a lot of address space up front. */
+        wasmtime::Config config;
+        config.pooling_allocation_strategy(wasmtime::PoolAllocationConfig());
+        config.memory_init_cow(true);
+        return wasmtime::Engine(std::move(config));
+    }();
+    return engine;
+}
+
+/**
+ * Delete the least recently used modules in the cache directory `dir`
+ * so that at most `maxCachedModules` remain.
+ */
+static void pruneCache(const std::filesystem::path & dir)
+{
+    std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> entries;
+    for (auto & entry : std::filesystem::directory_iterator(dir)) {
+        std::error_code ec;
+        auto time = entry.last_write_time(ec);
+        if (!ec && entry.path().extension() == ".cwasm")
+            entries.emplace_back(time, entry.path());
+    }
+
+    if (entries.size() <= maxCachedModules)
+        return;
+
+    std::ranges::sort(entries);
+
+    for (auto & [time, path] : std::span(entries).first(entries.size() - maxCachedModules)) {
+        debug("removing compiled WASM module %s from the cache", path);
+        /* Another process may have removed it already. */
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+    }
+}
+
+wasmtime::Module compileModule(wasmtime::Engine & engine, std::string_view wasm, std::string_view name)
+{
+    auto hash = hashString(HashAlgorithm::SHA256, wasm);
+
+    auto cacheFile = getCacheDir() / "wasm" / (hash.to_string(HashFormat::Nix32, false) + ".cwasm");
+
+    /* A cached module that was compiled by another version of wasmtime
+       or with a different configuration is rejected by
+       deserialize_file(), and we recompile it. */
+    if (pathExists(cacheFile)) {
+        auto res = wasmtime::Module::deserialize_file(engine, cacheFile.string());
+        if (res) {
+            /* Mark the module as recently used for `pruneCache()`. */
+            std::error_code ec;
+            std::filesystem::last_write_time(cacheFile, std::filesystem::file_time_type::clock::now(), ec);
+            return res.ok();
+        }
+        debug("cannot load compiled WASM module %s: %s", cacheFile, res.err().message());
+    }
+
+    Activity act(*logger, lvlTalkative, actUnknown, fmt("compiling WASM module '%s'", name));
+
+    auto module = unwrap(wasmtime::Module::compile(engine, string2span(wasm)));
+
+    try {
+        auto compiled = unwrap(module.serialize());
+        createDirs(cacheFile.parent_path());
+        auto tmpFile = makeTempPath(cacheFile.parent_path());
+        writeFile(tmpFile, span2string(compiled));
+        std::filesystem::rename(tmpFile, cacheFile);
+        pruneCache(cacheFile.parent_path());
+    } catch (std::exception & e) {
+        debug("cannot cache compiled WASM module '%s': %s", name, e.what());
+    }
+
+    return module;
+}
+
+wasmtime::Module compileModule(std::string_view wasm, std::string_view name)
+{
+    static Sync<std::map<Hash, wasmtime::Module>> modules_;
+
+    auto hash = hashString(HashAlgorithm::SHA256, wasm);
+
+    {
+        auto modules(modules_.lock());
+        if (auto i = modules->find(hash); i != modules->end())
+            return i->second;
+    }
+
+    auto module = compileModule(getEngine(), wasm, name);
+
+    modules_.lock()->insert_or_assign(hash, module);
+
+    return module;
+}
+
+} // namespace nix::wasm
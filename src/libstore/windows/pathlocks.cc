@@ -21,6 +21,18 @@ void deleteLockFile(const std::filesystem::path & path, Descriptor desc)
         warn("%s: &s", path, std::to_string(GetLastError()));
 }
 
+LockFileWatcher::LockFileWatcher() {}
+
+bool LockFileWatcher::watch(const std::filesystem::path & path)
+{
+    return false;
+}
+
+std::set<std::filesystem::path> LockFileWatcher::readEvents()
+{
+    return {};
+}
+
 void PathLocks::unlock()
 {
     for (auto & i : fds) {
@@ -5,7 +5,8 @@
 
 namespace nix {
 
-const WorkerProto::FeatureSet WorkerProto::allFeatures{{std::string(WorkerProto::featureQueryActiveBuilds)}};
+const WorkerProto::FeatureSet WorkerProto::allFeatures{
+    {std::string(WorkerProto::featureQueryActiveBuilds), std::string(WorkerProto::featureQueryBuildHistory)}};
 
 WorkerProto::BasicClientConnection::~BasicClientConnection()
 {
@@ -1,4 +1,6 @@
 #include "nix/util/archive.hh"
+#include "nix/util/memory-source-accessor.hh"
+#include "nix/util/posix-source-accessor.hh"
 #include "nix/util/tests/characterization.hh"
 #include "nix/util/tests/gmock-matchers.hh"
 
@@ -58,4 +60,161 @@ INSTANTIATE_TEST_SUITE_P(
         // Test that the 'name' field cannot come before the 'node' field in a directory entry.
         std::pair{"name-after-node", "bad archive: expected tag 'name'"}));
 
+#ifndef _WIN32
+TEST(restorePath, fromFile)
+{
+    using File = MemorySourceAccessor::File;
+
+    /* Make the files larger than the source's buffer, so that their
+       contents are copied from the file rather than from the buffer. */
+    std::string big(1024 * 1024, 'x');
+    for (size_t i = 0; i < big.size(); i += 4096)
+        big[i] = (char) i;
+
+    auto files = make_ref<MemorySourceAccessor>();
+    files->root = File::Directory{
+        .entries{
+            {"a", File::Regular{.executable = true, .contents = big}},
+            {"b", File::Regular{.contents = "small"}},
+            {"c", File::Symlink{.target = "a"}},
+            {"d", File::Regular{.contents = big + "tail"}},
+        },
+    };
+
+    StringSink nar;
+    files->dumpPath(CanonPath::root, nar);
+
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir, true);
+
+    auto narPath = tmpDir / "test.nar";
+    writeFile(narPath.string(), nar.s);
+
+    AutoCloseFD fd = toDescriptor(open(narPath.string().c_str(), O_RDONLY | O_CLOEXEC));
+    ASSERT_TRUE(fd);
+    FdSource source(fd.get());
+    restorePath(tmpDir / "out", source);
+
+    StringSink nar2;
+    PosixSourceAccessor::createAtRoot((tmpDir / "out").string()).dumpPath(nar2);
+    ASSERT_EQ(nar.s, nar2.s);
+}
+
+TEST(restorePath, linksKnownFiles)
+{
+    using File = MemorySourceAccessor::File;
+
+    auto files = make_ref<MemorySourceAccessor>();
+    files->root = File::Directory{
+        .entries{
+            {"dup", File::Regular{.contents = "known"}},
+            {"gone", File::Regular{.contents = "vanished"}},
+            {"new", File::Regular{.contents = "unknown"}},
+            {"sub", File::Directory{.entries{{"dup", File::Regular{.contents = "known"}}}}},
+        },
+    };
+
+    StringSink nar;
+    files->dumpPath(CanonPath::root, nar);
+
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir, true);
+
+    auto known = tmpDir / "known";
+    writeFile(known.string(), "known");
+
+    RestoreSink sink{false};
+    sink.dstPath = tmpDir / "out";
+    sink.maxBufferedFileSize = 1024;
+    sink.findLinkTarget = [&](const std::filesystem::path & path, std::string_view contents, bool executable) {
+        EXPECT_FALSE(executable);
+        if (contents == "known")
+            return std::optional{known};
+        if (contents == "vanished")
+            return std::optional{tmpDir / "nonexistent"};
+        return std::optional<std::filesystem::path>{};
+    };
+    StringSource source(nar.s);
+    parseDump(sink, source);
+
+    auto ino = lstat(known.string()).st_ino;
+    ASSERT_EQ(lstat((tmpDir / "out" / "dup").string()).st_ino, ino);
+    ASSERT_EQ(lstat((tmpDir / "out" / "sub" / "dup").string()).st_ino, ino);
+    ASSERT_NE(lstat((tmpDir / "out" / "new").string()).st_ino, ino);
+
+    StringSink nar2;
+    PosixSourceAccessor::createAtRoot((tmpDir / "out").string()).dumpPath(nar2);
+    ASSERT_EQ(nar.s, nar2.s);
+}
+#endif
+
+TEST(dumpPathReadAhead, matchesSequentialDump)
+{
+    using File = MemorySourceAccessor::File;
+
+    File::Directory root;
+    for (int i = 0; i < 50; ++i) {
+        File::Directory dir;
+        for (int j = 0; j < 50; ++j)
+            dir.entries.emplace(
+                fmt("file-%d", j), File::Regular{.executable = j % 7 == 0, .contents = fmt("%d/%d", i, j)});
+        dir.entries.emplace("link", File::Symlink{.target = "file-0"});
+        root.entries.emplace(fmt("dir-%d", i), std::move(dir));
+    }
+    root.entries.emplace("big", File::Regular{.contents = std::string(1024 * 1024, 'x')});
+    root.entries.emplace("empty", File::Directory{});
+
+    auto files = make_ref<MemorySourceAccessor>();
+    files->root = std::move(root);
+
+    PathFilter filter = [](const Path & path) { return !hasSuffix(path, "/file-3") && !hasSuffix(path, "/dir-5"); };
+
+    StringSink expected;
+    files->dumpPath(CanonPath::root, expected, filter);
+
+    StringSink actual;
+    dumpPathReadAhead(*files, CanonPath::root, actual, filter);
+    ASSERT_EQ(expected.s, actual.s);
+
+    /* Check the read-ahead of `PosixSourceAccessor` as well. */
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir, true);
+
+    StringSource source(expected.s);
+    restorePath(tmpDir / "out", source);
+
+    StringSink nar;
+    PosixSourceAccessor::createAtRoot((tmpDir / "out").string()).dumpPath(nar);
+    ASSERT_EQ(expected.s, nar.s);
+}
+
+TEST(dumpPathReadAhead, singleChild)
+{
+    using File = MemorySourceAccessor::File;
+
+    /* Directories with a single child schedule a single item at a
+       time, which must still be fetched. */
+    auto files = make_ref<MemorySourceAccessor>();
+    files->root = File::Directory{
+        .entries{{"a", File::Directory{.entries{{"b", File::Regular{.contents = "hello"}}}}}},
+    };
+
+    StringSink expected;
+    files->dumpPath(CanonPath::root, expected);
+
+    StringSink actual;
+    dumpPathReadAhead(*files, CanonPath::root, actual);
+    ASSERT_EQ(expected.s, actual.s);
+
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir, true);
+
+    StringSource source(expected.s);
+    restorePath(tmpDir / "out", source);
+
+    StringSink nar;
+    PosixSourceAccessor::createAtRoot((tmpDir / "out").string()).dumpPath(nar);
+    ASSERT_EQ(expected.s, nar.s);
+}
+
 } // namespace nix
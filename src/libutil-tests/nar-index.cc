@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+
+#include "nix/util/nar-index.hh"
+#include "nix/util/memory-source-accessor.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/serialise.hh"
+
+namespace nix {
+
+namespace memory_source_accessor {
+
+extern ref<MemorySourceAccessor> exampleComplex();
+
+}
+
+class NarIndexTest : public ::testing::Test
+{
+protected:
+
+    std::string nar;
+    ref<SourceAccessor> narAccessor = makeEmptySourceAccessor();
+
+    void SetUp() override
+    {
+        StringSink sink;
+        memory_source_accessor::exampleComplex()->dumpPath(CanonPath::root, sink);
+        nar = std::move(sink.s);
+        narAccessor = makeNarAccessor(std::string(nar));
+    }
+
+    GetNarBytes getNarBytes()
+    {
+        return [this](uint64_t offset, uint64_t length) { return nar.substr(offset, length); };
+    }
+};
+
+TEST_F(NarIndexTest, roundTrip)
+{
+    auto accessor = makeIndexedNarAccessor(makeNarIndex(*narAccessor), getNarBytes());
+
+    ASSERT_EQ(listNarDeep(*accessor, CanonPath::root), listNarDeep(*narAccessor, CanonPath::root));
+
+    ASSERT_EQ(accessor->readFile(CanonPath("/foo")), narAccessor->readFile(CanonPath("/foo")));
+    ASSERT_EQ(accessor->readFile(CanonPath("/bar/baz")), narAccessor->readFile(CanonPath("/bar/baz")));
+    ASSERT_EQ(accessor->readLink(CanonPath("/bar/quux")), "/over/there");
+    ASSERT_TRUE(accessor->lstat(CanonPath("/bar/baz")).isExecutable);
+
+    ASSERT_FALSE(accessor->maybeLstat(CanonPath("/bar/nope")));
+    ASSERT_FALSE(accessor->maybeLstat(CanonPath("/foo/bar")));
+    ASSERT_THROW(accessor->readDirectory(CanonPath("/foo")), Error);
+    ASSERT_THROW(accessor->readFile(CanonPath("/bar")), Error);
+}
+
+TEST_F(NarIndexTest, componentOrder)
+{
+    /* 'a-b' sorts before 'a/b' bytewise, but after the 'a' directory
+       component-wise. */
+    auto files = make_ref<MemorySourceAccessor>();
+    files->root = MemorySourceAccessor::File::Directory{
+        .entries{
+            {"a", MemorySourceAccessor::File::Directory{.entries{{"b", MemorySourceAccessor::File::Regular{}}}}},
+            {"a-b", MemorySourceAccessor::File::Regular{.contents = "x"}},
+        },
+    };
+    StringSink sink;
+    files->dumpPath(CanonPath::root, sink);
+    nar = std::move(sink.s);
+
+    auto accessor = makeIndexedNarAccessor(makeNarIndex(*makeNarAccessor(std::string(nar))), getNarBytes());
+
+    ASSERT_EQ(accessor->readDirectory(CanonPath::root).size(), 2u);
+    ASSERT_EQ(accessor->readDirectory(CanonPath("/a")).size(), 1u);
+    ASSERT_EQ(accessor->readFile(CanonPath("/a-b")), "x");
+    ASSERT_EQ(accessor->readFile(CanonPath("/a/b")), "");
+}
+
+TEST_F(NarIndexTest, mmap)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir, true);
+
+    auto indexPath = (tmpDir / "index").string();
+    writeFile(indexPath, makeNarIndex(*narAccessor));
+
+    auto accessor = openIndexedNarAccessor(indexPath, getNarBytes());
+    ASSERT_EQ(listNarDeep(*accessor, CanonPath::root), listNarDeep(*narAccessor, CanonPath::root));
+}
+
+TEST_F(NarIndexTest, rejectsCorrupt)
+{
+    auto index = makeNarIndex(*narAccessor);
+
+    ASSERT_THROW(makeIndexedNarAccessor(index.substr(0, index.size() - 1), getNarBytes()), Error);
+    ASSERT_THROW(makeIndexedNarAccessor(std::string(index.size(), 0), getNarBytes()), Error);
+    ASSERT_THROW(makeIndexedNarAccessor(std::string(), getNarBytes()), Error);
+}
+
+} // namespace nix
@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "nix/util/pos-table.hh"
+
+namespace nix {
+
+static Pos::Origin makeString(std::string s)
+{
+    return Pos::String{make_ref<std::string>(s)};
+}
+
+TEST(PosTable, lookup)
+{
+    PosTable positions;
+
+    /* Enough origins to need several segments. */
+    std::vector<PosTable::Origin> origins;
+    for (size_t i = 0; i < 1000; ++i)
+        origins.push_back(positions.addOrigin(makeString(fmt("%d\nab\n", i)), fmt("%d\nab\n", i).size()));
+
+    for (size_t i = 0; i < origins.size(); ++i) {
+        auto digits = fmt("%d", i).size();
+        auto pos = positions[positions.add(origins[i], digits + 2)];
+        ASSERT_EQ(pos.line, 2u);
+        ASSERT_EQ(pos.column, 2u);
+        ASSERT_EQ(pos.origin, origins[i].origin);
+        ASSERT_EQ(positions.originOf(positions.add(origins[i], 0)), origins[i].origin);
+    }
+
+    ASSERT_EQ(positions[PosIdx()].line, 0u);
+}
+
+TEST(PosTable, addLines)
+{
+    PosTable positions;
+
+    /* The precomputed lines are used instead of the source. */
+    auto origin = positions.addOrigin(makeString("a\nb\nc"), 5);
+    positions.addLines(origin, {0, 1, 2, 3, 4});
+
+    auto pos = positions[positions.add(origin, 4)];
+    ASSERT_EQ(pos.line, 5u);
+    ASSERT_EQ(pos.column, 1u);
+}
+
+TEST(PosTable, concurrentLookups)
+{
+    PosTable positions;
+
+    std::vector<PosTable::Origin> origins;
+    for (size_t i = 0; i < 100; ++i)
+        origins.push_back(positions.addOrigin(makeString("x\ny\nz"), 5));
+
+    std::vector<std::thread> threads;
+    std::atomic<size_t> failures{0};
+    for (size_t t = 0; t < 8; ++t)
+        threads.emplace_back([&]() {
+            for (auto & origin : origins) {
+                auto pos = positions[positions.add(origin, 4)];
+                if (pos.line != 3 || pos.column != 1)
+                    failures++;
+            }
+        });
+
+    /* Origins can be added while other threads look up positions. */
+    for (size_t i = 0; i < 1000; ++i)
+        positions.addOrigin(makeString("w"), 1);
+
+    for (auto & thread : threads)
+        thread.join();
+
+    ASSERT_EQ(failures.load(), 0u);
+}
+
+} // namespace nix
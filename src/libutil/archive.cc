@@ -2,6 +2,9 @@
 #include <algorithm>
 #include <vector>
 #include <map>
+#include <deque>
+#include <thread>
+#include <unordered_map>
 
 #include <strings.h> // for strcasecmp
 
@@ -12,6 +15,7 @@
 #include "nix/util/source-path.hh"
 #include "nix/util/file-system.hh"
 #include "nix/util/signals.hh"
+#include "nix/util/sync.hh"
 
 namespace nix {
 
@@ -34,12 +38,214 @@ static GlobalConfig::Register rArchiveSettings(&archiveSettings);
 
 PathFilter defaultPathFilter = [](const Path &) { return true; };
 
-void SourceAccessor::dumpPath(const CanonPath & path, Sink & sink, PathFilter & filter)
+namespace {
+
+/**
+ * Prefetches directory listings and the contents of small regular
+ * files on a set of worker threads, ahead of a depth-first traversal
+ * that consumes them in NAR order. This hides the latency of `open()`,
+ * `read()` and `readdir()` when dumping large trees, while the NAR
+ * itself is still produced sequentially.
+ */
+struct NarReadAhead
+{
+    /**
+     * Regular files larger than this are not prefetched but streamed
+     * by the traversal itself, to bound memory usage.
+     */
+    static constexpr uint64_t maxFileSize = 128 * 1024;
+
+    /**
+     * The maximum number of prefetched items that have not been
+     * consumed yet.
+     */
+    static constexpr size_t window = 512;
+
+    /**
+     * The maximum number of threads. Prefetching is I/O-bound, so
+     * this doesn't depend on the number of cores.
+     */
+    static constexpr size_t maxThreads = 8;
+
+    struct Item
+    {
+        CanonPath path;
+        SourceAccessor::Type type;
+    };
+
+    struct Slot
+    {
+        bool done = false;
+        std::optional<std::string> contents;
+        std::optional<SourceAccessor::DirEntries> entries;
+    };
+
+    struct State
+    {
+        /**
+         * Items that have not been scheduled yet, in traversal order.
+         */
+        std::deque<Item> backlog;
+
+        /**
+         * Items that have been scheduled but not picked up by a worker
+         * yet.
+         */
+        std::deque<Item> queue;
+
+        /**
+         * Items that have been scheduled but not consumed yet.
+         */
+        std::unordered_map<CanonPath, Slot> slots;
+
+        bool quit = false;
+    };
+
+    SourceAccessor & accessor;
+
+    Sync<State> state_;
+
+    /**
+     * Signalled when an item has been fetched.
+     */
+    std::condition_variable wakeup;
+
+    /**
+     * Signalled when there is work for the workers, or when they
+     * should quit.
+     */
+    std::condition_variable work;
+
+    /**
+     * The worker threads. Only accessed by the traversal.
+     */
+    std::vector<std::thread> workers;
+
+    NarReadAhead(SourceAccessor & accessor)
+        : accessor(accessor)
+    {
+    }
+
+    ~NarReadAhead()
+    {
+        state_.lock()->quit = true;
+        work.notify_all();
+        for (auto & thread : workers)
+            thread.join();
+    }
+
+    /**
+     * Schedule the children of a directory that the traversal is about
+     * to descend into. They come before everything else that is still
+     * in the backlog.
+     */
+    void schedule(std::vector<Item> && items)
+    {
+        if (items.empty())
+            return;
+        auto state(state_.lock());
+        state->backlog.insert(
+            state->backlog.begin(), std::make_move_iterator(items.begin()), std::make_move_iterator(items.end()));
+        fill(*state);
+    }
+
+    void fill(State & state)
+    {
+        auto added = false;
+        while (state.slots.size() < window && !state.backlog.empty()) {
+            auto item = std::move(state.backlog.front());
+            state.backlog.pop_front();
+            state.slots.emplace(item.path, Slot{});
+            state.queue.push_back(std::move(item));
+            added = true;
+        }
+        if (!added)
+            return;
+        /* Start a thread for every queued item, up to `maxThreads`,
+           so that even a single item is fetched right away. */
+        while (workers.size() < std::min(maxThreads, state.queue.size()))
+            workers.emplace_back(&NarReadAhead::worker, this);
+        work.notify_all();
+    }
+
+    void worker()
+    {
+        while (true) {
+            std::optional<Item> item;
+            {
+                auto state(state_.lock());
+                while (!state->quit && state->queue.empty())
+                    state.wait(work);
+                if (state->quit)
+                    return;
+                item = std::move(state->queue.front());
+                state->queue.pop_front();
+            }
+            fetch(*item);
+        }
+    }
+
+    void fetch(const Item & item)
+    {
+        Slot slot;
+
+        /* Errors are ignored here; the traversal will redo the
+           operation and get the same error in the right place. */
+        try {
+            if (item.type == SourceAccessor::tDirectory)
+                slot.entries = accessor.readDirectory(item.path);
+            else {
+                auto st = accessor.lstat(item.path);
+                if (st.type == SourceAccessor::tRegular && st.fileSize && *st.fileSize <= maxFileSize)
+                    slot.contents = accessor.readFile(item.path);
+            }
+        } catch (...) {
+        }
+
+        slot.done = true;
+
+        auto state(state_.lock());
+        state->slots.insert_or_assign(item.path, std::move(slot));
+        wakeup.notify_all();
+    }
+
+    /**
+     * Wait for the prefetched data for `path`, if any.
+     */
+    Slot take(const CanonPath & path)
+    {
+        auto state(state_.lock());
+
+        auto i = state->slots.find(path);
+        if (i == state->slots.end()) {
+            /* The item was never scheduled, or it is still in the
+               backlog. Since items are consumed in traversal order,
+               it's then at the front of the backlog. */
+            if (!state->backlog.empty() && state->backlog.front().path == path)
+                state->backlog.pop_front();
+            return {};
+        }
+
+        while (!i->second.done) {
+            state.wait(wakeup);
+            i = state->slots.find(path);
+            assert(i != state->slots.end());
+        }
+
+        auto slot = std::move(i->second);
+        state->slots.erase(i);
+        fill(*state);
+        return slot;
+    }
+};
+
+void dumpPathImpl(
+    SourceAccessor & accessor, const CanonPath & path, Sink & sink, PathFilter & filter, NarReadAhead * readAhead)
 {
     auto dumpContents = [&](const CanonPath & path) {
         sink << "contents";
         std::optional<uint64_t> size;
-        readFile(path, sink, [&](uint64_t _size) {
+        accessor.readFile(path, sink, [&](uint64_t _size) {
             size = _size;
             sink << _size;
         });
@@ -49,27 +255,39 @@ void SourceAccessor::dumpPath(const CanonPath & path, Sink & sink, PathFilter &
 
     sink << narVersionMagic1;
 
-    [&, &this_(*this)](this const auto & dump, const CanonPath & path) -> void {
+    [&](this const auto & dump, const CanonPath & path) -> void {
         checkInterrupt();
 
-        auto st = this_.lstat(path);
+        auto st = accessor.lstat(path);
 
         sink << "(";
 
-        if (st.type == tRegular) {
+        if (st.type == SourceAccessor::tRegular) {
             sink << "type" << "regular";
             if (st.isExecutable)
                 sink << "executable" << "";
-            dumpContents(path);
+            std::optional<std::string> contents;
+            if (readAhead)
+                contents = readAhead->take(path).contents;
+            if (contents)
+                sink << "contents" << *contents;
+            else
+                dumpContents(path);
         }
 
-        else if (st.type == tDirectory) {
+        else if (st.type == SourceAccessor::tDirectory) {
             sink << "type" << "directory";
 
+            std::optional<SourceAccessor::DirEntries> entries;
+            if (readAhead)
+                entries = readAhead->take(path).entries;
+            if (!entries)
+                entries = accessor.readDirectory(path);
+
             /* If we're on a case-insensitive system like macOS, undo
                the case hack applied by restorePath(). */
             StringMap unhacked;
-            for (auto & i : this_.readDirectory(path))
+            for (auto & i : *entries)
                 if (archiveSettings.useCaseHack) {
                     std::string name(i.first);
                     size_t pos = i.first.find(caseHackSuffix);
@@ -83,16 +301,30 @@ void SourceAccessor::dumpPath(const CanonPath & path, Sink & sink, PathFilter &
                 } else
                     unhacked.emplace(i.first, i.first);
 
+            std::vector<std::pair<std::string_view, CanonPath>> children;
             for (auto & i : unhacked)
-                if (filter((path / i.first).abs())) {
-                    sink << "entry" << "(" << "name" << i.first << "node";
-                    dump(path / i.second);
-                    sink << ")";
+                if (filter((path / i.first).abs()))
+                    children.emplace_back(i.first, path / i.second);
+
+            if (readAhead) {
+                std::vector<NarReadAhead::Item> items;
+                for (auto & [_, child] : children) {
+                    auto type = entries->at(std::string(child.baseName().value()));
+                    if (type == SourceAccessor::tRegular || type == SourceAccessor::tDirectory)
+                        items.push_back({child, *type});
                 }
+                readAhead->schedule(std::move(items));
+            }
+
+            for (auto & [name, child] : children) {
+                sink << "entry" << "(" << "name" << name << "node";
+                dump(child);
+                sink << ")";
+            }
         }
 
-        else if (st.type == tSymlink)
-            sink << "type" << "symlink" << "target" << this_.readLink(path);
+        else if (st.type == SourceAccessor::tSymlink)
+            sink << "type" << "symlink" << "target" << accessor.readLink(path);
 
         else
             throw Error("file '%s' has an unsupported type", path);
@@ -101,6 +333,19 @@ void SourceAccessor::dumpPath(const CanonPath & path, Sink & sink, PathFilter &
     }(path);
 }
 
+} // namespace
+
+void SourceAccessor::dumpPath(const CanonPath & path, Sink & sink, PathFilter & filter)
+{
+    dumpPathImpl(*this, path, sink, filter, nullptr);
+}
+
+void dumpPathReadAhead(SourceAccessor & accessor, const CanonPath & path, Sink & sink, PathFilter & filter)
+{
+    NarReadAhead readAhead(accessor);
+    dumpPathImpl(accessor, path, sink, filter, &readAhead);
+}
+
 time_t dumpPathAndGetMtime(const Path & path, Sink & sink, PathFilter & filter)
 {
     auto path2 = PosixSourceAccessor::createAtRoot(path, /*trackLastModified=*/true);
@@ -138,6 +383,23 @@ static void parseContents(CreateRegularFileSink & sink, Source & source)
     uint64_t left = size;
     std::array<char, 65536> buf;
 
+    /* If the NAR is read directly from a file, let the sink copy the
+       contents within the kernel rather than through our buffers.
+       This requires consuming whatever the source has buffered
+       first. */
+    if (auto fdSource = dynamic_cast<FdSource *>(&source); fdSource && fdSource->isSeekable) {
+        while (left && fdSource->BufferedSource::hasData()) {
+            auto n = source.read(buf.data(), std::min<uint64_t>(left, buf.size()));
+            sink({buf.data(), n});
+            left -= n;
+        }
+        if (left) {
+            auto copied = sink.copyFromFd(fdSource->fd, left);
+            fdSource->read += copied;
+            left -= copied;
+        }
+    }
+
     while (left) {
         checkInterrupt();
         auto n = buf.size();
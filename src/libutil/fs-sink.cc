@@ -3,6 +3,7 @@
 #include "nix/util/error.hh"
 #include "nix/util/config-global.hh"
 #include "nix/util/fs-sink.hh"
+#include "nix/util/signals.hh"
 
 #ifdef _WIN32
 #  include <fileapi.h>
@@ -84,6 +85,8 @@ void RestoreSink::createDirectory(const CanonPath & path, DirectoryCreatedCallba
 
     RestoreSink dirSink{startFsync};
     dirSink.dstPath = append(dstPath, path);
+    dirSink.findLinkTarget = findLinkTarget;
+    dirSink.maxBufferedFileSize = maxBufferedFileSize;
     dirSink.dirFd =
         unix::openFileEnsureBeneathNoSymlinks(dirFd.get(), path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
 
@@ -132,6 +135,14 @@ struct RestoreRegularFile : CreateRegularFileSink
     AutoCloseFD fd;
     bool startFsync = false;
 
+    /**
+     * If nonzero, the contents of files of at most this size are
+     * buffered in `contents` rather than written to `fd`.
+     */
+    uint64_t maxBufferedSize = 0;
+    std::optional<std::string> contents;
+    bool executable = false;
+
     ~RestoreRegularFile()
     {
         /* Initiate an fsync operation without waiting for the
@@ -145,8 +156,39 @@ struct RestoreRegularFile : CreateRegularFileSink
     void operator()(std::string_view data) override;
     void isExecutable() override;
     void preallocateContents(uint64_t size) override;
+    uint64_t copyFromFd(Descriptor fd, uint64_t size) override;
 };
 
+#ifndef _WIN32
+/**
+ * Atomically replace the file `name` in the directory `dirFd` by a hard
+ * link to `target`. Return false if the link cannot be created, e.g.
+ * because `target` has disappeared or has too many links already.
+ */
+static bool replaceByLink(int dirFd, const std::string & name, const std::filesystem::path & target)
+{
+    /* Only files directly in `dirFd` can be replaced without following
+       intermediate symlinks. */
+    if (dirFd != AT_FDCWD && name.find('/') != std::string::npos)
+        return false;
+
+    auto tmpName = name + ".tmp-link";
+
+    if (::linkat(AT_FDCWD, target.c_str(), dirFd, tmpName.c_str(), 0) == -1) {
+        debug("cannot link '%s' to '%s': %s", name, target.string(), strerror(errno));
+        return false;
+    }
+
+    if (::renameat(dirFd, tmpName.c_str(), dirFd, name.c_str()) == -1) {
+        auto savedErrno = errno;
+        ::unlinkat(dirFd, tmpName.c_str(), 0);
+        throw SysError(savedErrno, "replacing '%s' by a hard link", name);
+    }
+
+    return true;
+}
+#endif
+
 void RestoreSink::createRegularFile(const CanonPath & path, std::function<void(CreateRegularFileSink &)> func)
 {
     auto p = append(dstPath, path);
@@ -176,11 +218,30 @@ void RestoreSink::createRegularFile(const CanonPath & path, std::function<void(C
         ;
     if (!crf.fd)
         throw NativeSysError("creating file '%1%'", p);
+#ifndef _WIN32
+    if (findLinkTarget)
+        crf.maxBufferedSize = maxBufferedFileSize;
+#endif
     func(crf);
+
+#ifndef _WIN32
+    if (crf.contents) {
+        auto target = findLinkTarget(p, *crf.contents, crf.executable);
+        auto linked = target
+                      && (dirFd ? replaceByLink(dirFd.get(), std::string(path.rel()), *target)
+                                : replaceByLink(AT_FDCWD, p.string(), *target));
+        if (linked) {
+            crf.fd.close();
+            return;
+        }
+        writeFull(crf.fd.get(), *crf.contents);
+    }
+#endif
 }
 
 void RestoreRegularFile::isExecutable()
 {
+    executable = true;
     // Windows doesn't have a notion of executable file permissions we
     // care about here, right?
 #ifndef _WIN32
@@ -194,6 +255,12 @@ void RestoreRegularFile::isExecutable()
 
 void RestoreRegularFile::preallocateContents(uint64_t len)
 {
+    if (maxBufferedSize && len <= maxBufferedSize) {
+        contents.emplace();
+        contents->reserve(len);
+        return;
+    }
+
     if (!restoreSinkSettings.preallocateContents)
         return;
 
@@ -212,7 +279,41 @@ void RestoreRegularFile::preallocateContents(uint64_t len)
 
 void RestoreRegularFile::operator()(std::string_view data)
 {
-    writeFull(fd.get(), data);
+    if (contents)
+        contents->append(data);
+    else
+        writeFull(fd.get(), data);
+}
+
+uint64_t RestoreRegularFile::copyFromFd(Descriptor srcFd, uint64_t size)
+{
+    if (contents)
+        return 0;
+
+#if HAVE_COPY_FILE_RANGE
+    uint64_t copied = 0;
+    while (copied < size) {
+        checkInterrupt();
+        auto n = ::copy_file_range(srcFd, nullptr, fd.get(), nullptr, size - copied, 0);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            /* Not supported between these files (e.g. the source
+               is a pipe or on a different file system on older
+               kernels); let the caller copy the rest. */
+            if (copied || errno == EINVAL || errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP
+                || errno == EBADF)
+                break;
+            throw SysError("copying file contents");
+        }
+        if (n == 0)
+            break;
+        copied += n;
+    }
+    return copied;
+#else
+    return 0;
+#endif
 }
 
 void RestoreSink::createSymlink(const CanonPath & path, const std::string & target)
@@ -57,6 +57,15 @@ namespace nix {
  */
 void dumpPath(const Path & path, Sink & sink, PathFilter & filter = defaultPathFilter);
 
+/**
+ * Like `SourceAccessor::dumpPath()`, but reads directory listings and
+ * small files ahead of the traversal on worker threads. The resulting
+ * NAR is identical. `accessor` must be safe to use from multiple
+ * threads.
+ */
+void dumpPathReadAhead(
+    SourceAccessor & accessor, const CanonPath & path, Sink & sink, PathFilter & filter = defaultPathFilter);
+
 /**
  * Same as dumpPath(), but returns the last modified date of the path.
  */
@@ -74,6 +74,13 @@ std::string readFile(Descriptor fd);
  */
 void readFull(Descriptor fd, char * buf, size_t count);
 
+/**
+ * Like `readFull()`, but read at the given offset without using or
+ * changing the file position, so it is safe to call concurrently on
+ * the same descriptor.
+ */
+void readFullAt(Descriptor fd, char * buf, size_t count, uint64_t offset);
+
 void writeFull(Descriptor fd, std::string_view s, bool allowInterrupts = true);
 
 /**
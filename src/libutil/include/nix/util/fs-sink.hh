@@ -28,6 +28,22 @@ struct CreateRegularFileSink : virtual Sink
      * An optimization. By default, do nothing.
      */
     virtual void preallocateContents(uint64_t size) {};
+
+    /**
+     * An optimization: append `size` bytes read from the current
+     * position of the regular file `fd` to the file, advancing that
+     * position, without passing them through userspace (e.g. using
+     * `copy_file_range()`, which also lets file systems that support
+     * it share the extents).
+     *
+     * @return The number of bytes copied. This may be less than `size`
+     * (in particular 0 if this is not supported by the sink or the file
+     * systems involved); the caller must pass the rest as usual.
+     */
+    virtual uint64_t copyFromFd(Descriptor fd, uint64_t size)
+    {
+        return 0;
+    }
 };
 
 struct FileSystemObjectSink
@@ -113,6 +129,22 @@ struct RestoreSink : FileSystemObjectSink
 #endif
     bool startFsync = false;
 
+    /**
+     * Called with the full path, contents and executable bit of
+     * regular files of at most `maxBufferedFileSize` bytes, which are
+     * buffered in memory for this purpose. If it returns a path, the
+     * file is created as a hard link to that path rather than written,
+     * e.g. to deduplicate against a store of known file contents. If
+     * linking fails, the file is written as usual.
+     *
+     * @note Only supported on Unix.
+     */
+    std::function<std::optional<std::filesystem::path>(
+        const std::filesystem::path & path, std::string_view contents, bool isExecutable)>
+        findLinkTarget;
+
+    uint64_t maxBufferedFileSize = 0;
+
     explicit RestoreSink(bool startFsync)
         : startFsync{startFsync}
     {
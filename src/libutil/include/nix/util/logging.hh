@@ -263,7 +263,76 @@ struct PushActivity
     }
 };
 
-extern std::unique_ptr<Logger> logger;
+/**
+ * The process-wide logger. A thread can send its own log messages to a
+ * different logger using `PushThreadLogger`; `get()`, `->` and `*`
+ * return that logger on such threads.
+ */
+class GlobalLogger
+{
+    std::unique_ptr<Logger> logger;
+
+public:
+
+    explicit GlobalLogger(std::unique_ptr<Logger> logger)
+        : logger(std::move(logger))
+    {
+    }
+
+    GlobalLogger(const GlobalLogger &) = delete;
+
+    GlobalLogger & operator=(std::unique_ptr<Logger> && newLogger)
+    {
+        logger = std::move(newLogger);
+        return *this;
+    }
+
+    /**
+     * Take ownership of the process-wide logger.
+     */
+    operator std::unique_ptr<Logger>() &&
+    {
+        return std::move(logger);
+    }
+
+    /**
+     * Give up ownership of the process-wide logger without destroying it.
+     */
+    Logger * release()
+    {
+        return logger.release();
+    }
+
+    /**
+     * The logger to use on the current thread.
+     */
+    Logger * get() const;
+
+    Logger * operator->() const
+    {
+        return get();
+    }
+
+    Logger & operator*() const
+    {
+        return *get();
+    }
+};
+
+extern GlobalLogger logger;
+
+/**
+ * Send the log messages of the current thread to `logger` until this
+ * object is destroyed.
+ */
+struct PushThreadLogger
+{
+    Logger * const prevLogger;
+
+    PushThreadLogger(Logger & logger);
+
+    ~PushThreadLogger();
+};
 
 std::unique_ptr<Logger> makeSimpleLogger(bool printBuildLogs = true);
 
@@ -0,0 +1,39 @@
+#pragma once
+///@file
+
+#include "nix/util/nar-accessor.hh"
+
+namespace nix {
+
+/**
+ * Serialise the listing of a NAR into a compact binary index that can
+ * be memory-mapped by `openIndexedNarAccessor()`. `accessor` must be a
+ * NAR accessor, i.e. it must return `narOffset` for regular files.
+ *
+ * The index consists of a header, a table of fixed-size entries (one
+ * per file system object, sorted by path component-wise so that every
+ * directory is immediately followed by its descendants) and a string
+ * table holding the paths and symlink targets. It is in host byte
+ * order; it is meant as a local cache and is rejected on a host with
+ * a different byte order.
+ */
+std::string makeNarIndex(SourceAccessor & accessor);
+
+/**
+ * Return an accessor for the NAR described by the index in
+ * `indexPath`. The index is memory-mapped and looked up by binary
+ * search, so no part of the listing needs to be parsed or
+ * materialised. `getNarBytes` is used to read the contents of regular
+ * files.
+ *
+ * Throws an `Error` if the file is not a valid NAR index.
+ */
+ref<SourceAccessor> openIndexedNarAccessor(const Path & indexPath, GetNarBytes getNarBytes);
+
+/**
+ * Like `openIndexedNarAccessor()`, but using an in-memory copy of the
+ * index.
+ */
+ref<SourceAccessor> makeIndexedNarAccessor(std::string && index, GetNarBytes getNarBytes);
+
+} // namespace nix
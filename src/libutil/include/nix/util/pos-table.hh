@@ -1,10 +1,12 @@
 #pragma once
 ///@file
 
+#include <array>
+#include <atomic>
 #include <cstdint>
+#include <optional>
 #include <vector>
 
-#include "nix/util/lru-cache.hh"
 #include "nix/util/pos-idx.hh"
 #include "nix/util/position.hh"
 #include "nix/util/sync.hh"
@@ -37,63 +39,70 @@ public:
         }
     };
 
-private:
     /**
      * Vector of byte offsets (in the virtual input buffer) of initial line character's position.
      * Sorted by construction. Binary search over it allows for efficient translation of arbitrary
      * byte offsets in the virtual input buffer to its line + column position.
      */
     using Lines = std::vector<uint32_t>;
+
     /**
-     * Cache from byte offset in the virtual buffer of Origins -> @ref Lines in that origin.
+     * Compute the @ref Lines of `content`.
      */
-    using LinesCache = LRUCache<uint32_t, Lines>;
+    static Lines computeLines(std::string_view content);
 
-    mutable Sync<LinesCache> linesCache;
+private:
+    /**
+     * An origin and its @ref Lines. The lines are computed when first
+     * needed and never change after that, so they can be read without
+     * a lock.
+     */
+    struct Slot
+    {
+        std::optional<Origin> origin;
+        mutable std::atomic<const Lines *> lines{nullptr};
+    };
+
+    /**
+     * The origins, sorted by offset. Origins are only ever appended, in
+     * segments that are never moved or freed (except by `clear()`), so
+     * lookups don't need a lock. Segment `i` holds `firstSegmentSize <<
+     * i` origins.
+     */
+    static constexpr size_t firstSegmentSize = 64;
+
+    std::array<std::atomic<Slot *>, 32> segments{};
+
+    /**
+     * The number of origins that have been published.
+     */
+    std::atomic<size_t> nrOrigins{0};
 
-    // FIXME: this could be made lock-free (at least for access) if we
-    // have a data structure where pointers to existing positions are
-    // never invalidated.
     struct State
     {
-        std::map<uint32_t, Origin> origins;
+        /**
+         * The offset of the next origin.
+         */
+        uint32_t end = 0;
     };
 
-    SharedSync<State> state_;
+    /**
+     * Serialises adding and removing origins.
+     */
+    Sync<State> state_;
+
+    Slot & slot(size_t i) const;
 
-    const Origin * resolve(PosIdx p) const
-    {
-        if (p.id == 0)
-            return nullptr;
-
-        auto state(state_.readLock());
-        const auto idx = p.id - 1;
-        /* We want the last key <= idx, so we'll take prev(first key >
-           idx). This is guaranteed to never rewind origin.begin
-           because the first key is always 0. */
-        const auto pastOrigin = state->origins.upper_bound(idx);
-        return &std::prev(pastOrigin)->second;
-    }
+    const Slot * resolve(PosIdx p) const;
+
+    static const Lines * publishLines(const Slot & slot, Lines && lines);
 
 public:
-    PosTable(std::size_t linesCacheCapacity = 65536)
-        : linesCache(linesCacheCapacity)
-    {
-    }
+    PosTable() = default;
 
-    Origin addOrigin(Pos::Origin origin, size_t size)
-    {
-        auto state(state_.lock());
-        uint32_t offset = 0;
-        if (auto it = state->origins.rbegin(); it != state->origins.rend())
-            offset = it->first + it->second.size;
-        // +1 because all PosIdx are offset by 1 to begin with, and
-        // another +1 to ensure that all origins can point to EOF, eg
-        // on (invalid) empty inputs.
-        if (2 + offset + size < offset)
-            return Origin{origin, offset, 0};
-        return state->origins.emplace(offset, Origin{origin, offset, size}).first->second;
-    }
+    ~PosTable();
+
+    Origin addOrigin(Pos::Origin origin, size_t size);
 
     PosIdx add(const Origin & origin, size_t offset)
     {
@@ -115,22 +124,25 @@ public:
      */
     Pos operator[](PosIdx p) const;
 
+    /**
+     * Seed the line cache for `origin` with previously computed
+     * `lines`, so that looking up positions in it doesn't have to
+     * read its source.
+     */
+    void addLines(const Origin & origin, Lines lines);
+
     Pos::Origin originOf(PosIdx p) const
     {
-        if (auto o = resolve(p))
-            return o->origin;
+        if (auto slot = resolve(p))
+            return slot->origin->origin;
         return std::monostate{};
     }
 
     /**
-     * Remove all origins from the table.
+     * Remove all origins from the table. This must not be called
+     * while other threads may be looking up positions.
      */
-    void clear()
-    {
-        auto lines = linesCache.lock();
-        lines->clear();
-        state_.lock()->origins.clear();
-    }
+    void clear();
 };
 
 } // namespace nix
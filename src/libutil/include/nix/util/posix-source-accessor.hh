@@ -2,6 +2,8 @@
 
 #include "nix/util/source-accessor.hh"
 
+#include <atomic>
+
 namespace nix {
 
 struct SourcePath;
@@ -29,7 +31,7 @@ public:
      * The most recent mtime seen by lstat(). This is a hack to
      * support dumpPathAndGetMtime(). Should remove this eventually.
      */
-    time_t mtime = 0;
+    std::atomic<time_t> mtime = 0;
 
     void readFile(const CanonPath & path, Sink & sink, std::function<void(uint64_t)> sizeCallback) override;
 
@@ -43,12 +45,17 @@ public:
 
     std::optional<std::filesystem::path> getPhysicalPath(const CanonPath & path) override;
 
+    /**
+     * Dump using `dumpPathReadAhead()`, since this accessor can be
+     * used from multiple threads.
+     */
+    void dumpPath(const CanonPath & path, Sink & sink, PathFilter & filter = defaultPathFilter) override;
+
     /**
      * Create a `PosixSourceAccessor` and `SourcePath` corresponding to
      * some native path.
      *
      * @param Whether the accessor should return a non-null getLastModified.
-     * When true the accessor must be used only by a single thread.
      *
      * The `PosixSourceAccessor` is rooted as far up the tree as
      * possible, (e.g. on Windows it could scoped to a drive like
@@ -75,7 +82,7 @@ public:
 
     std::optional<std::time_t> getLastModified() override
     {
-        return trackLastModified ? std::optional{mtime} : std::nullopt;
+        return trackLastModified ? std::optional{mtime.load()} : std::nullopt;
     }
 
     void invalidateCache(const CanonPath & path) override;
@@ -73,6 +73,28 @@ CgroupStats getCgroupStats(const std::filesystem::path & cgroup)
         }
     }
 
+    auto memoryPeakPath = cgroup / "memory.peak";
+
+    if (pathExists(memoryPeakPath))
+        stats.memoryPeak = string2Int<uint64_t>(trim(readFile(memoryPeakPath)));
+
+    auto iostatPath = cgroup / "io.stat";
+
+    if (pathExists(iostatPath)) {
+        /* Each line has the form "MAJ:MIN rbytes=N wbytes=N rios=N ...". */
+        uint64_t readBytes = 0, writeBytes = 0;
+        for (auto & line : tokenizeString<std::vector<std::string>>(readFile(iostatPath), "\n")) {
+            for (auto & field : tokenizeString<std::vector<std::string>>(line, " ")) {
+                if (hasPrefix(field, "rbytes="))
+                    readBytes += string2Int<uint64_t>(field.substr(7)).value_or(0);
+                else if (hasPrefix(field, "wbytes="))
+                    writeBytes += string2Int<uint64_t>(field.substr(7)).value_or(0);
+            }
+        }
+        stats.ioReadBytes = readBytes;
+        stats.ioWriteBytes = writeBytes;
+    }
+
     return stats;
 }
 
@@ -16,6 +16,17 @@ StringMap getCgroups(const Path & cgroupFile);
 struct CgroupStats
 {
     std::optional<std::chrono::microseconds> cpuUser, cpuSystem;
+
+    /**
+     * Peak memory usage in bytes (`memory.peak`).
+     */
+    std::optional<uint64_t> memoryPeak;
+
+    /**
+     * Bytes read from and written to block devices, summed over all
+     * devices (`io.stat`).
+     */
+    std::optional<uint64_t> ioReadBytes, ioWriteBytes;
 };
 
 /**
@@ -32,7 +32,25 @@ void setCurActivity(const ActivityId activityId)
     curActivity = activityId;
 }
 
-std::unique_ptr<Logger> logger = makeSimpleLogger(true);
+GlobalLogger logger(makeSimpleLogger(true));
+
+static thread_local Logger * threadLogger = nullptr;
+
+Logger * GlobalLogger::get() const
+{
+    return threadLogger ? threadLogger : logger.get();
+}
+
+PushThreadLogger::PushThreadLogger(Logger & logger)
+    : prevLogger(threadLogger)
+{
+    threadLogger = &logger;
+}
+
+PushThreadLogger::~PushThreadLogger()
+{
+    threadLogger = prevLogger;
+}
 
 void Logger::warn(const std::string & msg)
 {
@@ -281,11 +281,8 @@ GetNarBytes seekableGetNarBytes(const Path & path)
 GetNarBytes seekableGetNarBytes(Descriptor fd)
 {
     return [fd](uint64_t offset, uint64_t length) {
-        if (::lseek(fromDescriptorReadOnly(fd), offset, SEEK_SET) == -1)
-            throw SysError("seeking in file");
-
         std::string buf(length, 0);
-        readFull(fd, buf.data(), length);
+        readFullAt(fd, buf.data(), length, offset);
 
         return buf;
     };
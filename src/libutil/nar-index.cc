@@ -0,0 +1,327 @@
+#include "nix/util/nar-index.hh"
+#include "nix/util/file-system.hh"
+
+#include <cstring>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+namespace nix {
+
+namespace {
+
+constexpr std::string_view narIndexMagic = "nixnidx1";
+
+struct NarIndexHeader
+{
+    char magic[8];
+    uint32_t byteOrder;
+    uint32_t entryCount;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+};
+
+static_assert(sizeof(NarIndexHeader) == 32);
+
+enum class NarIndexType : uint8_t {
+    Regular = 0,
+    Directory = 1,
+    Symlink = 2,
+};
+
+struct NarIndexEntry
+{
+    /* The path relative to the root of the NAR (without a leading
+       slash), as an offset and length in the string table. */
+    uint32_t pathOffset;
+    uint32_t pathLength;
+
+    /* One past the index of the last descendant of this entry. */
+    uint32_t end;
+
+    NarIndexType type;
+    uint8_t isExecutable;
+    uint16_t padding;
+
+    /* For regular files, the offset and size of the contents in the
+       NAR. For symlinks, the target as an offset and length in the
+       string table. */
+    uint64_t offset;
+    uint64_t size;
+};
+
+static_assert(sizeof(NarIndexEntry) == 32);
+
+/**
+ * Compare relative paths component-wise, i.e. as if '/' sorted before
+ * every other character. This is the order in which a depth-first
+ * traversal of a NAR visits its entries.
+ */
+int comparePaths(std::string_view a, std::string_view b)
+{
+    auto n = std::min(a.size(), b.size());
+    for (size_t i = 0; i < n; ++i) {
+        if (a[i] == b[i])
+            continue;
+        if (a[i] == '/')
+            return -1;
+        if (b[i] == '/')
+            return 1;
+        return (unsigned char) a[i] < (unsigned char) b[i] ? -1 : 1;
+    }
+    return a.size() < b.size() ? -1 : a.size() > b.size() ? 1 : 0;
+}
+
+uint32_t checkedU32(uint64_t n)
+{
+    if (n > std::numeric_limits<uint32_t>::max())
+        throw Error("NAR is too large to be indexed");
+    return n;
+}
+
+struct NarIndexWriter
+{
+    SourceAccessor & accessor;
+    std::vector<NarIndexEntry> entries;
+    std::string strings;
+
+    uint32_t addString(std::string_view s)
+    {
+        auto offset = checkedU32(strings.size());
+        strings.append(s);
+        return offset;
+    }
+
+    void add(const CanonPath & path)
+    {
+        auto st = accessor.lstat(path);
+        auto rel = path.rel();
+
+        auto index = entries.size();
+        entries.push_back(NarIndexEntry{
+            .pathOffset = addString(rel),
+            .pathLength = checkedU32(rel.size()),
+        });
+
+        switch (st.type) {
+        case SourceAccessor::Type::tRegular:
+            if (!st.fileSize || (!st.narOffset && *st.fileSize))
+                throw Error("cannot index '%s' because its NAR offset is unknown", path);
+            entries[index].type = NarIndexType::Regular;
+            entries[index].isExecutable = st.isExecutable;
+            entries[index].offset = st.narOffset.value_or(0);
+            entries[index].size = *st.fileSize;
+            break;
+        case SourceAccessor::Type::tDirectory:
+            entries[index].type = NarIndexType::Directory;
+            for (auto & [name, _] : accessor.readDirectory(path))
+                add(path / name);
+            break;
+        case SourceAccessor::Type::tSymlink: {
+            auto target = accessor.readLink(path);
+            entries[index].type = NarIndexType::Symlink;
+            entries[index].offset = addString(target);
+            entries[index].size = target.size();
+            break;
+        }
+        case SourceAccessor::Type::tBlock:
+        case SourceAccessor::Type::tChar:
+        case SourceAccessor::Type::tSocket:
+        case SourceAccessor::Type::tFifo:
+        case SourceAccessor::Type::tUnknown:
+            throw Error("file '%s' has an unsupported type", path);
+        }
+
+        entries[index].end = checkedU32(entries.size());
+    }
+};
+
+struct IndexedNarAccessor : SourceAccessor
+{
+    std::optional<boost::iostreams::mapped_file_source> mapping;
+    std::string buffer;
+    std::string_view data;
+
+    GetNarBytes getNarBytes;
+
+    NarIndexHeader header;
+
+    IndexedNarAccessor(const Path & indexPath, GetNarBytes getNarBytes)
+        : getNarBytes(std::move(getNarBytes))
+    {
+        try {
+            mapping.emplace(indexPath);
+        } catch (std::exception & e) {
+            throw Error("cannot memory-map NAR index '%s': %s", indexPath, e.what());
+        }
+        data = {mapping->data(), mapping->size()};
+        validate(indexPath);
+    }
+
+    IndexedNarAccessor(std::string && index, GetNarBytes getNarBytes)
+        : buffer(std::move(index))
+        , data(buffer)
+        , getNarBytes(std::move(getNarBytes))
+    {
+        validate("<memory>");
+    }
+
+    void validate(std::string_view name)
+    {
+        if (data.size() < sizeof(header))
+            throw Error("NAR index '%s' is truncated", name);
+        std::memcpy(&header, data.data(), sizeof(header));
+        if (std::string_view(header.magic, sizeof(header.magic)) != narIndexMagic)
+            throw Error("'%s' is not a NAR index", name);
+        if (header.byteOrder != 1)
+            throw Error("NAR index '%s' has the wrong byte order", name);
+        if (header.entryCount == 0
+            || header.stringsOffset != sizeof(header) + (uint64_t) header.entryCount * sizeof(NarIndexEntry)
+            || header.stringsOffset + header.stringsSize != data.size())
+            throw Error("NAR index '%s' is corrupt", name);
+    }
+
+    NarIndexEntry entry(uint32_t i) const
+    {
+        NarIndexEntry e;
+        std::memcpy(&e, data.data() + sizeof(header) + (size_t) i * sizeof(NarIndexEntry), sizeof(e));
+        return e;
+    }
+
+    std::string_view string(uint64_t offset, uint64_t length) const
+    {
+        if (offset + length > header.stringsSize)
+            throw Error("NAR index is corrupt");
+        return data.substr(header.stringsOffset + offset, length);
+    }
+
+    std::string_view pathOf(const NarIndexEntry & e) const
+    {
+        return string(e.pathOffset, e.pathLength);
+    }
+
+    /**
+     * Binary search for `path`, returning its index and entry.
+     */
+    std::optional<std::pair<uint32_t, NarIndexEntry>> find(const CanonPath & path) const
+    {
+        auto rel = path.rel();
+        uint32_t lo = 0, hi = header.entryCount;
+        while (lo < hi) {
+            auto mid = lo + (hi - lo) / 2;
+            auto e = entry(mid);
+            auto c = comparePaths(pathOf(e), rel);
+            if (c == 0)
+                return std::pair{mid, e};
+            if (c < 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return std::nullopt;
+    }
+
+    std::pair<uint32_t, NarIndexEntry> get(const CanonPath & path) const
+    {
+        auto res = find(path);
+        if (!res)
+            throw Error("NAR file does not contain path '%1%'", path);
+        return *res;
+    }
+
+    std::optional<Stat> maybeLstat(const CanonPath & path) override
+    {
+        auto res = find(path);
+        if (!res)
+            return std::nullopt;
+        auto & e = res->second;
+        switch (e.type) {
+        case NarIndexType::Regular:
+            return Stat{
+                .type = tRegular,
+                .fileSize = e.size,
+                .isExecutable = e.isExecutable != 0,
+                .narOffset = e.offset,
+            };
+        case NarIndexType::Directory:
+            return Stat{.type = tDirectory};
+        case NarIndexType::Symlink:
+            return Stat{.type = tSymlink};
+        }
+        throw Error("NAR index entry for '%s' has an invalid type", path);
+    }
+
+    DirEntries readDirectory(const CanonPath & path) override
+    {
+        auto [i, e] = get(path);
+
+        if (e.type != NarIndexType::Directory)
+            throw Error("path '%1%' inside NAR file is not a directory", path);
+
+        if (e.end > header.entryCount)
+            throw Error("NAR index is corrupt");
+
+        auto prefixLength = e.pathLength == 0 ? 0 : e.pathLength + 1;
+
+        DirEntries res;
+        for (auto j = i + 1; j < e.end;) {
+            auto child = entry(j);
+            if (child.end <= j)
+                throw Error("NAR index is corrupt");
+            res.insert_or_assign(std::string(pathOf(child).substr(prefixLength)), std::nullopt);
+            j = child.end;
+        }
+
+        return res;
+    }
+
+    std::string readFile(const CanonPath & path) override
+    {
+        auto [_, e] = get(path);
+        if (e.type != NarIndexType::Regular)
+            throw Error("path '%1%' inside NAR file is not a regular file", path);
+        return getNarBytes(e.offset, e.size);
+    }
+
+    std::string readLink(const CanonPath & path) override
+    {
+        auto [_, e] = get(path);
+        if (e.type != NarIndexType::Symlink)
+            throw Error("path '%1%' inside NAR file is not a symlink", path);
+        return std::string(string(e.offset, e.size));
+    }
+};
+
+} // namespace
+
+std::string makeNarIndex(SourceAccessor & accessor)
+{
+    NarIndexWriter writer{.accessor = accessor};
+    writer.add(CanonPath::root);
+
+    NarIndexHeader header{
+        .byteOrder = 1,
+        .entryCount = checkedU32(writer.entries.size()),
+        .stringsOffset = sizeof(NarIndexHeader) + writer.entries.size() * sizeof(NarIndexEntry),
+        .stringsSize = writer.strings.size(),
+    };
+    std::memcpy(header.magic, narIndexMagic.data(), sizeof(header.magic));
+
+    std::string res;
+    res.reserve(header.stringsOffset + header.stringsSize);
+    res.append((const char *) &header, sizeof(header));
+    res.append((const char *) writer.entries.data(), writer.entries.size() * sizeof(NarIndexEntry));
+    res.append(writer.strings);
+    return res;
+}
+
+ref<SourceAccessor> openIndexedNarAccessor(const Path & indexPath, GetNarBytes getNarBytes)
+{
+    return make_ref<IndexedNarAccessor>(indexPath, std::move(getNarBytes));
+}
+
+ref<SourceAccessor> makeIndexedNarAccessor(std::string && index, GetNarBytes getNarBytes)
+{
+    return make_ref<IndexedNarAccessor>(std::move(index), std::move(getNarBytes));
+}
+
+} // namespace nix
@@ -1,45 +1,120 @@
 #include "nix/util/pos-table.hh"
 
 #include <algorithm>
+#include <bit>
 
 namespace nix {
 
 /* Position table. */
 
-Pos PosTable::operator[](PosIdx p) const
+PosTable::Lines PosTable::computeLines(std::string_view content)
 {
-    auto origin = resolve(p);
-    if (!origin)
-        return {};
+    auto contentLines = Lines();
 
-    const auto offset = origin->offsetOf(p);
+    const char * begin = content.data();
+    for (Pos::LinesIterator it(content), end; it != end; it++)
+        contentLines.push_back(it->data() - begin);
+    if (contentLines.empty())
+        contentLines.push_back(0);
 
-    Pos result{0, 0, origin->origin};
-    auto linesCache = this->linesCache.lock();
+    return contentLines;
+}
 
-    /* Try the origin's line cache */
-    const auto * linesForInput = linesCache->getOrNullptr(origin->offset);
+PosTable::~PosTable()
+{
+    clear();
+}
 
-    auto fillCacheForOrigin = [](std::string_view content) {
-        auto contentLines = Lines();
+PosTable::Slot & PosTable::slot(size_t i) const
+{
+    auto segment = std::bit_width(i / firstSegmentSize + 1) - 1;
+    auto first = firstSegmentSize * ((size_t(1) << segment) - 1);
+    return segments[segment].load(std::memory_order_acquire)[i - first];
+}
 
-        const char * begin = content.data();
-        for (Pos::LinesIterator it(content), end; it != end; it++)
-            contentLines.push_back(it->data() - begin);
-        if (contentLines.empty())
-            contentLines.push_back(0);
+const PosTable::Slot * PosTable::resolve(PosIdx p) const
+{
+    if (p.id == 0)
+        return nullptr;
 
-        return contentLines;
-    };
+    const auto idx = p.id - 1;
 
-    /* Calculate line offsets and fill the cache */
-    if (!linesForInput) {
-        auto originContent = result.getSource().value_or("");
-        linesCache->upsert(origin->offset, fillCacheForOrigin(originContent));
-        linesForInput = linesCache->getOrNullptr(origin->offset);
+    /* We want the last origin that starts at or before idx. The first
+       origin always starts at 0. */
+    size_t lo = 0, hi = nrOrigins.load(std::memory_order_acquire);
+    if (hi == 0)
+        return nullptr;
+    while (hi - lo > 1) {
+        auto mid = lo + (hi - lo) / 2;
+        if (slot(mid).origin->offset <= idx)
+            lo = mid;
+        else
+            hi = mid;
     }
+    return &slot(lo);
+}
+
+PosTable::Origin PosTable::addOrigin(Pos::Origin origin, size_t size)
+{
+    auto state(state_.lock());
+    uint32_t offset = state->end;
+    // +1 because all PosIdx are offset by 1 to begin with, and
+    // another +1 to ensure that all origins can point to EOF, eg
+    // on (invalid) empty inputs.
+    if (2 + offset + size < offset)
+        return Origin{origin, offset, 0};
+
+    auto i = nrOrigins.load(std::memory_order_relaxed);
+    auto segment = std::bit_width(i / firstSegmentSize + 1) - 1;
+    assert(segment < segments.size());
+    if (!segments[segment].load(std::memory_order_relaxed))
+        segments[segment].store(new Slot[firstSegmentSize << segment], std::memory_order_release);
 
-    assert(linesForInput);
+    auto & s = slot(i);
+    s.origin.emplace(Origin{origin, offset, size});
+    state->end = offset + size;
+
+    /* Make the origin visible to lookups. */
+    nrOrigins.store(i + 1, std::memory_order_release);
+
+    return *s.origin;
+}
+
+const PosTable::Lines * PosTable::publishLines(const Slot & slot, Lines && lines)
+{
+    auto p = new Lines(std::move(lines));
+    const Lines * expected = nullptr;
+    if (slot.lines.compare_exchange_strong(expected, p, std::memory_order_acq_rel, std::memory_order_acquire))
+        return p;
+    /* Another thread got there first. */
+    delete p;
+    return expected;
+}
+
+void PosTable::addLines(const Origin & origin, Lines lines)
+{
+    auto slot = resolve(PosIdx(1 + origin.offset));
+    if (slot && slot->origin->offset == origin.offset)
+        publishLines(*slot, std::move(lines));
+}
+
+Pos PosTable::operator[](PosIdx p) const
+{
+    auto slot = resolve(p);
+    if (!slot)
+        return {};
+
+    auto & origin = *slot->origin;
+    const auto offset = origin.offsetOf(p);
+
+    Pos result{0, 0, origin.origin};
+
+    /* Compute the origin's line offsets the first time they're
+       needed. Threads that race to do this may compute them more than
+       once, but only one result is kept. */
+    auto linesForInput = slot->lines.load(std::memory_order_acquire);
+    if (!linesForInput)
+        linesForInput = publishLines(*slot, computeLines(result.getSource().value_or("")));
 
     // as above: the first line starts at byte 0 and is always present
     auto lineStartOffset = std::prev(std::upper_bound(linesForInput->begin(), linesForInput->end(), offset));
@@ -48,4 +123,15 @@ Pos PosTable::operator[](PosIdx p) const
     return result;
 }
 
+void PosTable::clear()
+{
+    auto state(state_.lock());
+    auto n = nrOrigins.exchange(0);
+    for (size_t i = 0; i < n; ++i)
+        delete slot(i).lines.load(std::memory_order_relaxed);
+    for (auto & segment : segments)
+        delete[] segment.exchange(nullptr);
+    state->end = 0;
+}
+
 } // namespace nix
@@ -2,6 +2,7 @@
 #include "nix/util/source-path.hh"
 #include "nix/util/signals.hh"
 #include "nix/util/sync.hh"
+#include "nix/util/archive.hh"
 
 #include <boost/unordered/concurrent_flat_map.hpp>
 
@@ -121,10 +122,11 @@ std::optional<SourceAccessor::Stat> PosixSourceAccessor::maybeLstat(const CanonP
     if (!st)
         return std::nullopt;
 
-    /* The contract is that trackLastModified implies that the caller uses the accessor
-       from a single thread. Thus this is not a CAS loop. */
-    if (trackLastModified)
-        mtime = std::max(mtime, st->st_mtime);
+    if (trackLastModified) {
+        auto prev = mtime.load();
+        while (prev < st->st_mtime && !mtime.compare_exchange_weak(prev, st->st_mtime))
+            ;
+    }
 
     return Stat{
         .type = S_ISREG(st->st_mode)   ? tRegular
@@ -196,6 +198,11 @@ SourceAccessor::DirEntries PosixSourceAccessor::readDirectory(const CanonPath &
     return res;
 }
 
+void PosixSourceAccessor::dumpPath(const CanonPath & path, Sink & sink, PathFilter & filter)
+{
+    dumpPathReadAhead(*this, path, sink, filter);
+}
+
 std::string PosixSourceAccessor::readLink(const CanonPath & path)
 {
     if (auto parent = path.parent())
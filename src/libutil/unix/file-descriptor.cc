@@ -69,6 +69,24 @@ void readFull(int fd, char * buf, size_t count)
     }
 }
 
+void readFullAt(int fd, char * buf, size_t count, uint64_t offset)
+{
+    while (count) {
+        checkInterrupt();
+        ssize_t res = pread(fd, buf, count, offset);
+        if (res == -1) {
+            if (errno == EINTR)
+                continue;
+            throw SysError("reading from file");
+        }
+        if (res == 0)
+            throw EndOfFile("unexpected end-of-file");
+        count -= res;
+        buf += res;
+        offset += res;
+    }
+}
+
 void writeFull(int fd, std::string_view s, bool allowInterrupts)
 {
     while (!s.empty()) {
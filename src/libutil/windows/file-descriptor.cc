@@ -40,6 +40,24 @@ void readFull(HANDLE handle, char * buf, size_t count)
     }
 }
 
+void readFullAt(HANDLE handle, char * buf, size_t count, uint64_t offset)
+{
+    while (count) {
+        checkInterrupt();
+        OVERLAPPED ov = {};
+        ov.Offset = (DWORD) offset;
+        ov.OffsetHigh = (DWORD) (offset >> 32);
+        DWORD res;
+        if (!ReadFile(handle, (char *) buf, count, &res, &ov))
+            throw WinError("%s:%d reading from file", __FILE__, __LINE__);
+        if (res == 0)
+            throw EndOfFile("unexpected end-of-file");
+        count -= res;
+        buf += res;
+        offset += res;
+    }
+}
+
 void writeFull(HANDLE handle, std::string_view s, bool allowInterrupts)
 {
     while (!s.empty()) {
@@ -121,9 +121,14 @@ struct CmdEval : MixJSON, InstallableValueCommand, MixReadOnlyOption
         }
 
         else if (json) {
-            // FIXME: use printJSON
-            auto j = printValueAsJSON(*state, true, *v, pos, context, false);
-            logger->cout("%s", state->devirtualize(outputPretty ? j.dump(2) : j.dump(), context));
+            if (outputPretty) {
+                auto j = printValueAsJSON(*state, true, *v, pos, context, false);
+                logger->cout("%s", state->devirtualize(j.dump(2), context));
+            } else {
+                StringSink sink;
+                printValueAsJSON(*state, true, *v, pos, sink, context, false);
+                logger->cout("%s", state->devirtualize(sink.s, context));
+            }
         }
 
         else {
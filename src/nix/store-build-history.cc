@@ -0,0 +1,124 @@
+#include "nix/cmd/command.hh"
+#include "nix/main/common-args.hh"
+#include "nix/main/shared.hh"
+#include "nix/store/store-api.hh"
+#include "nix/store/store-cast.hh"
+#include "nix/store/build-history.hh"
+#include "nix/util/table.hh"
+#include "nix/util/terminal.hh"
+
+#include <iomanip>
+
+#include <nlohmann/json.hpp>
+
+using namespace nix;
+
+struct CmdStoreBuildHistory : MixJSON, StoreCommand
+{
+    BuildHistoryQuery query;
+    std::optional<std::string> outputPath;
+
+    CmdStoreBuildHistory()
+    {
+        addFlag({
+            .longName = "name",
+            .description = "Only show builds of derivations named *name*, ignoring the version.",
+            .labels = {"name"},
+            .handler = {&query.name},
+        });
+
+        addFlag({
+            .longName = "output",
+            .description = "Only show builds that produced the store path *path*.",
+            .labels = {"path"},
+            .handler = {&outputPath},
+        });
+
+        addFlag({
+            .longName = "limit",
+            .description = "Show at most *n* builds.",
+            .labels = {"n"},
+            .handler = {&query.limit},
+        });
+    }
+
+    std::string description() override
+    {
+        return "show the history of builds performed by a Nix store";
+    }
+
+    std::string doc() override
+    {
+        return
+#include "store-build-history.md"
+            ;
+    }
+
+    void run(ref<Store> store) override
+    {
+        auto & historyStore = require<BuildHistoryStore>(*store);
+
+        if (outputPath)
+            query.outputPath = store->followLinksToStorePath(*outputPath);
+
+        auto builds = historyStore.queryBuildHistory(query);
+
+        if (json) {
+            printJSON(nlohmann::json(builds));
+            return;
+        }
+
+        if (builds.empty()) {
+            notice("No builds found.");
+            return;
+        }
+
+        auto formatSeconds = [](std::chrono::microseconds t) {
+            return fmt(
+                "%.1fs",
+                std::chrono::duration_cast<std::chrono::duration<float, std::chrono::seconds::period>>(t).count());
+        };
+
+        auto formatOptional = [](const auto & value, auto && format) -> TableCell {
+            return {value ? format(*value) : "-", TableCell::Alignment::Right};
+        };
+
+        auto formatSize = [](uint64_t n) { return renderSize(n); };
+
+        Table table;
+
+        table.push_back({
+            {"STARTED"},
+            {"STATUS"},
+            {"WALL", TableCell::Alignment::Right},
+            {"CPU", TableCell::Alignment::Right},
+            {"MEMORY", TableCell::Alignment::Right},
+            {"READ", TableCell::Alignment::Right},
+            {"WRITTEN", TableCell::Alignment::Right},
+            {"DERIVATION"},
+        });
+
+        for (auto & build : builds) {
+            std::optional<std::chrono::microseconds> cpuTime;
+            if (build.cpuUser && build.cpuSystem)
+                cpuTime = *build.cpuUser + *build.cpuSystem;
+
+            table.push_back({
+                fmt("%s", std::put_time(std::gmtime(&build.startTime), "%Y-%m-%d %H:%M:%S")),
+                build.status,
+                {fmt("%ds", build.stopTime - build.startTime), TableCell::Alignment::Right},
+                formatOptional(cpuTime, formatSeconds),
+                formatOptional(build.peakMemory, formatSize),
+                formatOptional(build.ioReadBytes, formatSize),
+                formatOptional(build.ioWriteBytes, formatSize),
+                store->printStorePath(build.drvPath),
+            });
+        }
+
+        auto width = isTTY() && isatty(STDOUT_FILENO) ? getWindowWidth() : std::numeric_limits<unsigned int>::max();
+
+        printTable(std::cout, table, width);
+    }
+};
+
+static auto rCmdStoreBuildHistory = registerCommand2<CmdStoreBuildHistory>({"store", "build-history"});
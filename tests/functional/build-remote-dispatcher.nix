@@ -0,0 +1,39 @@
+{
+  busybox,
+  salt ? "",
+}:
+with import ./config.nix;
+let
+
+  mkDerivation =
+    name: buildCommand:
+    derivation {
+      name = "${name}${salt}";
+      inherit system;
+      builder = busybox;
+      args = [
+        "sh"
+        "-e"
+        "-c"
+        buildCommand
+      ];
+    };
+
+in
+{
+
+  ok = mkDerivation "ok" ''
+    echo "building on the remote machine"
+    echo hello > $out
+  '';
+
+  failing = mkDerivation "failing" ''
+    echo "this build fails"
+    exit 1
+  '';
+
+  sleeping = mkDerivation "sleeping" ''
+    sleep 1000
+    touch $out
+  '';
+}
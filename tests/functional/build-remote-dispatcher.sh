@@ -0,0 +1,52 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+requireSandboxSupport
+requiresUnprivilegedUserNamespaces
+[[ "${busybox-}" =~ busybox ]] || skipTest "no busybox"
+
+# Avoid store dir being inside sandbox build-dir
+unset NIX_STORE_DIR
+
+chmod -R +w "$TEST_ROOT/machine"* || true
+rm -rf "$TEST_ROOT/machine"* || true
+
+file=build-remote-dispatcher.nix
+
+# Note: ssh://localhost and ssh-ng://localhost bypass ssh, directly
+# invoking nix-store or nix-daemon as a child process. This covers both
+# LegacySSHStore and RemoteStore.
+for i in 1 2; do
+    if [[ $i = 1 ]]; then
+        builder="ssh://localhost?remote-store=$TEST_ROOT/machine$i"
+    else
+        builder="ssh-ng://localhost?remote-store=$TEST_ROOT/machine$i"
+    fi
+
+    buildRemote() {
+        nix build -L -f "$file" --no-link --max-jobs 0 \
+            --arg busybox "$busybox" \
+            --argstr salt "-$i" \
+            --store "$TEST_ROOT/machine0" \
+            --builders "$builder - - 1 1" \
+            --option remote-build-dispatcher true \
+            "$@"
+    }
+
+    # A successful build is copied back from the remote machine.
+    outPath=$(buildRemote --print-out-paths ok)
+    grep hello "$TEST_ROOT/machine0/$outPath"
+    nix path-info --store "$TEST_ROOT/machine$i" "$outPath"
+
+    # The log stays on the remote machine; no empty log is kept locally.
+    expect 1 nix log --store "$TEST_ROOT/machine0" "$outPath"
+
+    # A failure on the remote machine fails the build.
+    expectStderr 100 buildRemote failing | grepQuiet "failing-$i.drv' on '$builder' failed"
+
+    # Timing out cancels the remote build instead of waiting for it.
+    start=$SECONDS
+    expectStderr 101 buildRemote --timeout 5 sleeping | grepQuiet "timed out"
+    (( SECONDS - start < 60 ))
+done
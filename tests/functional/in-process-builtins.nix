@@ -0,0 +1,48 @@
+with import ./config.nix;
+
+let
+
+  mkPkg =
+    name:
+    mkDerivation {
+      inherit name;
+      buildCommand = ''
+        mkdir -p $out/bin
+        echo ${name} > $out/bin/hello
+      '';
+    };
+
+  mkEnv =
+    pkgs:
+    derivation {
+      name = "user-environment";
+      system = "builtin";
+      builder = "builtin:buildenv";
+      manifest = builtins.toFile "manifest.nix" "[]";
+      derivations = map (pkg: [
+        "true"
+        5
+        1
+        pkg
+      ]) pkgs;
+    };
+
+in
+
+{
+  env = mkEnv [ (mkPkg "foo") ];
+
+  # The builtin warns about packages that are not directories.
+  file = mkEnv [
+    (mkDerivation {
+      name = "file";
+      buildCommand = "echo foo > $out";
+    })
+  ];
+
+  # Both packages provide bin/hello with the same priority.
+  collision = mkEnv [
+    (mkPkg "foo")
+    (mkPkg "bar")
+  ];
+}
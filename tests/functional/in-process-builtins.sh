@@ -0,0 +1,33 @@
+#!/usr/bin/env bash
+
+# Test running builtin builders in the Nix process.
+
+source common.sh
+
+# The debug messages of the builder are only visible when building locally.
+needLocalStore "the daemon does the build"
+
+TODO_NixOS
+
+clearStoreIfPossible
+
+# builtin:buildenv runs in-process and registers its output as usual.
+outPath=$(nix-build --no-out-link --debug in-process-builtins.nix -A env 2> "$TEST_ROOT/log")
+grepQuiet "running builder 'builtin:buildenv' in-process" "$TEST_ROOT/log"
+[[ $(cat "$outPath/bin/hello") = foo ]]
+[[ -L $outPath/manifest.nix ]]
+nix-store --verify-path "$outPath"
+
+# Failures of the builtin are reported in the build log.
+expectStderr 100 nix-build --no-out-link in-process-builtins.nix -A collision \
+    | grepQuiet "There is a conflict for the following files"
+
+# Messages of the builtin end up in the build log.
+outPath=$(nix-build --no-out-link in-process-builtins.nix -A file)
+nix-store -l "$outPath" | grepQuiet "not including .* in the user environment"
+
+# The setting disables it.
+clearStoreIfPossible
+outPath=$(nix-build --no-out-link --debug --option in-process-builtins false in-process-builtins.nix -A env 2> "$TEST_ROOT/log")
+grepQuietInverse "in-process" "$TEST_ROOT/log"
+[[ $(cat "$outPath/bin/hello") = foo ]]